@@ -2,11 +2,11 @@
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
-#define LITESPD_GL_LOG_ERROR(message)                                                                    \
-    do {                                                                                                 \
-        auto message___ = litespd::gl::lgi::format("[ERROR] %s(%d)\n%s\n", __FILE__, __LINE__, message); \
-        fprintf(stderr, message___.c_str());                                                             \
-        ::OutputDebugStringA(message___.c_str());                                                        \
+#define LITESPD_GL_LOG_ERROR(message)                                        \
+    do {                                                                     \
+        auto message___ = litespd::gl::lgi::format("[ERROR] %s\n", message); \
+        fprintf(stderr, message___.c_str());                                 \
+        ::OutputDebugStringA(message___.c_str());                            \
     } while (false)
 #define LITESPD_GL_LOG_WARNING(message)                                      \
     do {                                                                     \
@@ -0,0 +1,82 @@
+#include "test.h"
+#include <cstring>
+#include <random>
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("BC1 and BC4 blocks decode to known values", "[BlockDecoder]") {
+    uint8_t rgba[16 * 4];
+
+    SECTION("BC1 four color mode") {
+        // c0 = pure red, c1 = pure blue. Rows use index 0, 1, 2 and 3.
+        const uint8_t block[8] = {0x00, 0xF8, 0x1F, 0x00, 0x00, 0x55, 0xAA, 0xFF};
+        REQUIRE(TextureObject::decodeBlocks(0x83F1, block, 4, 4, rgba));
+        const uint8_t expected[4][4] = {{255, 0, 0, 255}, {0, 0, 255, 255}, {170, 0, 85, 255}, {85, 0, 170, 255}};
+        for (int y = 0; y < 4; ++y)
+            for (int x = 0; x < 4; ++x) CHECK(0 == memcmp(rgba + (y * 4 + x) * 4, expected[y], 4));
+    }
+
+    SECTION("BC1 three color mode has transparent black") {
+        // c0 <= c1 selects the three color palette, where index 3 is transparent black for RGBA DXT1.
+        const uint8_t block[8] = {0x1F, 0x00, 0x00, 0xF8, 0xFF, 0xFF, 0xFF, 0xFF};
+        REQUIRE(TextureObject::decodeBlocks(0x83F1, block, 4, 4, rgba));
+        for (int i = 0; i < 16; ++i) CHECK(0 == rgba[i * 4 + 3]);
+        REQUIRE(TextureObject::decodeBlocks(0x83F0, block, 4, 4, rgba)); // RGB DXT1 stays opaque.
+        for (int i = 0; i < 16; ++i) CHECK(255 == rgba[i * 4 + 3]);
+    }
+
+    SECTION("BC4 eight value mode") {
+        // r0 = 255, r1 = 0. All indices are 2, the first interpolated value: (6 * 255 + 0) / 7.
+        const uint8_t block[8] = {255, 0, 0x92, 0x24, 0x49, 0x92, 0x24, 0x49};
+        REQUIRE(TextureObject::decodeBlocks(0x8DBB, block, 4, 4, rgba));
+        for (int i = 0; i < 16; ++i) {
+            CHECK(218 == rgba[i * 4]);
+            CHECK(255 == rgba[i * 4 + 3]);
+        }
+    }
+
+    SECTION("partial blocks are clipped") {
+        const uint8_t block[8] = {0x00, 0xF8, 0x00, 0xF8, 0, 0, 0, 0};
+        uint8_t       small[3 * 2 * 4];
+        REQUIRE(TextureObject::decodeBlocks(0x83F1, block, 3, 2, small));
+        for (int i = 0; i < 6; ++i) CHECK(255 == small[i * 4]);
+    }
+
+    SECTION("unknown formats are rejected") {
+        const uint8_t block[16] = {};
+        CHECK_FALSE(TextureObject::decodeBlocks(GL_RGBA8, block, 4, 4, rgba));
+        CHECK_FALSE(TextureObject::decodeBlocks(0x8E8C, block, 4, 4, rgba)); // BC7 needs a fallback decoder.
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("software BC1-BC5 decoding matches the driver", "[BlockDecoder]") {
+    testContext();
+    const uint32_t W = 16, H = 16;
+    std::mt19937   rng(1234);
+    for (GLenum format : {0x83F0u, 0x83F1u, 0x83F2u, 0x83F3u, 0x8DBBu, 0x8DBDu}) {
+        if (!TextureObject::isFormatSupported(format)) continue;
+        INFO("format 0x" << std::hex << format);
+        std::vector<uint8_t> blocks(TextureObject::compressedImageSize(format, W, H));
+        for (auto & b : blocks) b = (uint8_t) rng();
+
+        TextureObject texture;
+        texture.allocate2D(format, W, H);
+        texture.setCompressedPixels(0, 0, 0, W, H, blocks.data(), blocks.size());
+        std::vector<uint8_t> gpu(W * H * 4);
+        texture.bind(0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, gpu.data());
+        texture.unbind();
+
+        std::vector<uint8_t> cpu(W * H * 4);
+        REQUIRE(TextureObject::decodeBlocks(format, blocks.data(), W, H, cpu.data()));
+        // Interpolated palette entries may round differently.
+        int maxDiff = 0;
+        for (size_t i = 0; i < cpu.size(); ++i) maxDiff = std::max(maxDiff, std::abs((int) cpu[i] - (int) gpu[i]));
+        CHECK(maxDiff <= 1);
+    }
+}
@@ -0,0 +1,90 @@
+#include "test.h"
+#include <random>
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+static bool overlap(const BufferAllocator::Allocation & a, const BufferAllocator::Allocation & b) {
+    return a.buffer == b.buffer && a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("buddy allocator rounds block size up to power of 2", "[BufferAllocator]") {
+    testContext();
+    BufferAllocator ba;
+    ba.init(GL_ARRAY_BUFFER, 1024, GL_STATIC_DRAW, 24);
+
+    // 24 becomes 32. Blocks are aligned to their own size.
+    auto a = ba.alloc(24);
+    auto b = ba.alloc(24);
+    auto c = ba.alloc(48);
+    REQUIRE((a && b && c));
+    CHECK(a.offset % 32 == 0);
+    CHECK(b.offset % 32 == 0);
+    CHECK(c.offset % 64 == 0);
+    CHECK(!overlap(a, b));
+    CHECK(!overlap(b, c));
+    CHECK(!overlap(a, c));
+
+    // Freeing everything merges back into a single block.
+    ba.free(b);
+    ba.free(a);
+    ba.free(c);
+    auto s = ba.stats();
+    CHECK(1 == s.pages);
+    CHECK(1024 == s.capacity);
+    CHECK(1024 == s.freeBytes);
+    CHECK(1024 == s.largestFreeBlock);
+    CHECK(0 == s.allocations);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("buddy allocator handles random alloc and free", "[BufferAllocator]") {
+    testContext();
+    BufferAllocator ba;
+    ba.init(GL_ARRAY_BUFFER, 64 * 1024, GL_STATIC_DRAW, 256);
+
+    std::mt19937                             rng(1234);
+    std::vector<BufferAllocator::Allocation> live;
+    for (int i = 0; i < 2000; ++i) {
+        if (live.empty() || rng() % 3 != 0) {
+            auto a = ba.alloc(1 + rng() % 8192);
+            REQUIRE(a);
+            CHECK(a.offset % 16 == 0);
+            for (const auto & l : live) REQUIRE(!overlap(a, l));
+            live.push_back(a);
+        } else {
+            auto i2 = rng() % live.size();
+            ba.free(live[i2]);
+            live[i2] = live.back();
+            live.pop_back();
+        }
+    }
+    CHECK(live.size() == ba.stats().allocations);
+
+    for (auto & l : live) ba.free(l);
+    auto s = ba.stats();
+    CHECK(1 == s.pages);
+    CHECK(s.capacity == s.freeBytes);
+    CHECK(s.capacity == s.largestFreeBlock);
+    CHECK(0 == s.requestedBytes);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("allocations larger than a page get a dedicated page", "[BufferAllocator]") {
+    testContext();
+    BufferAllocator ba;
+    ba.init(GL_ARRAY_BUFFER, 4096);
+    auto small = ba.alloc(100);
+    auto large = ba.alloc(10000);
+    REQUIRE((small && large));
+    CHECK(small.buffer != large.buffer);
+    CHECK(2 == ba.stats().pages);
+    ba.free(large);
+    CHECK(1 == ba.stats().pages);
+    ba.free(small);
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("dirty ranges are sorted and coalesced", "[DirtyRanges]") {
+    DirtyRanges d;
+    CHECK(d.empty());
+    d.add(10, 20);
+    d.add(20, 25); // adjacent
+    d.add(2, 4);   // out of order
+    d.add(3, 6);   // overlapping
+    d.add(30, 30); // empty
+    auto & r = d.ranges();
+    REQUIRE(2 == r.size());
+    CHECK((2 == r[0].begin && 6 == r[0].end));
+    CHECK((10 == r[1].begin && 25 == r[1].end));
+    CHECK(19 == d.count());
+    d.clear();
+    CHECK(d.empty());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("syncDirtyRanges uploads only what is dirty, if anything is tracked", "[DirtyRanges]") {
+    std::vector<int>                       c(100);
+    DirtyRanges                            dirty;
+    BufferSyncStats                        stats;
+    std::vector<std::pair<size_t, size_t>> uploads;
+    auto                                   upload = [&](size_t first, size_t count) { uploads.emplace_back(first, count); };
+
+    SECTION("nothing tracked uploads everything") {
+        // c was written directly, without marking anything dirty.
+        lgi::syncDirtyRanges(c, dirty, 0.5f, stats, upload);
+        REQUIRE(1 == uploads.size());
+        CHECK((0 == uploads[0].first && 100 == uploads[0].second));
+        CHECK(1 == stats.fullUploads);
+        CHECK(100 * sizeof(int) == stats.uploadedBytes);
+        CHECK(0 == stats.skippedBytes);
+    }
+
+    SECTION("partial upload") {
+        dirty.add(5, 10);
+        dirty.add(50, 51);
+        lgi::syncDirtyRanges(c, dirty, 0.5f, stats, upload);
+        REQUIRE(2 == uploads.size());
+        CHECK((5 == uploads[0].first && 5 == uploads[0].second));
+        CHECK((50 == uploads[1].first && 1 == uploads[1].second));
+        CHECK(6 * sizeof(int) == stats.uploadedBytes);
+        CHECK(dirty.empty());
+    }
+
+    SECTION("full upload above threshold") {
+        dirty.add(0, 60);
+        lgi::syncDirtyRanges(c, dirty, 0.5f, stats, upload);
+        REQUIRE(1 == uploads.size());
+        CHECK((0 == uploads[0].first && 100 == uploads[0].second));
+        CHECK(1 == stats.fullUploads);
+    }
+
+    SECTION("ranges past the end are clamped") {
+        dirty.add(95, 120);
+        lgi::syncDirtyRanges(c, dirty, 0.5f, stats, upload);
+        REQUIRE(1 == uploads.size());
+        CHECK((95 == uploads[0].first && 5 == uploads[0].second));
+    }
+}
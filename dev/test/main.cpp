@@ -0,0 +1,16 @@
+#define CATCH_CONFIG_MAIN
+#include "test.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+litespd::gl::RenderContext & testContext() {
+    static litespd::gl::RenderContext rc([] {
+        litespd::gl::RenderContext::CreateParams cp;
+        cp.width            = 64;
+        cp.height           = 64;
+        cp.debug            = true;
+        cp.debugSynchronous = true;
+        return cp;
+    }());
+    return rc;
+}
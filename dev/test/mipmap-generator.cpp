@@ -0,0 +1,91 @@
+#include "test.h"
+#include <cstring>
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("box filtered RGBA8 mips", "[MipmapGenerator]") {
+    // 4x2: left half (0, 100, 200, 255) / (100, 200, 0, 255), right half all 50.
+    std::vector<uint8_t> base = {0, 100, 200, 255, 100, 200, 0, 255, 50, 50, 50, 50, 50, 50, 50, 50,  // row 0
+                                 100, 200, 0, 255, 0, 100, 200, 255, 50, 50, 50, 50, 50, 50, 50, 50}; // row 1
+    MipmapGenerator gen;
+    auto            mips = gen.generate(base.data(), 4, 2);
+    REQUIRE(2 == mips.size()); // 2x1, 1x1
+    CHECK(mips[0] == std::vector<uint8_t> {50, 150, 100, 255, 50, 50, 50, 50});
+    CHECK(mips[1] == std::vector<uint8_t> {50, 100, 75, 153});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("mip chain of odd sizes", "[MipmapGenerator]") {
+    std::vector<uint8_t> base(5 * 3 * 4, 77);
+    MipmapGenerator      gen;
+    auto                 mips = gen.generate(base.data(), 5, 3);
+    REQUIRE(2 == mips.size()); // 2x1, 1x1
+    CHECK(mips[0] == std::vector<uint8_t>(2 * 1 * 4, 77));
+    CHECK(mips[1] == std::vector<uint8_t>(4, 77));
+    CHECK(1 == gen.generate(base.data(), 5, 3, 2).size());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("sRGB mips are filtered in linear space", "[MipmapGenerator]") {
+    std::vector<uint8_t> base = {0, 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 0};
+    MipmapGenerator      gen;
+    gen.format = MipmapGenerator::Format::RGBA8_SRGB;
+    auto mips  = gen.generate(base.data(), 2, 2);
+    REQUIRE(1 == mips.size());
+    // Linear 0.5 is sRGB 188, while a naive average of the encoded values would give 128. Alpha is linear.
+    for (int c = 0; c < 3; ++c) CHECK(std::abs((int) mips[0][c] - 188) <= 1);
+    CHECK(128 == mips[0][3]);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("half float mips", "[MipmapGenerator]") {
+    // 1.0, 3.0, 0.5 and -2.0, averaged per channel across a 2x1 image.
+    std::vector<uint16_t> base = {0x3C00, 0x3C00, 0x3800, 0xC000, 0x4200, 0x4200, 0x3800, 0xC000};
+    MipmapGenerator       gen;
+    gen.format = MipmapGenerator::Format::RGBA16F;
+    auto mips  = gen.generate(base.data(), 2, 1);
+    REQUIRE(1 == mips.size());
+    REQUIRE(8 == mips[0].size());
+    uint16_t h[4];
+    memcpy(h, mips[0].data(), 8);
+    CHECK(0x4000 == h[0]); // 2.0
+    CHECK(0x4000 == h[1]);
+    CHECK(0x3800 == h[2]); // 0.5
+    CHECK(0xC000 == h[3]); // -2.0
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("Kaiser filter preserves constant images", "[MipmapGenerator]") {
+    std::vector<float> base(64 * 64 * 4);
+    for (size_t i = 0; i < base.size(); ++i) base[i] = (float) (i % 4) * 0.25f;
+    MipmapGenerator gen;
+    gen.format = MipmapGenerator::Format::RGBA32F;
+    gen.filter = MipmapGenerator::Filter::KAISER;
+    auto mips  = gen.generate(base.data(), 64, 64);
+    REQUIRE(6 == mips.size());
+    for (const auto & level : mips) {
+        auto f = (const float *) level.data();
+        for (size_t i = 0; i < level.size() / 4; ++i) CHECK(std::abs(f[i] - (float) (i % 4) * 0.25f) < 1e-4f);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("threaded mips match single threaded ones", "[MipmapGenerator]") {
+    std::vector<uint8_t> base(512 * 384 * 4);
+    for (size_t i = 0; i < base.size(); ++i) base[i] = (uint8_t) (i * 31 + i / 7);
+    for (auto filter : {MipmapGenerator::Filter::BOX, MipmapGenerator::Filter::KAISER}) {
+        MipmapGenerator gen;
+        gen.filter  = filter;
+        gen.threads = 1;
+        auto single = gen.generate(base.data(), 512, 384);
+        gen.threads = 8;
+        CHECK(single == gen.generate(base.data(), 512, 384));
+    }
+}
@@ -0,0 +1,83 @@
+#include "test.h"
+#include <cstring>
+
+using namespace litespd::gl;
+
+namespace {
+
+// float a; vec2 b; vec3 c; float d[3]; mat3 e; int f;
+using Std140 = UniformBlock<float, glm::vec2, glm::vec3, float[3], glm::mat3, int>;
+using Std430 = StorageBlock<float, glm::vec2, glm::vec3, float[3], glm::mat3, int>;
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("block layouts follow std140 and std430 rules", "[ShaderBlock]") {
+    // std140 rounds array elements and matrix columns up to vec4.
+    static_assert(0 == Std140::offset<0>() && 8 == Std140::offset<1>() && 16 == Std140::offset<2>());
+    static_assert(32 == Std140::offset<3>() && 16 == Std140::LAYOUT_[3].arrayStride);
+    static_assert(80 == Std140::offset<4>() && 16 == Std140::LAYOUT_[4].matrixStride);
+    static_assert(128 == Std140::offset<5>() && 144 == Std140::SIZE);
+
+    // std430 packs scalar arrays tightly. vec3 columns of mat3 are still vec4 aligned.
+    static_assert(0 == Std430::offset<0>() && 8 == Std430::offset<1>() && 16 == Std430::offset<2>());
+    static_assert(28 == Std430::offset<3>() && 4 == Std430::LAYOUT_[3].arrayStride);
+    static_assert(48 == Std430::offset<4>() && 16 == Std430::LAYOUT_[4].matrixStride);
+    static_assert(96 == Std430::offset<5>() && 112 == Std430::SIZE);
+
+    // vec3 followed by a scalar shares the vec4 slot in both layouts.
+    using Packed = UniformBlock<glm::vec3, float, glm::mat4>;
+    static_assert(12 == Packed::offset<1>() && 16 == Packed::offset<2>() && 80 == Packed::SIZE);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("block layouts match program reflection", "[ShaderBlock]") {
+    testContext();
+    const char * cs = R"(
+        #version 430
+        layout(local_size_x = 1) in;
+        layout(std140, binding = 0) uniform U { float a; vec2 b; vec3 c; float d[3]; mat3 e; int f; };
+        layout(std430, binding = 1) buffer S { float sa; vec2 sb; vec3 sc; float sd[3]; mat3 se; int sf; };
+        void main() {
+            sa = a + b.x + c.z + d[2] + e[2][2] + float(f);
+            sb = b; sc = c; sd[0] = d[0]; sd[1] = d[1]; sd[2] = d[2]; se = e; sf = f;
+        }
+    )";
+    SimpleGlslProgram program("shader-block-test");
+    REQUIRE(program.loadCs(cs));
+
+    Std140 u;
+    Std430 s;
+    CHECK(u.verify(program, "U", {"a", "b", "c", "d", "e", "f"}));
+    CHECK(s.verify(program, "S", {"sa", "sb", "sc", "sd[0]", "se", "sf"}));
+
+    // A layout that disagrees with the program is reported.
+    UniformBlock<float, glm::vec3, glm::vec3, float[3], glm::mat3, int> wrong;
+    CHECK_FALSE(wrong.verify(program, "U", {"a", "b", "c", "d", "e", "f"}));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("block members are packed at their offsets", "[ShaderBlock]") {
+    Std140 u;
+    float  m[9] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    glm::mat3 e;
+    memcpy(&e, m, sizeof(m));
+    u.set<1>(glm::vec2(10.f, 11.f)).set<3>(12.f, 2).set<4>(e).set<5>(-1);
+
+    auto read = [&](size_t offset) {
+        float v;
+        memcpy(&v, u.data() + offset, 4);
+        return v;
+    };
+    CHECK(10.f == read(8));
+    CHECK(11.f == read(12));
+    CHECK(12.f == read(32 + 2 * 16));
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r) CHECK(m[c * 3 + r] == read(80 + (size_t) c * 16 + (size_t) r * 4));
+    int f;
+    memcpy(&f, u.data() + 128, 4);
+    CHECK(-1 == f);
+}
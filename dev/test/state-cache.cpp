@@ -0,0 +1,46 @@
+#include "test.h"
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+static GLuint elementArrayBinding(GLuint va) {
+    StateCache::current().bindVertexArray(va);
+    GLint ib = 0;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &ib);
+    return (GLuint) ib;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("index buffer of the last drawn mesh survives unrelated index buffer uploads", "[StateCache]") {
+    testContext();
+    SimpleFBO target(1, false);
+    target.allocate(16, 16, 1, GL_RGBA8);
+    target.bind();
+
+    const SimpleMesh::Vertex vertices[] = {
+        SimpleMesh::Vertex::create().setPosition({-1.f, -1.f, 0.f}),
+        SimpleMesh::Vertex::create().setPosition({+1.f, -1.f, 0.f}),
+        SimpleMesh::Vertex::create().setPosition({+1.f, +1.f, 0.f}),
+        SimpleMesh::Vertex::create().setPosition({-1.f, +1.f, 0.f}),
+    };
+    const uint16_t indices[] = {0, 1, 2, 0, 2, 3};
+    SimpleMesh     mesh;
+    mesh.allocate(SimpleMesh::AllocateParameters().setVertices(std::size(vertices), vertices).setIndex16(std::size(indices), indices));
+    REQUIRE(elementArrayBinding(mesh.va) == mesh.ib.bo);
+
+    mesh.draw();
+    CHECK(GL_NO_ERROR == glGetError());
+
+    // Allocate and update an unrelated index buffer, while the mesh's vertex array is still bound.
+    BufferObject<GL_ELEMENT_ARRAY_BUFFER> other;
+    other.allocate(sizeof(uint16_t), std::size(indices), indices);
+    other.update(indices, 0, std::size(indices));
+
+    mesh.draw();
+    CHECK(GL_NO_ERROR == glGetError());
+    CHECK(elementArrayBinding(mesh.va) == mesh.ib.bo);
+    StateCache::current().bindVertexArray(0);
+    StateCache::current().bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
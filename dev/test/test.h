@@ -0,0 +1,6 @@
+#pragma once
+#include "../lgl.h"
+#include <catch2/catch.hpp>
+
+/// Returns the GL context shared by all tests, creating it on first call. The context is current to the calling thread.
+litespd::gl::RenderContext & testContext();
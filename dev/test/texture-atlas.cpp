@@ -0,0 +1,85 @@
+#include "test.h"
+#include <random>
+
+using namespace litespd::gl;
+
+namespace {
+
+bool overlaps(const TextureAtlas::Region & a, const TextureAtlas::Region & b, uint32_t padding) {
+    if (a.layer != b.layer) return false;
+    return a.x - padding < b.x + b.w + padding && b.x - padding < a.x + a.w + padding && a.y - padding < b.y + b.h + padding &&
+           b.y - padding < a.y + a.h + padding;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("atlas regions never overlap", "[TextureAtlas]") {
+    testContext();
+    TextureAtlas atlas;
+    atlas.allocate(GL_RGBA8, 256, 1, 8, 2);
+
+    std::mt19937                      rng(1234);
+    std::vector<TextureAtlas::Region> live;
+    std::vector<uint32_t>             pixels(48 * 48, 0xFFFFFFFFu);
+    for (int i = 0; i < 300; ++i) {
+        if (!live.empty() && rng() % 3 == 0) {
+            auto k = rng() % live.size();
+            atlas.remove(live[k].id);
+            CHECK(nullptr == atlas.find(live[k].id));
+            live.erase(live.begin() + (std::ptrdiff_t) k);
+            continue;
+        }
+        auto r = atlas.insert(1 + (uint32_t) (rng() % 48), 1 + (uint32_t) (rng() % 48), pixels.data(), GL_RGBA, GL_UNSIGNED_BYTE);
+        if (!r) continue; // all layers are full.
+        CHECK(r.x >= 2);
+        CHECK(r.y >= 2);
+        CHECK(r.x + r.w + 2 <= 256);
+        CHECK(r.y + r.h + 2 <= 256);
+        for (const auto & other : live) CHECK_FALSE(overlaps(r, other, 2));
+        live.push_back(r);
+    }
+    CHECK(live.size() == atlas.regionCount());
+    CHECK(atlas.texture().desc().depth > 1); // grew beyond the initial layer.
+    CHECK(atlas.texture().desc().depth <= 8);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("atlas pixels survive growing", "[TextureAtlas]") {
+    testContext();
+    TextureAtlas atlas;
+    atlas.allocate(GL_RGBA8, 32, 1, 2, 1);
+
+    // Each 14x14 image takes 16x16 with padding, so 4 fill the first layer and the 5th grows the array.
+    std::vector<TextureAtlas::Region> regions;
+    for (uint32_t i = 0; i < 5; ++i) {
+        std::vector<uint32_t> pixels(14 * 14, 0xFF000000u | i);
+        regions.push_back(atlas.insert(14, 14, pixels.data(), GL_RGBA, GL_UNSIGNED_BYTE));
+        REQUIRE(regions.back());
+    }
+    CHECK(1 == regions[4].layer);
+    std::vector<uint32_t> big(32 * 32);
+    CHECK_FALSE(atlas.insert(32, 32, big.data(), GL_RGBA, GL_UNSIGNED_BYTE)); // larger than a layer.
+
+    for (uint32_t layer = 0; layer < 2; ++layer) {
+        auto bytes = atlas.texture().getBaseLevelPixels(layer);
+        REQUIRE(32 * 32 * 4 == bytes.size());
+        auto texels = (const uint32_t *) bytes.data();
+        for (uint32_t i = 0; i < 5; ++i) {
+            const auto & r = regions[i];
+            if (r.layer != layer) continue;
+            // Content, and the replicated edge in the padding.
+            CHECK(texels[r.y * 32 + r.x] == (0xFF000000u | i));
+            CHECK(texels[(r.y + r.h - 1) * 32 + r.x + r.w - 1] == (0xFF000000u | i));
+            CHECK(texels[(r.y - 1) * 32 + r.x - 1] == (0xFF000000u | i));
+        }
+    }
+
+    // Freed space is reused.
+    atlas.remove(regions[1].id);
+    std::vector<uint32_t> pixels(14 * 14, 0xFF0000FFu);
+    auto                  r = atlas.insert(14, 14, pixels.data(), GL_RGBA, GL_UNSIGNED_BYTE);
+    CHECK((r.layer == regions[1].layer && r.x == regions[1].x && r.y == regions[1].y));
+}
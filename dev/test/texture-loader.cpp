@@ -0,0 +1,142 @@
+#include "test.h"
+#include <cstring>
+
+using namespace litespd::gl;
+
+namespace {
+
+template<typename T>
+void put(std::vector<uint8_t> & file, size_t offset, T value) {
+    memcpy(file.data() + offset, &value, sizeof(T));
+}
+
+// RGBA8 KTX2 file with a full mip chain. Texel i of each image is (i, level, layer, 0xFF).
+std::vector<uint8_t> makeKTX2(uint32_t width, uint32_t height, uint32_t layers, uint32_t levels) {
+    static const uint8_t ID[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+    std::vector<uint8_t> file(80 + levels * 24);
+    memcpy(file.data(), ID, 12);
+    put<uint32_t>(file, 12, 37); // VK_FORMAT_R8G8B8A8_UNORM
+    put<uint32_t>(file, 16, 1);
+    put<uint32_t>(file, 20, width);
+    put<uint32_t>(file, 24, height);
+    put<uint32_t>(file, 32, layers > 1 ? layers : 0);
+    put<uint32_t>(file, 36, 1);
+    put<uint32_t>(file, 40, levels);
+    for (uint32_t level = 0; level < levels; ++level) {
+        auto w      = std::max(1u, width >> level);
+        auto h      = std::max(1u, height >> level);
+        auto offset = file.size();
+        for (uint32_t layer = 0; layer < std::max(1u, layers); ++layer)
+            for (uint32_t i = 0; i < w * h; ++i) file.insert(file.end(), {(uint8_t) i, (uint8_t) level, (uint8_t) layer, 0xFF});
+        put<uint64_t>(file, 80 + level * 24, offset);
+        put<uint64_t>(file, 80 + level * 24 + 8, file.size() - offset);
+        put<uint64_t>(file, 80 + level * 24 + 16, file.size() - offset);
+    }
+    return file;
+}
+
+// Uncompressed RGBA8 DDS file, with the same texel pattern as makeKTX2().
+std::vector<uint8_t> makeDDS(uint32_t width, uint32_t height, uint32_t levels) {
+    std::vector<uint8_t> file(128);
+    memcpy(file.data(), "DDS ", 4);
+    put<uint32_t>(file, 4, 124);
+    put<uint32_t>(file, 4 + 8, height);
+    put<uint32_t>(file, 4 + 12, width);
+    put<uint32_t>(file, 4 + 24, levels);
+    put<uint32_t>(file, 4 + 72, 32);         // DDS_PIXELFORMAT::dwSize
+    put<uint32_t>(file, 4 + 72 + 4, 0x41);   // DDPF_RGB | DDPF_ALPHAPIXELS
+    put<uint32_t>(file, 4 + 72 + 12, 32);    // RGB bit count
+    put<uint32_t>(file, 4 + 72 + 16, 0xFF);  // R mask
+    for (uint32_t level = 0; level < levels; ++level) {
+        auto n = std::max(1u, width >> level) * std::max(1u, height >> level);
+        for (uint32_t i = 0; i < n; ++i) file.insert(file.end(), {(uint8_t) i, (uint8_t) level, 0, 0xFF});
+    }
+    return file;
+}
+
+std::vector<uint8_t> expectedPixels(uint32_t width, uint32_t height, uint32_t layer) {
+    std::vector<uint8_t> pixels;
+    for (uint32_t i = 0; i < width * height; ++i) pixels.insert(pixels.end(), {(uint8_t) i, 0, (uint8_t) layer, 0xFF});
+    return pixels;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("KTX2 files are loaded", "[TextureLoader]") {
+    testContext();
+
+    SECTION("2D with mips") {
+        auto          file = makeKTX2(8, 4, 0, 4);
+        TextureObject texture;
+        REQUIRE(loadTextureFromMemory(file.data(), file.size(), texture));
+        CHECK(texture.desc().is2D());
+        CHECK(8 == texture.desc().width);
+        CHECK(4 == texture.desc().height);
+        CHECK(4 == texture.desc().mips);
+        CHECK(texture.getBaseLevelPixels() == expectedPixels(8, 4, 0));
+    }
+
+    SECTION("2D array") {
+        auto          file = makeKTX2(4, 4, 3, 1);
+        TextureObject texture;
+        REQUIRE(loadTextureFromMemory(file.data(), file.size(), texture));
+        CHECK(texture.desc().is2DArray());
+        CHECK(3 == texture.desc().depth);
+        CHECK(texture.getBaseLevelPixels(2) == expectedPixels(4, 4, 2));
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("malformed KTX2 files are rejected", "[TextureLoader]") {
+    testContext();
+    auto          file = makeKTX2(8, 8, 0, 1);
+    TextureObject texture;
+
+    SECTION("truncated") { file.resize(file.size() - 1); }
+    SECTION("huge layer count") { put<uint32_t>(file, 32, 0x40000000); }
+    SECTION("huge size") { put<uint32_t>(file, 20, 0xFFFFFFFF), put<uint32_t>(file, 24, 0xFFFFFFFF); }
+    SECTION("invalid face count") { put<uint32_t>(file, 36, 3); }
+    SECTION("too many mips") {
+        file.resize(80 + 5 * 24, 0);
+        put<uint32_t>(file, 40, 5);
+    }
+    SECTION("level out of range") { put<uint64_t>(file, 80, 0xFFFFFFFFFFFFFF00ull); }
+
+    CHECK_FALSE(loadTextureFromMemory(file.data(), file.size(), texture));
+    CHECK(texture.empty());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("DDS files are loaded", "[TextureLoader]") {
+    testContext();
+    auto          file = makeDDS(4, 8, 4);
+    TextureObject texture;
+    REQUIRE(loadTextureFromMemory(file.data(), file.size(), texture));
+    CHECK(4 == texture.desc().width);
+    CHECK(8 == texture.desc().height);
+    CHECK(4 == texture.desc().mips);
+    CHECK(texture.getBaseLevelPixels() == expectedPixels(4, 8, 0));
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("malformed DDS files are rejected", "[TextureLoader]") {
+    testContext();
+    auto          file = makeDDS(4, 4, 1);
+    TextureObject texture;
+
+    SECTION("truncated") { file.resize(file.size() - 1); }
+    SECTION("huge size") { put<uint32_t>(file, 4 + 8, 0x10000000), put<uint32_t>(file, 4 + 12, 0x10000000); }
+    SECTION("too many mips") { put<uint32_t>(file, 4 + 24, 4); }
+    SECTION("non-square cube") {
+        put<uint32_t>(file, 4 + 8, 2);
+        put<uint32_t>(file, 4 + 108, 0xFE00); // DDSCAPS2_CUBEMAP with all faces
+    }
+
+    CHECK_FALSE(loadTextureFromMemory(file.data(), file.size(), texture));
+    CHECK(texture.empty());
+}
@@ -0,0 +1,49 @@
+#include "test.h"
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("pooled frame buffers are reused", "[TexturePool]") {
+    testContext();
+    TexturePool pool;
+    auto        color = pool.acquire2D(GL_RGBA8, 16, 16);
+    auto        fbo   = pool.framebuffer({&color});
+    CHECK(0 != fbo);
+    CHECK(fbo == pool.framebuffer({&color}));
+    CHECK(1 == pool.stats().framebuffers);
+
+    // Released textures stay attached until evicted.
+    pool.release(std::move(color));
+    for (uint32_t i = 0; i <= pool.maxIdleFrames; ++i) pool.update();
+    CHECK(0 == pool.stats().idleTextures);
+    CHECK(0 == pool.stats().framebuffers);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("frame buffers of deleted textures are dropped", "[TexturePool]") {
+    testContext();
+    TexturePool pool;
+    GLuint      oldName;
+    {
+        // Destroyed without being released to the pool.
+        auto color = pool.acquire2D(GL_RGBA8, 16, 16);
+        oldName    = color.id();
+        pool.framebuffer({&color});
+        CHECK(1 == pool.stats().framebuffers);
+    }
+    CHECK(0 == pool.stats().framebuffers);
+
+    // A new texture, which may well get the recycled name, must get an FBO of its own.
+    auto color = pool.acquire2D(GL_RGBA8, 16, 16);
+    auto fbo   = pool.framebuffer({&color});
+    INFO("old name " << oldName << ", new name " << color.id());
+    GLint attached = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &attached);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    StateCache::current().invalidate();
+    CHECK((GLuint) attached == color.id());
+    CHECK(GL_NO_ERROR == glGetError());
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+using namespace litespd::gl;
+
+namespace {
+
+uint8_t texel(uint32_t level, size_t i) { return (uint8_t) (i * 3 + level * 50); }
+
+bool fill(uint32_t level, void * dst, size_t size) {
+    for (size_t i = 0; i < size; ++i) ((uint8_t *) dst)[i] = texel(level, i);
+    return true;
+}
+
+GLint texParameter(const TextureObject & texture, GLenum name) {
+    GLint value = -1;
+    texture.bind(0);
+    glGetTexParameteriv(GL_TEXTURE_2D, name, &value);
+    texture.unbind();
+    return value;
+}
+
+// Update the streamer until every stream is done. Decoding happens on worker threads, so give them real time.
+void pump(TextureStreamer & ts) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (ts.pending() > 0 && std::chrono::steady_clock::now() < deadline) {
+        ts.update();
+        glFlush();
+        std::this_thread::yield();
+    }
+    CHECK(0 == ts.pending());
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("mip levels stream coarsest first over all textures", "[TextureStreamer]") {
+    testContext();
+    TextureObject a, b;
+    a.allocate2D(GL_RGBA8, 16, 16, 5);
+    b.allocate2D(GL_RGBA8, 4, 4, 3);
+    auto maxLevel = texParameter(a, GL_TEXTURE_MAX_LEVEL);
+
+    // A single worker decodes slots in the order they were dispatched.
+    std::mutex               mutex;
+    std::vector<std::string> order;
+    auto                     decoder = [&](const char * name) {
+        return [&, name](uint32_t, uint32_t level, void * dst, size_t size) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(name + std::to_string(level));
+            }
+            return fill(level, dst, size);
+        };
+    };
+
+    TextureStreamer ts;
+    ts.init(1, 1);
+    auto ha = ts.load(a, GL_RGBA, GL_UNSIGNED_BYTE, 4, decoder("a"));
+    auto hb = ts.load(b, GL_RGBA, GL_UNSIGNED_BYTE, 4, decoder("b"));
+    CHECK(TextureStreamer::Status::LOADING == ts.status(ha));
+    CHECK(5 == ts.visibleLevel(ha));
+    CHECK(4 == texParameter(a, GL_TEXTURE_BASE_LEVEL));
+    pump(ts);
+
+    CHECK(order == std::vector<std::string> {"a4", "a3", "a2", "b2", "a1", "b1", "a0", "b0"});
+    for (auto h : {ha, hb}) {
+        CHECK(TextureStreamer::Status::LOADED == ts.status(h));
+        CHECK(ts.loaded(h));
+        CHECK(0 == ts.visibleLevel(h));
+    }
+
+    // The texture's own mip range is back once streaming is done.
+    CHECK(0 == texParameter(a, GL_TEXTURE_BASE_LEVEL));
+    CHECK(maxLevel == texParameter(a, GL_TEXTURE_MAX_LEVEL));
+    auto pixels = a.getBaseLevelPixels();
+    REQUIRE(16 * 16 * 4 == pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) REQUIRE(texel(0, i) == pixels[i]);
+    CHECK(GL_NO_ERROR == glGetError());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("failed and cancelled streams are not loaded", "[TextureStreamer]") {
+    testContext();
+    TextureObject texture;
+    texture.allocate2D(GL_RGBA8, 16, 16, 5);
+    auto            maxLevel = texParameter(texture, GL_TEXTURE_MAX_LEVEL);
+    TextureStreamer ts;
+    ts.init();
+
+    SECTION("decoder failure") {
+        auto h = ts.load(texture, GL_RGBA, GL_UNSIGNED_BYTE, 4, [](uint32_t, uint32_t level, void * dst, size_t size) {
+            return level > 2 && fill(level, dst, size);
+        });
+        pump(ts);
+        CHECK(TextureStreamer::Status::FAILED == ts.status(h));
+        CHECK_FALSE(ts.loaded(h));
+        CHECK(0 != ts.visibleLevel(h));
+    }
+
+    SECTION("cancel") {
+        auto h = ts.load(texture, GL_RGBA, GL_UNSIGNED_BYTE, 4, [](uint32_t, uint32_t level, void * dst, size_t size) { return fill(level, dst, size); });
+        ts.cancel(h);
+        CHECK(0 == ts.pending());
+        CHECK(TextureStreamer::Status::CANCELLED == ts.status(h));
+        CHECK_FALSE(ts.loaded(h));
+        pump(ts);
+        ts.forget(h);
+        CHECK(TextureStreamer::Status::UNKNOWN == ts.status(h));
+    }
+
+    // Either way, the texture must not be left pointing at levels that were never uploaded.
+    CHECK(0 == texParameter(texture, GL_TEXTURE_BASE_LEVEL));
+    CHECK(maxLevel == texParameter(texture, GL_TEXTURE_MAX_LEVEL));
+    CHECK(GL_NO_ERROR == glGetError());
+}
@@ -0,0 +1,51 @@
+#include "test.h"
+
+using namespace litespd::gl;
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("texture rows larger than a staging chunk are split", "[UploadScheduler]") {
+    testContext();
+    const uint32_t W = 512, H = 4; // 2KB per row, while a chunk of the 1KB staging ring is at most 256 bytes.
+    TextureObject  texture;
+    texture.allocate2D(GL_RGBA8, W, H);
+    std::vector<uint8_t> pixels(W * H * 4);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = (uint8_t) (i * 7);
+
+    UploadScheduler us;
+    us.init(1024, 2);
+    us.budget.bytesPerFrame = 512;
+    bool done               = false;
+    us.uploadTexture(texture, 0, 0, 0, 0, W, H, pixels.data(), pixels.size(), GL_RGBA, GL_UNSIGNED_BYTE, UploadScheduler::Priority::NORMAL,
+                     [&] { done = true; });
+
+    // update() never blocks. Keep calling it until everything is issued.
+    for (int frame = 0; frame < 10000 && us.stats().pendingJobs > 0; ++frame) {
+        us.update();
+        CHECK(us.stats().bytesLastFrame <= 512);
+        glFlush();
+    }
+    CHECK(0 == us.stats().pendingJobs);
+    us.finish();
+    CHECK(done);
+    CHECK(texture.getBaseLevelPixels() == pixels);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("buffer uploads go through the staging ring", "[UploadScheduler]") {
+    testContext();
+    std::vector<uint32_t> data(1000);
+    for (uint32_t i = 0; i < data.size(); ++i) data[i] = i * 3 + 1;
+    BufferObject<GL_ARRAY_BUFFER> bo;
+    bo.allocate(sizeof(uint32_t), data.size(), nullptr);
+
+    UploadScheduler us;
+    us.init(1024, 2);
+    us.uploadBuffer(bo.bo, 0, data.data(), data.size() * sizeof(uint32_t));
+    us.finish();
+
+    std::vector<uint32_t> result(data.size());
+    bo.getData(result.data(), 0, result.size());
+    CHECK(result == data);
+}
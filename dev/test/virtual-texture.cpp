@@ -0,0 +1,93 @@
+#include "test.h"
+#include <map>
+
+using namespace litespd::gl;
+
+namespace {
+
+// 4x4 pages of 8x8 content pixels, and a cache of only 4 tiles, so requests keep evicting each other.
+const uint32_t TILE = 16, BORDER = 4, CACHE = 32;
+
+std::vector<uint32_t> readLevel(const TextureObject & texture, uint32_t level) {
+    TextureReadback readback;
+    auto            h = readback.read(texture, level);
+    REQUIRE(readback.wait(h));
+    std::vector<uint32_t> pixels(readback.size(h) / 4);
+    REQUIRE(readback.get(h, pixels.data(), pixels.size() * 4));
+    return pixels;
+}
+
+// Render feedback that requests a single page, and feed it back.
+void request(VirtualTexture & vt, uint32_t x, uint32_t y, uint32_t level) {
+    vt.beginFeedback(4, 4);
+    glClearColor((float) x / 255.f, (float) y / 255.f, 0.f, (float) (level + 1) / 255.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    vt.endFeedback();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    for (int i = 0; i < 10; ++i) {
+        glFinish();
+        vt.update();
+    }
+}
+
+// Every page table entry must point to the tile of its closest resident ancestor.
+void checkPageTable(const VirtualTexture & vt) {
+    // Each tile is filled with (x, y, level, 0xFF) of its page, so the cache tells which pages are resident.
+    auto                                   cache = readLevel(vt.cache(), 0);
+    std::map<std::array<uint32_t, 3>, int> resident; // page -> slot
+    for (int slot = 0; slot < 4; ++slot) {
+        auto p = cache[(slot / 2) * TILE * CACHE + (slot % 2) * TILE];
+        if (p >> 24) resident[{p & 0xFF, (p >> 8) & 0xFF, (p >> 16) & 0xFF}] = slot;
+    }
+    for (uint32_t level = 0; level < 3; ++level) {
+        auto table = readLevel(vt.pageTable(), level);
+        auto n     = 4u >> level;
+        REQUIRE(n * n == table.size());
+        for (uint32_t y = 0; y < n; ++y)
+            for (uint32_t x = 0; x < n; ++x) {
+                uint32_t l = level;
+                while (!resident.count({x >> (l - level), y >> (l - level), l})) ++l;
+                auto slot = resident[{x >> (l - level), y >> (l - level), l}];
+                INFO("level " << level << " page " << x << "," << y);
+                CHECK(table[y * n + x] == ((uint32_t) (slot % 2) | ((uint32_t) (slot / 2) << 8) | (l << 24)));
+            }
+    }
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------------------------------------------------
+//
+TEST_CASE("page table tracks loads and evictions", "[VirtualTexture]") {
+    testContext();
+    VirtualTexture::CreateParams cp;
+    cp.width       = 32;
+    cp.height      = 32;
+    cp.tileSize    = TILE;
+    cp.border      = BORDER;
+    cp.cacheSize   = CACHE;
+    cp.cacheLayers = 1;
+    cp.loader      = [](uint32_t x, uint32_t y, uint32_t level, void * pixels) {
+        uint32_t p = x | (y << 8) | (level << 16) | 0xFF000000u;
+        std::fill_n((uint32_t *) pixels, TILE * TILE, p);
+        return true;
+    };
+    VirtualTexture vt;
+    vt.init(cp);
+    vt.update();
+    CHECK(1 == vt.stats().residentTiles);
+    checkPageTable(vt);
+
+    request(vt, 0, 0, 0); // loads (0,0,0) and (0,0,1)
+    CHECK(3 == vt.stats().residentTiles);
+    checkPageTable(vt);
+
+    request(vt, 3, 3, 0); // loads (1,1,1), then evicts the oldest tile for (3,3,0)
+    CHECK(4 == vt.stats().residentTiles);
+    CHECK(vt.stats().evictions > 0);
+    checkPageTable(vt);
+
+    request(vt, 2, 1, 0);
+    checkPageTable(vt);
+    CHECK(GL_NO_ERROR == glGetError());
+}
@@ -43,26 +43,315 @@ SOFTWARE.
 
 #ifdef _WIN32
 extern "C" __declspec(dllimport) void __stdcall DebugBreak();
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h> // for memory mapped file
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #include <array> // for std::size
 #include <atomic>
 #include <stack>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
 #include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <stdarg.h>
 
+// SIMD kernels of the mipmap generator
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LGI_MIP_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define LGI_MIP_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LGI_MIP_NEON 1
+#endif
+
 namespace LITESPD_GL_NAMESPACE {
 
 namespace lgi {
 
 std::string format(const char * fmt, ...) {
+    va_list args, copy;
+    va_start(args, fmt);
+    va_copy(copy, args);
+    char        buffer[1024];
+    int         n = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    std::string result;
+    if (n >= (int) sizeof(buffer)) {
+        // Too long for the stack buffer. Format again directly into the result.
+        result.resize((size_t) n);
+        vsnprintf(result.data(), (size_t) n + 1, fmt, copy);
+    } else if (n > 0) {
+        result.assign(buffer, (size_t) n);
+    }
+    va_end(copy);
+    va_end(args);
+    return result;
+}
+
+// Send the message to the LITESPD_GL_LOG_XXX macro of the level. Errors are prefixed with the location of the call site.
+static void writeLog(LogLevel level, const char * file, int line, const char * message) {
+    switch (level) {
+    case LogLevel::ERROR_:
+        if (file) {
+            auto located = format("%s(%d): %s", file, line, message);
+            LITESPD_GL_LOG_ERROR(located.c_str());
+        } else {
+            LITESPD_GL_LOG_ERROR(message);
+        }
+        break;
+    case LogLevel::WARNING:
+        LITESPD_GL_LOG_WARNING(message);
+        break;
+    case LogLevel::INFO:
+        LITESPD_GL_LOG_INFO(message);
+        break;
+    case LogLevel::VERBOSE:
+        LITESPD_GL_LOG_VERBOSE(message);
+        break;
+    default:
+        LITESPD_GL_LOG_DEBUG(message);
+        break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Asynchronous log backend. Each thread formats its log records directly into its own single-producer/single-consumer
+// ring buffer, so there's no lock nor heap allocation on the logging thread. A background writer thread merges records
+// of all threads in submission order and hands them to the LITESPD_GL_LOG_XXX macros.
+class LogBackend {
+public:
+    static LogBackend & instance() {
+        // Never destroyed, so logging from static destructors and exiting threads stays safe. Pending records are
+        // written out by the atexit handler.
+        static LogBackend * inst = new LogBackend();
+        return *inst;
+    }
+
+    LGI_NO_COPY_NO_MOVE(LogBackend);
+
+    void log(LogLevel level, const char * file, int line, const char * fmt, va_list args) {
+        auto ring = threadRing();
+        if (_stopped || !ring) {
+            writeLarge(level, file, line, fmt, args, -1);
+            return;
+        }
+
+        auto & r    = *ring;
+        size_t need = MIN_SPACE;
+        for (;;) {
+            size_t head   = r.head.load(std::memory_order_relaxed);
+            size_t free   = RING_SIZE - (head - r.tail.load(std::memory_order_acquire));
+            size_t offset = head & (RING_SIZE - 1);
+            size_t toEnd  = RING_SIZE - offset;
+            if (toEnd < need && free >= toEnd) {
+                // Not enough contiguous space till the end of the ring. Pad and wrap around.
+                auto pad   = (Record *) (r.data + offset);
+                pad->size  = (uint32_t) toEnd;
+                pad->level = -1;
+                r.head.store(head + toEnd, std::memory_order_release);
+                continue;
+            }
+            size_t space = std::min(free, toEnd);
+            if (space >= need) {
+                auto    rec = (Record *) (r.data + offset);
+                va_list copy;
+                va_copy(copy, args);
+                int n = vsnprintf((char *) (rec + 1), space - sizeof(Record), fmt, copy);
+                va_end(copy);
+                if (n < 0) return; // encoding error.
+                size_t size = (sizeof(Record) + (size_t) n + 1 + 7) & ~(size_t) 7;
+                if (size <= space) {
+                    // Take the sequence number only now that the record is about to be published. Taken earlier, a
+                    // record that waits for ring space could be published after a later one was already written out.
+                    rec->size     = (uint32_t) size;
+                    rec->level    = (int32_t) level;
+                    rec->file     = file;
+                    rec->line     = line;
+                    rec->sequence = _sequence++;
+                    r.head.store(head + size, std::memory_order_release);
+                    break;
+                }
+                // Now we know the exact size of the record.
+                need = size;
+                if (need > RING_SIZE / 2) {
+                    // Too large for the ring. Write it out directly, after everything pending.
+                    writeLarge(level, file, line, fmt, args, n);
+                    return;
+                }
+                continue;
+            }
+            // The ring is full. Wake up the writer and wait.
+            _cv.notify_one();
+            std::this_thread::yield();
+        }
+
+        // Errors are usually followed by an exception or a crash. Make sure they are not lost.
+        if (LogLevel::ERROR_ == level) flush();
+    }
+
+    void flush() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        drain();
+    }
+
+private:
+    // Header of each log record, followed by null-terminated text.
+    struct Record {
+        uint32_t     size;  ///< total size of the record, including the header. Always multiple of 8.
+        int32_t      level; ///< -1 for padding.
+        uint64_t     sequence;
+        const char * file; ///< __FILE__ of the call site, which is a string literal.
+        int32_t      line;
+    };
+
+    static constexpr size_t RING_SIZE = 64 * 1024; // must be power of 2.
+    static constexpr size_t MIN_SPACE = sizeof(Record) + 128;
+
+    struct Ring {
+        alignas(8) uint8_t data[RING_SIZE];
+        std::atomic<size_t> head {0};        ///< only written by the owner thread.
+        std::atomic<size_t> tail {0};        ///< only written by the consumer.
+        std::atomic<bool>   retired {false}; ///< set when the owner thread exits.
+    };
+
+    struct RingHolder {
+        Ring * ring = nullptr;
+        ~RingHolder() {
+            // The writer deletes retired rings once drained. Forget it, so nothing on this thread touches it again.
+            if (ring) ring->retired = true;
+            ring       = nullptr;
+            ringIsGone = true;
+        }
+    };
+
+    // Set when the ring holder of the thread is destroyed. Being trivially destructible, it stays valid for
+    // thread_local destructors that run after the holder's.
+    static inline thread_local bool ringIsGone = false;
+
+    std::mutex              _mutex; // serializes consumers and protects _rings.
+    std::condition_variable _cv;
+    std::vector<Ring *>     _rings;
+    std::atomic<uint64_t>   _sequence {0};
+    std::atomic<bool>       _stopped {false};
+    std::thread             _writer;
+
+    LogBackend() {
+        _writer = std::thread([this] { run(); });
+        std::atexit([] { instance().stop(); });
+    }
+
+    // Returns null after the ring of the thread is gone. Logs are then written by the locked slow path.
+    Ring * threadRing() {
+        if (ringIsGone) return nullptr;
+        static thread_local RingHolder holder;
+        if (!holder.ring) {
+            // One time allocation per thread.
+            holder.ring = new Ring();
+            std::lock_guard<std::mutex> lock(_mutex);
+            _rings.push_back(holder.ring);
+        }
+        return holder.ring;
+    }
+
+    void writeLarge(LogLevel level, const char * file, int line, const char * fmt, va_list args, int length) {
+        va_list copy;
+        va_copy(copy, args);
+        if (length < 0) length = vsnprintf(nullptr, 0, fmt, copy);
+        va_end(copy);
+        if (length < 0) return;
+        std::string text((size_t) length, '\0');
+        va_copy(copy, args);
+        vsnprintf(text.data(), (size_t) length + 1, fmt, copy);
+        va_end(copy);
+        std::lock_guard<std::mutex> lock(_mutex);
+        drain();
+        writeLog(level, file, line, text.c_str());
+    }
+
+    // Write out all pending records. Must be called with _mutex locked.
+    void drain() {
+        for (;;) {
+            Ring *         next    = nullptr;
+            const Record * nextRec = nullptr;
+            for (auto r : _rings) {
+                size_t tail = r->tail.load(std::memory_order_relaxed);
+                size_t head = r->head.load(std::memory_order_acquire);
+                // skip paddings
+                const Record * rec = nullptr;
+                while (tail != head) {
+                    rec = (const Record *) (r->data + (tail & (RING_SIZE - 1)));
+                    if (rec->level >= 0) break;
+                    tail += rec->size;
+                    r->tail.store(tail, std::memory_order_release);
+                    rec = nullptr;
+                }
+                if (rec && (!nextRec || rec->sequence < nextRec->sequence)) {
+                    next    = r;
+                    nextRec = rec;
+                }
+            }
+            if (!next) break;
+            writeLog((LogLevel) nextRec->level, nextRec->file, nextRec->line, (const char *) (nextRec + 1));
+            next->tail.store(next->tail.load(std::memory_order_relaxed) + nextRec->size, std::memory_order_release);
+        }
+
+        // release rings of exited threads.
+        auto end = std::remove_if(_rings.begin(), _rings.end(), [](Ring * r) {
+            if (!r->retired.load(std::memory_order_acquire)) return false;
+            if (r->head.load(std::memory_order_acquire) != r->tail.load(std::memory_order_relaxed)) return false;
+            delete r;
+            return true;
+        });
+        _rings.erase(end, _rings.end());
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopped) {
+            drain();
+            _cv.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _cv.notify_one();
+        if (_writer.joinable()) _writer.join();
+        flush();
+    }
+};
+
+static std::atomic<int> logLevel = LITESPD_GL_MAX_LOG_LEVEL;
+
+bool logEnabled(LogLevel level) { return (int) level <= logLevel.load(std::memory_order_relaxed); }
+
+void log(LogLevel level, const char * file, int line, const char * fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    char buffer[1024];
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    LogBackend::instance().log(level, file, line, fmt, args);
     va_end(args);
-    return buffer;
 }
 
 // Trim the string
@@ -96,153 +385,388 @@ std::string ns2str(uint64_t ns) {
     return s.str();
 }
 
+// Stack of active error scopes of current thread.
+struct ErrorScopeStack {
+    static constexpr size_t MAX_DEPTH = 64;
+    const char *            names[MAX_DEPTH];
+    size_t                  depth = 0;
+    const char *            last  = nullptr; // name of the most recently entered scope.
+
+    const char * current() const { return depth > 0 ? names[std::min(depth, MAX_DEPTH) - 1] : last; }
+};
+static thread_local ErrorScopeStack errorScopes;
+
+static std::atomic<int> errorCheckPolicy = LITESPD_GL_ERROR_CHECK_POLICY;
+
+void reportGLErrors(const char * where, const char * file, int line) {
+#if LITESPD_GL_ENABLE_GLAD
+    if (glGetError == NULL) {
+        LGI_LOGE("gl not initialized properly...");
+        return;
+    }
+#endif
+    // A context may have multiple error flags recorded. Drain them all, but don't loop forever on a lost context.
+    for (int i = 0; i < 16; ++i) {
+        GLenum err = glGetError();
+        if (GL_NO_ERROR == err) break;
+        auto scope = errorScopes.current();
+        // Attribute the error to the GL call site, rather than to this function.
+        log(LogLevel::ERROR_, file, line, "%s: GL error 0x%x. (scope=%s)", where, err, scope ? scope : "<none>");
+    }
+}
+
 } // namespace lgi
 
+// -----------------------------------------------------------------------------
+//
+void setLogLevel(LogLevel level) { lgi::logLevel = (int) level; }
+
+// -----------------------------------------------------------------------------
+//
+LogLevel getLogLevel() { return (LogLevel) lgi::logLevel.load(); }
+
+// -----------------------------------------------------------------------------
+//
+void flushLog() { lgi::LogBackend::instance().flush(); }
+
+// -----------------------------------------------------------------------------
+//
+void setErrorCheckPolicy(ErrorCheckPolicy policy) { lgi::errorCheckPolicy = (int) policy; }
+
+// -----------------------------------------------------------------------------
+//
+ErrorCheckPolicy getErrorCheckPolicy() {
+#if LITESPD_GL_ERROR_CHECK_POLICY
+    return (ErrorCheckPolicy) lgi::errorCheckPolicy.load(std::memory_order_relaxed);
+#else
+    return ErrorCheckPolicy::OFF;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+//
+ErrorScope::ErrorScope(const char * name) {
+    auto & s = lgi::errorScopes;
+    // Errors pending at this point belong to whatever ran before the scope.
+    if (getErrorCheckPolicy() >= ErrorCheckPolicy::PER_SCOPE) lgi::reportGLErrors("before scope", __FILE__, __LINE__);
+    if (s.depth < s.MAX_DEPTH) s.names[s.depth] = name;
+    ++s.depth;
+    s.last = name;
+}
+
+// -----------------------------------------------------------------------------
+//
+ErrorScope::~ErrorScope() {
+    auto & s = lgi::errorScopes;
+    if (getErrorCheckPolicy() >= ErrorCheckPolicy::PER_SCOPE) lgi::reportGLErrors("end of scope", __FILE__, __LINE__);
+    if (s.depth > 0)
+        --s.depth;
+    else
+        LGI_LOGE("ErrorScope stack underflow.");
+}
+
 #if LITESPD_GL_ENABLE_GLAD
 // -----------------------------------------------------------------------------
 //
-static void initializeOpenGLDebugRuntime() {
-    struct OGLDebugOutput {
-        static const char * source2String(GLenum source) {
-            switch (source) {
-            case GL_DEBUG_SOURCE_API_ARB:
-                return "GL API";
-            case GL_DEBUG_SOURCE_WINDOW_SYSTEM_ARB:
-                return "Window System";
-            case GL_DEBUG_SOURCE_SHADER_COMPILER_ARB:
-                return "Shader Compiler";
-            case GL_DEBUG_SOURCE_THIRD_PARTY_ARB:
-                return "Third Party";
-            case GL_DEBUG_SOURCE_APPLICATION_ARB:
-                return "Application";
-            case GL_DEBUG_SOURCE_OTHER_ARB:
-                return "Other";
+struct OGLDebugOutput {
+    enum Level {
+        NONE,
+        INFO,
+        WARNING,
+        ERROR_,
+    };
+
+    static const char * source2String(GLenum source) {
+        switch (source) {
+        case GL_DEBUG_SOURCE_API_ARB:
+            return "GL API";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM_ARB:
+            return "Window System";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER_ARB:
+            return "Shader Compiler";
+        case GL_DEBUG_SOURCE_THIRD_PARTY_ARB:
+            return "Third Party";
+        case GL_DEBUG_SOURCE_APPLICATION_ARB:
+            return "Application";
+        case GL_DEBUG_SOURCE_OTHER_ARB:
+            return "Other";
+        default:
+            return "INVALID_SOURCE";
+        }
+    }
+
+    static const char * type2String(GLenum type) {
+        switch (type) {
+        case GL_DEBUG_TYPE_ERROR_ARB:
+            return "Error";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR_ARB:
+            return "Deprecation";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR_ARB:
+            return "Undefined Behavior";
+        case GL_DEBUG_TYPE_PORTABILITY_ARB:
+            return "Portability";
+        case GL_DEBUG_TYPE_PERFORMANCE_ARB:
+            return "Performance";
+        case GL_DEBUG_TYPE_OTHER_ARB:
+            return "Other";
+        default:
+            return "INVALID_TYPE";
+        }
+    }
+
+    static const char * severity2String(GLenum severity) {
+        switch (severity) {
+        case GL_DEBUG_SEVERITY_HIGH_ARB:
+            return "High";
+        case GL_DEBUG_SEVERITY_MEDIUM_ARB:
+            return "Medium";
+        case GL_DEBUG_SEVERITY_LOW_ARB:
+            return "Low";
+        default:
+            return "INVALID_SEVERITY";
+        }
+    }
+
+    // Determine log level of the message. Messages of level NONE are ignored.
+    static Level classify(GLenum type, GLenum severity) {
+        switch (type) {
+        case GL_DEBUG_TYPE_ERROR_ARB:
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR_ARB:
+            return ERROR_;
+
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR_ARB:
+        case GL_DEBUG_TYPE_PORTABILITY:
+            switch (severity) {
+            case GL_DEBUG_SEVERITY_HIGH_ARB:
+            case GL_DEBUG_SEVERITY_MEDIUM_ARB:
+                return WARNING;
+            case GL_DEBUG_SEVERITY_LOW_ARB:
+                return NONE;
             default:
-                return "INVALID_SOURCE";
+                return ERROR_;
             }
-        }
 
-        static const char * type2String(GLenum type) {
-            switch (type) {
-            case GL_DEBUG_TYPE_ERROR_ARB:
-                return "Error";
-            case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR_ARB:
-                return "Deprecation";
-            case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR_ARB:
-                return "Undefined Behavior";
-            case GL_DEBUG_TYPE_PORTABILITY_ARB:
-                return "Portability";
-            case GL_DEBUG_TYPE_PERFORMANCE_ARB:
-                return "Performance";
-            case GL_DEBUG_TYPE_OTHER_ARB:
-                return "Other";
+        case GL_DEBUG_TYPE_PERFORMANCE_ARB:
+            switch (severity) {
+            case GL_DEBUG_SEVERITY_HIGH_ARB:
+                return WARNING;
+            case GL_DEBUG_SEVERITY_MEDIUM_ARB: // shader recompiliation, buffer data read back.
+            case GL_DEBUG_SEVERITY_LOW_ARB:
+                return NONE; // verbose: performance warnings from redundant state changes
             default:
-                return "INVALID_TYPE";
+                return ERROR_;
             }
-        }
 
-        static const char * severity2String(GLenum severity) {
+        case GL_DEBUG_TYPE_OTHER_ARB:
             switch (severity) {
             case GL_DEBUG_SEVERITY_HIGH_ARB:
-                return "High";
+                return ERROR_;
             case GL_DEBUG_SEVERITY_MEDIUM_ARB:
-                return "Medium";
+                return WARNING;
             case GL_DEBUG_SEVERITY_LOW_ARB:
-                return "Low";
+            case GL_DEBUG_SEVERITY_NOTIFICATION:
+                return NONE; // verbose
             default:
-                return "INVALID_SEVERITY";
+                return ERROR_;
             }
+
+        default:
+            return ERROR_;
         }
+    }
 
-        static void GLAPIENTRY messageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
-                                               GLsizei, // length,
-                                               const GLchar * message,
-                                               const void *) // userParam)
-        {
-            // Determine log level
-            bool error_  = false;
-            bool warning = false;
-            bool info    = false;
-            switch (type) {
-            case GL_DEBUG_TYPE_ERROR_ARB:
-            case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR_ARB:
-                error_ = true;
-                break;
+    static void log(Level level, GLenum source, GLenum type, GLuint id, GLenum severity, const char * message, const char * backtrace,
+                    uint32_t suppressed) {
+        std::string s = lgi::format("(id=[%d] source=[%s] type=[%s] severity=[%s]): %s", id, source2String(source), type2String(type),
+                                    severity2String(severity), message);
+        if (suppressed) s += lgi::format(" (%u duplicates suppressed)", suppressed);
+        if (backtrace && *backtrace) {
+            s += '\n';
+            s += backtrace;
+        }
+        if (ERROR_ == level)
+            LGI_LOGE("[GL ERROR] %s", s.c_str());
+        else if (WARNING == level)
+            LGI_LOGW("[GL WARNING] %s", s.c_str());
+        else if (INFO == level)
+            LGI_LOGI("[GL INFO] %s", s.c_str());
+    }
 
-            case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR_ARB:
-            case GL_DEBUG_TYPE_PORTABILITY:
-                switch (severity) {
-                case GL_DEBUG_SEVERITY_HIGH_ARB:
-                case GL_DEBUG_SEVERITY_MEDIUM_ARB:
-                    warning = true;
-                    break;
-                case GL_DEBUG_SEVERITY_LOW_ARB:
-                    break;
-                default:
-                    error_ = true;
-                    break;
-                }
-                break;
+    // Synchronous mode: log the message right away, on the thread that issues the GL call.
+    static void GLAPIENTRY syncCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                        GLsizei, // length,
+                                        const GLchar * message,
+                                        const void *) // userParam)
+    {
+        auto level = classify(type, severity);
+        if (NONE == level) return;
+        // Capturing call stack is expensive. Only do it for errors.
+        std::string bt = (ERROR_ == level) ? LITESPD_GL_BACKTRACE() : std::string();
+        log(level, source, type, id, severity, message, bt.c_str(), 0);
+    }
+};
 
-            case GL_DEBUG_TYPE_PERFORMANCE_ARB:
-                switch (severity) {
-                case GL_DEBUG_SEVERITY_HIGH_ARB:
-                    warning = true;
-                    break;
-                case GL_DEBUG_SEVERITY_MEDIUM_ARB: // shader recompiliation, buffer data read back.
-                case GL_DEBUG_SEVERITY_LOW_ARB:
-                    break; // verbose: performance warnings from redundant state changes
-                default:
-                    error_ = true;
-                    break;
-                }
-                break;
+// -----------------------------------------------------------------------------
+// Asynchronous GL debug message pipeline: the debug callback pushes raw messages into a bounded lock-free queue. A
+// background thread drains the queue, suppresses repeated message IDs, then formats and logs the rest. No backtrace is
+// captured: the callback may run on a driver thread, where the call stack says nothing about the offending GL call.
+class AsyncDebugOutput {
+public:
+    static AsyncDebugOutput & instance() {
+        static AsyncDebugOutput inst;
+        return inst;
+    }
 
-            case GL_DEBUG_TYPE_OTHER_ARB:
-                switch (severity) {
-                case GL_DEBUG_SEVERITY_HIGH_ARB:
-                    error_ = true;
-                    break;
-                case GL_DEBUG_SEVERITY_MEDIUM_ARB:
-                    warning = true;
-                    break;
-                case GL_DEBUG_SEVERITY_LOW_ARB:
-                case GL_DEBUG_SEVERITY_NOTIFICATION:
-                    break; // verbose
-                default:
-                    error_ = true;
-                    break;
-                }
-                break;
+    LGI_NO_COPY_NO_MOVE(AsyncDebugOutput);
 
-            default:
-                error_ = true;
-                break;
+    void start() {
+        if (_thread.joinable()) return;
+        _quit   = false;
+        _thread = std::thread([this] { run(); });
+    }
+
+    static void GLAPIENTRY callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar * message,
+                                    const void *) // userParam)
+    {
+        auto level = OGLDebugOutput::classify(type, severity);
+        if (OGLDebugOutput::NONE == level) return;
+        instance().push(level, source, type, id, severity, length, message);
+    }
+
+private:
+    static constexpr size_t   QUEUE_SIZE         = 256; // must be power of 2.
+    static constexpr size_t   MAX_MESSAGE_LENGTH = 1024;
+    static constexpr uint64_t RATE_LIMIT_MS      = 1000; // log the same message ID at most once per this period.
+
+    struct Message {
+        OGLDebugOutput::Level level;
+        GLenum                source;
+        GLenum                type;
+        GLuint                id;
+        GLenum                severity;
+        char                  text[MAX_MESSAGE_LENGTH];
+    };
+
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Message             msg;
+    };
+
+    struct History {
+        std::chrono::steady_clock::time_point lastLogged;
+        uint32_t                              suppressed = 0;
+    };
+
+    std::array<Slot, QUEUE_SIZE>          _slots;
+    std::atomic<size_t>                   _enqueuePos {0};
+    size_t                                _dequeuePos = 0; // only touched by the worker thread.
+    std::atomic<uint32_t>                 _dropped {0};
+    std::atomic<bool>                     _quit {false};
+    std::thread                           _thread;
+    std::unordered_map<uint64_t, History> _history; // only touched by the worker thread.
+
+    AsyncDebugOutput() {
+        for (size_t i = 0; i < QUEUE_SIZE; ++i) _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~AsyncDebugOutput() {
+        _quit = true;
+        if (_thread.joinable()) _thread.join();
+    }
+
+    // Called by the GL driver, potentially from multiple threads at the same time.
+    void push(OGLDebugOutput::Level level, GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar * message) {
+        size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        Slot * slot;
+        for (;;) {
+            slot      = &_slots[pos & (QUEUE_SIZE - 1)];
+            auto seq  = slot->sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t) seq - (intptr_t) pos;
+            if (0 == diff) {
+                if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                // Queue is full. Drop the message rather than stall the GL thread.
+                ++_dropped;
+                return;
+            } else {
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        auto & m = slot->msg;
+        m.level    = level;
+        m.source   = source;
+        m.type     = type;
+        m.id       = id;
+        m.severity = severity;
+        size_t n   = length < 0 ? strlen(message) : (size_t) length;
+        n          = std::min(n, MAX_MESSAGE_LENGTH - 1);
+        memcpy(m.text, message, n);
+        m.text[n] = 0;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    bool pop() {
+        auto & slot = _slots[_dequeuePos & (QUEUE_SIZE - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != _dequeuePos + 1) return false;
+        process(slot.msg);
+        slot.sequence.store(_dequeuePos + QUEUE_SIZE, std::memory_order_release);
+        ++_dequeuePos;
+        return true;
+    }
+
+    void process(const Message & m) {
+        auto key = ((uint64_t) m.source << 48) ^ ((uint64_t) m.type << 32) ^ m.id;
+        auto now = std::chrono::steady_clock::now();
+        auto it  = _history.find(key);
+        if (it != _history.end()) {
+            auto & h       = it->second;
+            auto   elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - h.lastLogged).count();
+            // Errors are never rate limited.
+            if ((uint64_t) elapsed < RATE_LIMIT_MS && OGLDebugOutput::ERROR_ != m.level) {
+                ++h.suppressed;
+                return;
             }
+            OGLDebugOutput::log(m.level, m.source, m.type, m.id, m.severity, m.text, nullptr, h.suppressed);
+            h.lastLogged = now;
+            h.suppressed = 0;
+        } else {
+            OGLDebugOutput::log(m.level, m.source, m.type, m.id, m.severity, m.text, nullptr, 0);
+            _history[key].lastLogged = now;
+        }
+    }
 
-            std::string s = lgi::format("(id=[%d] source=[%s] type=[%s] severity=[%s]): %s\n%s", id, source2String(source), type2String(type),
-                                        severity2String(severity), message, LITESPD_GL_BACKTRACE().c_str());
-            if (error_)
-                LGI_LOGE("[GL ERROR] %s", s.c_str());
-            else if (warning)
-                LGI_LOGW("[GL WARNING] %s", s.c_str());
-            else if (info)
-                LGI_LOGI("[GL INFO] %s", s.c_str());
+    void run() {
+        for (;;) {
+            bool quit = _quit; // read before draining, so messages pushed before quit are not lost.
+            while (pop()) {}
+            if (auto dropped = _dropped.exchange(0)) LGI_LOGW("[GL WARNING] %u GL debug messages dropped: queue is full.", dropped);
+            if (quit) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
         }
-    };
+    }
+};
+
+// -----------------------------------------------------------------------------
+//
+static void initializeOpenGLDebugRuntime(bool synchronous) {
+    GLDEBUGPROC callback = synchronous ? &OGLDebugOutput::syncCallback : &AsyncDebugOutput::callback;
+    if (!synchronous) AsyncDebugOutput::instance().start();
 
     if (GLAD_GL_KHR_debug) {
-        LGI_CHK(glDebugMessageCallback(&OGLDebugOutput::messageCallback, nullptr));
-        LGI_CHK(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+        LGI_CHK(glDebugMessageCallback(callback, nullptr));
+        if (synchronous)
+            LGI_CHK(glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
+        else
+            LGI_CHK(glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS));
         LGI_CHK(glDebugMessageControl(GL_DONT_CARE, // source
                                       GL_DONT_CARE, // type
                                       GL_DONT_CARE, // severity
                                       0,            // count
                                       nullptr,      // ids
                                       GL_TRUE));
-        LGI_LOGI("OpenGL KHR_debug enabled");
+        LGI_LOGI("OpenGL KHR_debug enabled (%s)", synchronous ? "synchronous" : "asynchronous");
     } else if (GLAD_GL_ARB_debug_output) {
-        LGI_CHK(glDebugMessageCallbackARB(&OGLDebugOutput::messageCallback, nullptr));
+        LGI_CHK(glDebugMessageCallbackARB(callback, nullptr));
         // enable all messages
         LGI_CHK(glDebugMessageControlARB(GL_DONT_CARE, // source
                                          GL_DONT_CARE, // type
@@ -250,7 +774,7 @@ static void initializeOpenGLDebugRuntime() {
                                          0,            // count
                                          nullptr,      // ids
                                          GL_TRUE));
-        LGI_LOGI("OpenGL ARB_debug_output enabled");
+        LGI_LOGI("OpenGL ARB_debug_output enabled (%s)", synchronous ? "synchronous" : "asynchronous");
     }
 }
 
@@ -361,802 +885,4610 @@ void initGlad(bool printExtensionList) {
 
 // -----------------------------------------------------------------------------
 //
-void TextureObject::attach(GLenum target, GLuint id) {
-    cleanup();
-    _owned       = false;
-    _desc.target = target;
-    _desc.id     = id;
-    bind(0);
-
-    glGetTexLevelParameteriv(_desc.target, 0, GL_TEXTURE_WIDTH, (GLint *) &_desc.width);
-    LGI_ASSERT(_desc.width);
-
-    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, (GLint *) &_desc.height);
-    LGI_ASSERT(_desc.height);
-
-    // determine depth
-    switch (target) {
-    case GL_TEXTURE_2D_ARRAY:
-    case GL_TEXTURE_3D:
-        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, (GLint *) &_desc.depth);
-        LGI_ASSERT(_desc.depth);
-        break;
-    case GL_TEXTURE_CUBE_MAP:
-        _desc.depth = 6;
-        break;
-    default:
-        _desc.depth = 1;
-        break;
-    }
-
-    GLint maxLevel;
-    glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel);
-    _desc.mips = (uint32_t) maxLevel + 1;
+static thread_local StateCache * currentStateCache = nullptr;
 
-    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint *) &_desc.internalFormat);
+// Linked list of texture pools created on the calling thread. They are told about texture deletions, to drop cached
+// FBOs. A plain pointer, so it stays valid for pools destroyed after thread_local destructors have run.
+static thread_local TexturePool * texturePools = nullptr;
 
-    unbind();
+// -----------------------------------------------------------------------------
+//
+StateCache & StateCache::current() {
+    if (currentStateCache) return *currentStateCache;
+    static thread_local StateCache fallback;
+    return fallback;
 }
 
 // -----------------------------------------------------------------------------
 //
-void TextureObject::allocate2D(GLenum internalFormat, size_t w, size_t h, size_t m) {
-    cleanup();
-    _desc.target         = GL_TEXTURE_2D;
-    _desc.internalFormat = internalFormat;
-    _desc.width          = (uint32_t) w;
-    _desc.height         = (uint32_t) h;
-    _desc.depth          = (uint32_t) 1;
-    _desc.mips           = (uint32_t) m;
-    _owned               = true;
-    LGI_CHK(glGenTextures(1, &_desc.id));
-    LGI_CHK(glBindTexture(_desc.target, _desc.id));
-    applyDefaultParameters();
-    LGI_CHK(glTexStorage2D(_desc.target, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.height));
-    LGI_CHK(glBindTexture(_desc.target, 0));
+void StateCache::makeCurrent(StateCache * cache) {
+    currentStateCache = cache;
+    // The fallback cache might be shared by multiple contexts. So it can't be trusted after context switch.
+    if (!cache) current().invalidate();
 }
 
 // -----------------------------------------------------------------------------
 //
-void TextureObject::allocate2DArray(GLenum internalFormat, size_t w, size_t h, size_t l, size_t m) {
-    cleanup();
-    _desc.target         = GL_TEXTURE_2D_ARRAY;
-    _desc.internalFormat = internalFormat;
-    _desc.width          = (uint32_t) w;
-    _desc.height         = (uint32_t) h;
-    _desc.depth          = (uint32_t) l;
-    _desc.mips           = (uint32_t) m;
-    _owned               = true;
-    LGI_CHK(glGenTextures(1, &_desc.id));
-    LGI_CHK(glBindTexture(_desc.target, _desc.id));
-    applyDefaultParameters();
-    LGI_CHK(glTexStorage3D(_desc.target, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.height, (GLsizei) _desc.depth));
-    LGI_CHK(glBindTexture(_desc.target, 0));
+void StateCache::invalidate() {
+    _program     = UNKNOWN;
+    _vertexArray = UNKNOWN;
+    for (auto & b : _buffers) b = UNKNOWN;
+    for (auto & target : _indexedBuffers)
+        for (auto & b : target) b = {};
+    _activeTexture = UNKNOWN;
+    for (auto & unit : _textures)
+        for (auto & t : unit) t = UNKNOWN;
+    for (auto & s : _samplers) s = UNKNOWN;
+    _drawFramebuffer = UNKNOWN;
+    _readFramebuffer = UNKNOWN;
+    _viewportValid   = false;
 }
 
 // -----------------------------------------------------------------------------
 //
-void TextureObject::allocateCube(GLenum internalFormat, size_t w, size_t m) {
-    cleanup();
-    _desc.target         = GL_TEXTURE_CUBE_MAP;
-    _desc.internalFormat = internalFormat;
-    _desc.width          = (uint32_t) w;
-    _desc.height         = (uint32_t) w;
-    _desc.depth          = 6;
-    _desc.mips           = (uint32_t) m;
-    _owned               = true;
-    LGI_CHK(glGenTextures(1, &_desc.id));
-    LGI_CHK(glBindTexture(GL_TEXTURE_CUBE_MAP, _desc.id));
-    applyDefaultParameters();
-    LGI_CHK(glTexStorage2D(GL_TEXTURE_CUBE_MAP, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.width));
-    LGI_CHK(glBindTexture(_desc.target, 0));
+void StateCache::onProgramDeleted(GLuint program) {
+    if (program && _program == program) _program = UNKNOWN;
 }
 
-void TextureObject::applyDefaultParameters() {
-    LGI_ASSERT(_desc.width > 0);
-    LGI_ASSERT(_desc.height > 0);
-    LGI_ASSERT(_desc.depth > 0);
-    LGI_ASSERT(_desc.mips > 0);
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_BASE_LEVEL, 0));
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MAX_LEVEL, (GLint) _desc.mips - 1));
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MIN_FILTER, _desc.mips > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST));
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+// -----------------------------------------------------------------------------
+// Deleting a bound vertex array reverts the binding to zero.
+void StateCache::onVertexArrayDeleted(GLuint va) {
+    if (va && _vertexArray == va) {
+        _vertexArray                                  = 0;
+        _buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
 }
 
 // -----------------------------------------------------------------------------
-//
-void TextureObject::setPixels(size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t rowLength, GLenum format, GLenum type) const {
-    if (empty()) return;
-    LGI_DCHK(glBindTexture(_desc.target, _desc.id));
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, (int) rowLength);
-    LGI_DCHK(glTexSubImage2D(_desc.target, (GLint) level, (GLint) x, (GLint) y, (GLsizei) w, (GLsizei) h, format, type, pixels));
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    LGI_CHK(;);
+// Deleting a bound buffer reverts all its bindings in current context to zero.
+void StateCache::onBufferDeleted(GLuint bo) {
+    if (!bo) return;
+    for (auto & b : _buffers)
+        if (b == bo) b = 0;
+    for (auto & target : _indexedBuffers)
+        for (auto & b : target)
+            if (b.buffer == bo) b = {0, 0, 0};
 }
 
-void TextureObject::setPixels(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t rowLength, GLenum format,
-                              GLenum type) const {
-    if (empty()) return;
+// -----------------------------------------------------------------------------
+//
+void StateCache::onTextureDeleted(GLuint id) {
+    if (!id) return;
+    for (auto & unit : _textures)
+        for (auto & t : unit)
+            if (t == id) t = 0;
+    for (auto pool = texturePools; pool; pool = pool->_nextPool) pool->onTextureDeleted(id);
+}
 
-    LGI_DCHK(glBindTexture(_desc.target, _desc.id));
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, (int) rowLength);
-    LGI_DCHK(glTexSubImage3D(_desc.target, (GLint) level, (GLint) x, (GLint) y, (GLint) layer, (GLsizei) w, (GLsizei) h, 1, format, type, pixels));
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    LGI_CHK(;);
+// -----------------------------------------------------------------------------
+//
+void StateCache::onSamplerDeleted(GLuint sampler) {
+    if (!sampler) return;
+    for (auto & s : _samplers)
+        if (s == sampler) s = 0;
 }
 
 // -----------------------------------------------------------------------------
 //
-// jedi::ManagedRawImage TextureObject::getBaseLevelPixels() const {
-//     if (empty()) return {};
-//     jedi::ManagedRawImage image(ImageDesc(_desc.format, _desc.width, _desc.height, _desc.depth));
-// #ifdef __ANDROID__
-//     if (_desc.target == GL_TEXTURE_2D) {
-//         GLuint _frameBuffer = 0;
-//         glGenFramebuffers(1, &_frameBuffer);
-//         glBindFramebuffer(GL_FRAMEBUFFER, _frameBuffer);
-//         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _desc.target, _desc.id, 0);
-//         glReadBuffer(GL_COLOR_ATTACHMENT0);
-//         glReadPixels(0, 0, _desc.width, _desc.height, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
-//         LGI_CHK(;);
-//     } else {
-//         LGI_LOGE("read texture 2D array pixels is not implemented on android yet.");
-//     }
-// #else
-//     auto & cf = getColorFormatDesc(_desc.format);
-//     glPixelStorei(GL_UNPACK_ALIGNMENT, image.alignment());
-//     glPixelStorei(GL_UNPACK_ROW_LENGTH, (int) image.pitch() * 8 / (int) cf.bits);
-//     glBindTexture(_desc.target, _desc.id);
-//     glGetTexImage(_desc.target, 0, cf.glFormat, cf.glType, image.data());
-//     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-//     LGI_CHK(;);
-// #endif
-//     return image;
-// }
+void StateCache::onFramebufferDeleted(GLuint fbo) {
+    if (!fbo) return;
+    if (_drawFramebuffer == fbo) _drawFramebuffer = 0;
+    if (_readFramebuffer == fbo) _readFramebuffer = 0;
+}
 
 // -----------------------------------------------------------------------------
 //
-void SimpleFBO::cleanup() {
-    for (int i = 0; i < COLOR_BUFFER_COUNT; ++i) {
-        if (_colors[i].texture) {
-            glDeleteTextures(1, &_colors[i].texture);
-            _colors[i].texture = 0;
-        }
-    }
-    if (_depth) glDeleteTextures(1, &_depth), _depth = 0;
-    for (auto & m : _mips) {
-        if (m.fbo) glDeleteFramebuffers(1, &m.fbo), m.fbo = 0;
+void DirtyRanges::coalesce() {
+    std::sort(_ranges.begin(), _ranges.end(), [](const Range & a, const Range & b) { return a.begin < b.begin; });
+    size_t n = 0;
+    for (size_t i = 1; i < _ranges.size(); ++i) {
+        auto & last = _ranges[n];
+        auto & r    = _ranges[i];
+        if (r.begin <= last.end)
+            last.end = std::max(last.end, r.end);
+        else
+            _ranges[++n] = r;
     }
-    _mips.clear();
+    if (!_ranges.empty()) _ranges.resize(n + 1);
+    _sorted = true;
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleFBO::allocate(uint32_t w, uint32_t h, uint32_t levels, const GLenum * colorFormats) {
-    LGI_CHK(;); // make sure there's no preexisting conditions.
+BufferUpdateStats & BufferUpdateStats::get() {
+    static thread_local BufferUpdateStats stats;
+    return stats;
+}
 
-    cleanup(); // release existing buffers.
+// -----------------------------------------------------------------------------
+//
+std::string BufferUpdateStats::print() const {
+    static const char * names[] = {"sub-data", "orphan", "map-invalidate", "map-unsynchronized"};
+    static_assert(std::size(names) == (size_t) BufferUpdateStrategy::COUNT);
+    std::stringstream ss;
+    for (size_t i = 0; i < std::size(names); ++i) {
+        auto & c = counters[i];
+        if (0 == c.calls) continue;
+        ss << lgi::format("%-18s : %8llu calls, %10llu bytes, %s", names[i], (unsigned long long) c.calls, (unsigned long long) c.bytes,
+                          lgi::ns2str(c.ns).c_str());
+        if (c.ns > 0) ss << lgi::format(", %.1f MB/s", (double) c.bytes * 1000.0 / (double) c.ns);
+        ss << std::endl;
+    }
+    return ss.str();
+}
 
-    LGI_ASSERT(w > 0 && h > 0);
+// -----------------------------------------------------------------------------
+//
+void lgi::updateBuffer(GLenum target, size_t length, GLenum usage, BufferUpdateStrategy strategy, size_t offset, size_t size, const void * data) {
+    if (0 == size) return;
+    LGI_ASSERT(offset + size <= length);
+    auto start = std::chrono::steady_clock::now();
 
-    // create mips array
-    while (w > 0 && h > 0 && (0 == levels || _mips.size() < levels)) {
-        _mips.push_back({w, h, 0});
-        LGI_CHK(glGenFramebuffers(1, &_mips.back().fbo));
-        if (w > 0) w >>= 1;
-        if (h > 0) h >>= 1;
-    };
-    levels = (uint32_t) _mips.size();
+    // Orphaning only makes sense when the whole buffer is rewritten.
+    if (BufferUpdateStrategy::ORPHAN == strategy && (offset > 0 || size < length)) strategy = BufferUpdateStrategy::MAP_INVALIDATE;
 
-    const auto minfilter = _mips.size() > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+    switch (strategy) {
+    case BufferUpdateStrategy::ORPHAN:
+        LGI_DCHK(glBufferData(target, (GLsizeiptr) length, data, usage));
+        break;
 
-    if (colorFormats) {
-        _colorTextureTarget   = GL_TEXTURE_2D;
-        GLenum drawBuffers[8] = {};
-        for (int i = 0; i < COLOR_BUFFER_COUNT; ++i) {
-            LGI_CHK(glGenTextures(1, &_colors[i].texture));
-            auto cf                   = colorFormats[i];
-            _colors[i].internalFormat = cf;
-            LGI_CHK(glBindTexture(GL_TEXTURE_2D, _colors[i].texture));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) (levels - 1)));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-            LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, (GLsizei) levels, cf, (GLsizei) _mips[0].width, (GLsizei) _mips[0].height));
-            for (size_t l = 0; l < _mips.size(); ++l) {
-                auto & m = _mips[l];
-                LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo));
-                LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, (GLenum) (GL_COLOR_ATTACHMENT0 + i), GL_TEXTURE_2D, _colors[i].texture, (GLint) l));
-            }
-            drawBuffers[i] = (GLenum) (GL_COLOR_ATTACHMENT0 + i);
-        }
-        for (auto & m : _mips) {
-            LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo));
-            LGI_CHK(glDrawBuffers(COLOR_BUFFER_COUNT, drawBuffers));
-        }
-    } else {
-        GLenum none = GL_NONE;
-        for (auto & m : _mips) {
-            LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo));
-            LGI_CHK(glDrawBuffers(1, &none));
+    case BufferUpdateStrategy::MAP_INVALIDATE:
+    case BufferUpdateStrategy::MAP_UNSYNCHRONIZED: {
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        if (BufferUpdateStrategy::MAP_UNSYNCHRONIZED == strategy) access |= GL_MAP_UNSYNCHRONIZED_BIT;
+        void * ptr = nullptr;
+        LGI_DCHK(ptr = glMapBufferRange(target, (GLintptr) offset, (GLsizeiptr) size, access));
+        if (ptr) {
+            std::memcpy(ptr, data, size);
+            LGI_DCHK(glUnmapBuffer(target));
+            break;
         }
+        // mapping failed. fall back to sub data.
+        strategy = BufferUpdateStrategy::SUB_DATA;
+        [[fallthrough]];
     }
 
-    if (HAS_DEPTH) {
-        // depth (use texture instead of renderbuffer, since it is very likely that we'll need
-        // to read depth data in the future.)
-        LGI_CHK(glGenTextures(1, &_depth));
-        LGI_CHK(glBindTexture(GL_TEXTURE_2D, _depth));
-        // For OpenGL ES, depth texture works only when the texture is defined with
-        // glTexImage2D() using GL_DEPTH_COMPONENT as the internal format, as specified
-        // in OES_depth_texture extension.
-        // On OpenGL CORE profile though, glTexStorage2D() works just fine.
-        // LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT, w, h));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) (_mips.size() - 1)));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-        for (size_t l = 0; l < _mips.size(); ++l) {
-            auto & m = _mips[l];
-            LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo));
-            // Note: switching to 16-bit (GL_UNSIGNED_SHORT) depth buffer gives about 3ms performance boost.
-            LGI_CHK(glTexImage2D(GL_TEXTURE_2D, (GLsizei) l, GL_DEPTH_COMPONENT, (GLsizei) m.width, (GLsizei) m.height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT,
-                                 nullptr));
-            LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depth, (GLint) l));
-        }
+    default:
+        LGI_DCHK(glBufferSubData(target, (GLintptr) offset, (GLsizeiptr) size, data));
+        break;
     }
 
-    // todo: stencil?
+    auto & c = BufferUpdateStats::get().counters[(size_t) strategy];
+    c.calls += 1;
+    c.bytes += size;
+    c.ns += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-    // make sure the FBO is ready to use.
-    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    LGI_REQUIRE(GL_FRAMEBUFFER_COMPLETE == status);
-    LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+// -----------------------------------------------------------------------------
+//
+static bool bufferStorageSupported() {
+#if LITESPD_GL_ENABLE_GLAD
+    return GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage || GLAD_GL_EXT_buffer_storage;
+#else
+    return false;
+#endif
 }
 
 // -----------------------------------------------------------------------------
 //
-static void saveTextureToFile(uint32_t w, uint32_t h, uint32_t channels, GLenum target, GLenum format, GLenum type, const std::string & filepath) {
-    LGI_LOGI("Save texture content to %s", filepath.c_str());
-    std::vector<float> pixels(w * h * channels);
-    LGI_CHK(glGetTexImage(target, 0, format, type, pixels.data()));
+void RingBuffer::allocate(size_t size, uint32_t framesInFlight, bool persistent) {
+    cleanup();
+    if (0 == size) return;
+    _size           = size;
+    _framesInFlight = std::max(framesInFlight, 1u);
+    _persistent     = persistent && bufferStorageSupported();
+    _alignment      = std::max<size_t>(16, (size_t) getInt(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT));
+
+    // Use the copy-write target, so the element array binding of current VAO is not touched.
+    auto & sc = StateCache::current();
+    LGI_CHK(glGenBuffers(1, &_buffer));
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+#if LITESPD_GL_ENABLE_GLAD
+    if (_persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        if (glBufferStorage)
+            LGI_CHK(glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, nullptr, flags));
+        else
+            LGI_CHK(glBufferStorageEXT(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, nullptr, flags));
+        LGI_CHK(_mapped = (uint8_t *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr) size, flags));
+        if (!_mapped) {
+            LGI_LOGW("Failed to persistently map ring buffer. Fall back to orphaning.");
+            sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &_buffer);
+            sc.onBufferDeleted(_buffer);
+            LGI_CHK(glGenBuffers(1, &_buffer));
+            sc.bindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+            _persistent = false;
+        }
+    }
+#endif
+    if (!_persistent) {
+        LGI_CHK(glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_DRAW));
+        _shadow.resize(size);
+        _mapped = _shadow.data();
+    }
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
 
-    // Flip the image vertically, since OpenGL texture is bottom-up.
-    std::vector<float> flipped(w * h * channels);
-    for (size_t i = 0; i < h; ++i) {
-        const float * s = &pixels[w * channels * (h - i - 1)];
-        float *       d = &flipped[w * channels * i];
-        std::memcpy(d, s, w * channels * sizeof(float));
+// -----------------------------------------------------------------------------
+//
+void RingBuffer::cleanup() {
+    _frames.clear();
+    if (_buffer) {
+        // Deleting the buffer implicitly unmaps it.
+        glDeleteBuffers(1, &_buffer);
+        StateCache::current().onBufferDeleted(_buffer);
+        _buffer = 0;
     }
+    _shadow.clear();
+    _shadow.shrink_to_fit();
+    _mapped     = nullptr;
+    _persistent = false;
+    _size = _head = _tail = _flushed = 0;
+}
 
-    // todo: save to file
+// -----------------------------------------------------------------------------
+// Release the oldest frame in flight, if the GPU is done with it (or wait for it, if wait is true).
+void RingBuffer::retireFrame(bool wait) {
+    LGI_ASSERT(!_frames.empty());
+    auto & f = _frames.front();
+    if (!(wait ? f.fence.wait() : f.fence.signaled())) return;
+    _tail = f.end;
+    _frames.erase(_frames.begin());
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleFBO::saveColorToFile(uint32_t rt, const std::string & filepath) const {
-    bindColorAsTexture(rt, 0);
-    saveTextureToFile(_mips[0].width, _mips[0].height, 4, _colorTextureTarget, GL_RGBA, GL_FLOAT, filepath);
+bool RingBuffer::beginFrame(bool wait) {
+    if (!_buffer) return false;
+    if (_persistent) {
+        // Release whatever the GPU has finished, then make sure we don't get too far ahead of the GPU.
+        while (!_frames.empty()) {
+            auto n = _frames.size();
+            retireFrame(false);
+            if (n == _frames.size()) break;
+        }
+        if (!wait && _frames.size() >= _framesInFlight) return false;
+        while (_frames.size() >= _framesInFlight) retireFrame(true);
+    } else {
+        // Orphan the buffer: the driver hands us fresh storage, while the GPU keeps reading the old one.
+        auto & sc = StateCache::current();
+        sc.bindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+        LGI_CHK(glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) _size, nullptr, GL_STREAM_DRAW));
+        sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        _head = _tail = _flushed = 0;
+    }
+    return true;
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleFBO::saveDepthToFile(const std::string & filepath) const {
-    bindDepthAsTexture(0);
-    saveTextureToFile(_mips[0].width, _mips[0].height, 1, _colorTextureTarget, GL_DEPTH_COMPONENT, GL_FLOAT, filepath);
+void RingBuffer::endFrame() {
+    if (!_buffer || !_persistent) return;
+    auto & f = _frames.emplace_back();
+    f.fence.insert();
+    f.end = _head;
 }
 
 // -----------------------------------------------------------------------------
 //
-void CubeFBO::allocate(uint32_t w, uint32_t levels, GLenum internalFormat) {
-    cleanup(); // release existing buffers.
-
-    LGI_ASSERT(w > 0);
+RingBuffer::Allocation RingBuffer::alloc(size_t size, size_t alignment) { return reserve(size, alignment, true); }
 
-    // create mips array
-    while (w > 0 && (0 == levels || _mips.size() < levels)) {
-        _mips.push_back({w, {}});
-        LGI_CHK(glGenFramebuffers(6, _mips.back().fbo));
-        w >>= 1;
-    };
-
-    const auto minfilter = _mips.size() > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+// -----------------------------------------------------------------------------
+//
+RingBuffer::Allocation RingBuffer::tryAlloc(size_t size, size_t alignment) { return reserve(size, alignment, false); }
 
-    if (GL_NONE != internalFormat) {
-        LGI_CHK(glGenTextures(1, &_color));
-        LGI_CHK(glBindTexture(GL_TEXTURE_CUBE_MAP, _color));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint) _mips.size() - 1));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minfilter));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-        LGI_CHK(glTexStorage2D(GL_TEXTURE_CUBE_MAP, (GLsizei) _mips.size(), internalFormat, (GLsizei) _mips[0].width, (GLsizei) _mips[0].width));
-        for (size_t l = 0; l < _mips.size(); ++l) {
-            const auto & m = _mips[l];
-            for (int i = 0; i < 6; ++i) {
-                LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]));
-                LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, (GLenum) (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i), _color, (GLint) l));
-            }
+// -----------------------------------------------------------------------------
+//
+RingBuffer::Allocation RingBuffer::reserve(size_t size, size_t alignment, bool wait) {
+    if (!_buffer || 0 == size) return {};
+    if (0 == alignment) alignment = _alignment;
+
+    for (;;) {
+        // offsets wrap around, while _head and _tail keep growing.
+        size_t pos    = _head;
+        size_t offset = pos % _size;
+        size_t pad    = (alignment - offset % alignment) % alignment;
+        if (offset + pad + size > _size) {
+            // not enough space till the end of the buffer. skip to the beginning.
+            pad += _size - offset - pad;
+            offset = 0;
+        } else {
+            offset += pad;
         }
-    } else {
-        GLenum none = GL_NONE;
-        for (auto & m : _mips) {
-            for (int i = 0; i < 6; ++i) {
-                LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]));
-                LGI_CHK(glDrawBuffers(1, &none));
-            }
+        if (pos + pad + size - _tail <= _size) {
+            _head = pos + pad + size;
+            return {_mapped + offset, _buffer, offset, size};
         }
-    }
-
-    // depth (use texture instead of renderbuffer, since it is very likely that we'll need
-    // to read depth data in the future.)
-    LGI_CHK(glGenTextures(1, &_depth));
-    LGI_CHK(glBindTexture(GL_TEXTURE_CUBE_MAP, _depth));
-    // For OpenGL ES, depth texture works only when the texture is defined with
-    // glTexImage2D() using GL_DEPTH_COMPONENT as the internal format, as specified
-    // in OES_depth_texture extension.
-    // On OpenGL CORE profile though, glTexStorage2D() works just fine.
-    // LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT, w, h));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint) _mips.size() - 1));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minfilter));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
-    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
-    for (size_t l = 0; l < _mips.size(); ++l) {
-        const auto & m = _mips[l];
-        for (unsigned int i = 0; i < 6; ++i) {
-            LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]));
-            LGI_CHK(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLsizei) l, GL_DEPTH_COMPONENT, (GLsizei) m.width, (GLsizei) m.width, 0,
-                                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr));
-            LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, _depth, (GLint) l));
+        if (_frames.empty()) {
+            if (wait) LGI_LOGE("RingBuffer out of space: requested %zu bytes, ring size is %zu bytes.", size, _size);
+            return {};
         }
+        // Wait for the GPU to release some space. Without waiting, only take what it has released already.
+        auto n = _frames.size();
+        retireFrame(wait);
+        if (n == _frames.size()) return {};
     }
+}
 
-    // todo: stencil?
+// -----------------------------------------------------------------------------
+//
+void RingBuffer::flush() {
+    if (_persistent || !_buffer || _head == _flushed) return;
+    auto & sc = StateCache::current();
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+    LGI_CHK(glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) _flushed, (GLsizeiptr) (_head - _flushed), _mapped + _flushed));
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    _flushed = _head;
+}
 
-    // make sure the FBO is ready to use.
-    for (size_t l = 0; l < _mips.size(); ++l) {
-        const auto & m = _mips[l];
-        for (size_t i = 0; i < 6; ++i) {
-            LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]));
-            auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-            LGI_REQUIRE(GL_FRAMEBUFFER_COMPLETE == status);
-        }
+// -----------------------------------------------------------------------------
+//
+void BufferAllocator::init(GLenum target, size_t pageSize, GLenum usage, size_t minBlockSize) {
+    cleanup();
+    _usage        = usage;
+    // Buddy math (offset ^ size) only works with power of 2 block sizes.
+    _minBlockSize = 16;
+    while (_minBlockSize < minBlockSize) _minBlockSize *= 2;
+    switch (target) {
+    case GL_UNIFORM_BUFFER:
+        _alignment = (size_t) getInt(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+        break;
+    case GL_SHADER_STORAGE_BUFFER:
+        _alignment = (size_t) getInt(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT);
+        break;
+    default:
+        _alignment = 16;
+        break;
     }
+    _alignment = std::max<size_t>(_alignment, 1);
+    LGI_REQUIRE(0 == (_alignment & (_alignment - 1)), "offset alignment (%zu) of target 0x%x is not power of 2.", _alignment, target);
+    _pageSize = _minBlockSize;
+    while (_pageSize < pageSize) _pageSize *= 2;
+}
 
-    // done
-    LGI_CHK(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+// -----------------------------------------------------------------------------
+//
+void BufferAllocator::cleanup() {
+    auto & sc = StateCache::current();
+    for (auto & p : _pages) {
+        if (!p.buffer) continue;
+        glDeleteBuffers(1, &p.buffer);
+        sc.onBufferDeleted(p.buffer);
+    }
+    _pages.clear();
+    _allocations = 0;
+    _requested   = 0;
 }
 
-void DebugSSBO::printLastResult() const {
-#if DEBUG_SSBO_ENABLED
-    if (!counter) return;
-    auto count    = std::min<size_t>((*counter), buffer.size() - 1);
-    auto dataSize = sizeof(float) * (count + 1);
-    if (0 != memcmp(buffer.data(), printed.data(), dataSize)) {
-        memcpy(printed.data(), buffer.data(), dataSize);
-        std::stringstream ss;
-        ss << "count = " << *counter << " [";
-        for (size_t i = 0; i < count; ++i) {
-            auto value = printed[i + 1];
-            if (std::isnan(value))
-                ss << std::endl;
-            else
-                ss << value << ", ";
-        }
-        ss << "]";
-        LGI_LOGI("%s", ss.str().c_str());
-    }
-#endif
+// -----------------------------------------------------------------------------
+//
+uint32_t BufferAllocator::orderOf(size_t size) const {
+    uint32_t order = 0;
+    while ((_minBlockSize << order) < size) ++order;
+    return order;
 }
 
 // -----------------------------------------------------------------------------
 //
-ScreenQuad & ScreenQuad::allocate() {
-    // Cleanup previous array if any.
-    cleanup();
+uint32_t BufferAllocator::newPage(uint32_t maxOrder) {
+    // reuse slot of released page, so indices of live allocations stay valid.
+    uint32_t index = 0;
+    while (index < _pages.size() && _pages[index].buffer) ++index;
+    if (index == _pages.size()) _pages.emplace_back();
+
+    auto & p  = _pages[index];
+    auto   sz = _minBlockSize << maxOrder;
+    auto & sc = StateCache::current();
+    LGI_CHK(glGenBuffers(1, &p.buffer));
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, p.buffer);
+    LGI_CHK(glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) sz, nullptr, _usage));
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    p.maxOrder = maxOrder;
+    p.used     = 0;
+    p.free.assign(maxOrder + 1, {});
+    p.free[maxOrder].insert(0);
+    return index;
+}
 
-    // Create new array.
-    LGI_CHK(glGenVertexArrays(1, &va));
-    LGI_CHK(glBindVertexArray(va));
-    vb.allocate(sizeof(Vertex), 6, nullptr);
-    LGI_CHK(vb.bind());
-    LGI_CHK(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) 0));
-    LGI_CHK(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, u)));
-    LGI_CHK(glEnableVertexAttribArray(0));
-    LGI_CHK(glEnableVertexAttribArray(1));
-    LGI_CHK(glBindVertexArray(0)); // unbind
+// -----------------------------------------------------------------------------
+//
+bool BufferAllocator::allocFromPage(uint32_t page, uint32_t order, size_t & offset) {
+    auto & p = _pages[page];
+    if (!p.buffer || order > p.maxOrder) return false;
+
+    // find the smallest free block that is large enough.
+    uint32_t o = order;
+    while (o <= p.maxOrder && p.free[o].empty()) ++o;
+    if (o > p.maxOrder) return false;
+
+    offset = *p.free[o].begin();
+    p.free[o].erase(p.free[o].begin());
+
+    // split it down to the requested order, releasing the upper halves.
+    while (o > order) {
+        --o;
+        p.free[o].insert(offset + (_minBlockSize << o));
+    }
+    p.used += _minBlockSize << order;
+    return true;
+}
 
-    // update the buffer with default value.
-    update();
+// -----------------------------------------------------------------------------
+//
+BufferAllocator::Allocation BufferAllocator::alloc(size_t size, size_t alignment) {
+    if (0 == size || 0 == _pageSize) return {};
+    if (0 == alignment) alignment = _alignment;
+    LGI_ASSERT(0 == (alignment & (alignment - 1)));
+
+    // Blocks are aligned to their own size. So it's enough to make the block at least as large as the alignment.
+    auto order     = orderOf(std::max(size, alignment));
+    auto pageOrder = orderOf(_pageSize);
+
+    Allocation a;
+    a.size  = size;
+    a.order = order;
+    bool ok = false;
+    for (uint32_t i = 0; i < _pages.size() && !ok; ++i) {
+        if (allocFromPage(i, order, a.offset)) {
+            a.page = i;
+            ok     = true;
+        }
+    }
+    if (!ok) {
+        a.page = newPage(std::max(order, pageOrder));
+        ok     = allocFromPage(a.page, order, a.offset);
+        LGI_ASSERT(ok);
+    }
+    a.buffer = _pages[a.page].buffer;
+    ++_allocations;
+    _requested += size;
+    return a;
+}
 
-    return *this;
+// -----------------------------------------------------------------------------
+//
+void BufferAllocator::free(Allocation & a) {
+    if (!a) return;
+    LGI_ASSERT(a.page < _pages.size() && _pages[a.page].buffer == a.buffer);
+    auto & p      = _pages[a.page];
+    auto   offset = a.offset;
+    auto   order  = a.order;
+    p.used -= _minBlockSize << order;
+
+    // merge with free buddies as far as possible.
+    while (order < p.maxOrder) {
+        auto buddy = offset ^ (_minBlockSize << order);
+        auto iter  = p.free[order].find(buddy);
+        if (iter == p.free[order].end()) break;
+        p.free[order].erase(iter);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    p.free[order].insert(offset);
+
+    --_allocations;
+    _requested -= a.size;
+    a = {};
+
+    // Release the page once it is completely free. Keep at least one page around for reuse.
+    if (0 == p.used) {
+        size_t livePages = 0;
+        for (auto & i : _pages)
+            if (i.buffer) ++livePages;
+        if (livePages > 1) {
+            glDeleteBuffers(1, &p.buffer);
+            StateCache::current().onBufferDeleted(p.buffer);
+            p = {};
+        }
+    }
 }
 
 // -----------------------------------------------------------------------------
 //
-ScreenQuad & ScreenQuad::cleanup() {
-    vb.cleanup();
+void BufferAllocator::update(const Allocation & a, const void * data, size_t size, size_t offset) {
+    if (!a || 0 == size) return;
+    LGI_ASSERT(offset + size <= (_minBlockSize << a.order));
+    auto & sc = StateCache::current();
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, a.buffer);
+    LGI_DCHK(glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) (a.offset + offset), (GLsizeiptr) size, data));
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
 
-    // If we actually have a vertex array to cleanup.
-    if (va) {
-        // Delete the vertex array.
-        glDeleteVertexArrays(1, &va);
+// -----------------------------------------------------------------------------
+//
+BufferAllocator::Stats BufferAllocator::stats() const {
+    Stats s;
+    s.allocations    = _allocations;
+    s.requestedBytes = _requested;
+    for (auto & p : _pages) {
+        if (!p.buffer) continue;
+        ++s.pages;
+        s.capacity += _minBlockSize << p.maxOrder;
+        s.allocatedBytes += p.used;
+        for (uint32_t o = 0; o <= p.maxOrder; ++o) {
+            if (p.free[o].empty()) continue;
+            auto blockSize = _minBlockSize << o;
+            s.freeBytes += blockSize * p.free[o].size();
+            s.largestFreeBlock = std::max(s.largestFreeBlock, blockSize);
+        }
+    }
+    return s;
+}
 
-        // Reset this to mark it as cleaned up.
-        va = 0;
+// -----------------------------------------------------------------------------
+//
+void BufferReadback::cleanup() {
+    auto & sc = StateCache::current();
+    for (auto & s : _pool) {
+        if (s.buffer) {
+            glDeleteBuffers(1, &s.buffer);
+            sc.onBufferDeleted(s.buffer);
+        }
     }
-    LGI_CHK(;);
-    return *this;
+    _pool.clear();
 }
 
 // -----------------------------------------------------------------------------
 //
-ScreenQuad & ScreenQuad::update(const glm::vec4 pos, const glm::vec4 & uv) {
-    const Vertex vertices[] = {
-        {pos.x, pos.w, uv.x, uv.w}, {pos.y, pos.w, uv.y, uv.w}, {pos.x, pos.z, uv.x, uv.z},
-        {pos.x, pos.z, uv.x, uv.z}, {pos.y, pos.w, uv.y, uv.w}, {pos.y, pos.z, uv.y, uv.z},
-    };
-    vb.update(vertices, 0, 6);
-    return *this;
+BufferReadback::Handle BufferReadback::read(GLuint buffer, size_t offset, size_t size, Callback callback) {
+    if (!buffer || 0 == size) return {};
+
+    // Pick the smallest idle staging buffer that is large enough. Otherwise, grow an idle one or create a new one.
+    Staging * fit  = nullptr;
+    Staging * grow = nullptr;
+    for (auto & i : _pool) {
+        if (i.busy) continue;
+        if (i.capacity >= size) {
+            if (!fit || i.capacity < fit->capacity) fit = &i;
+        } else if (!grow || i.capacity > grow->capacity) {
+            grow = &i;
+        }
+    }
+    Staging * s = fit ? fit : grow ? grow : &_pool.emplace_back();
+
+    auto & sc = StateCache::current();
+    if (s->capacity < size) {
+        if (!s->buffer) { LGI_CHK(glGenBuffers(1, &s->buffer)); }
+        sc.bindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+        LGI_CHK(glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_READ));
+        s->capacity = size;
+    }
+
+    sc.bindBuffer(GL_COPY_READ_BUFFER, buffer);
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, s->buffer);
+    LGI_CHK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) offset, 0, (GLsizeiptr) size));
+    s->fence.insert();
+    sc.bindBuffer(GL_COPY_READ_BUFFER, 0);
+    sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    s->size     = size;
+    s->busy     = true;
+    s->callback = std::move(callback);
+    ++s->generation;
+    return {(uint32_t) (s - _pool.data()), s->generation};
 }
 
 // -----------------------------------------------------------------------------
 //
-SimpleMesh & SimpleMesh::allocate(const AllocateParameters & p) {
-    // Cleanup previous array if any.
-    cleanup();
+BufferReadback::Staging * BufferReadback::find(Handle h) {
+    if (!h || h.index >= _pool.size()) return nullptr;
+    auto & s = _pool[h.index];
+    return (s.busy && s.generation == h.generation) ? &s : nullptr;
+}
 
-    // Create new vertex array
-    LGI_CHK(glGenVertexArrays(1, &va));
-    LGI_CHK(glBindVertexArray(va));
-    vb.allocate(sizeof(Vertex), p.vertexCount, p.vertices);
-    if (vb) {
-        LGI_CHK(vb.bind());
-        LGI_CHK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, position)));
-        LGI_CHK(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, normal)));
-        LGI_CHK(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, tangent)));
-        LGI_CHK(glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, color)));
-        LGI_CHK(glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, uv0)));
-        LGI_CHK(glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, uv1)));
-        LGI_CHK(glEnableVertexAttribArray(0));
-        LGI_CHK(glEnableVertexAttribArray(1));
-        LGI_CHK(glEnableVertexAttribArray(2));
-        LGI_CHK(glEnableVertexAttribArray(3));
-        LGI_CHK(glEnableVertexAttribArray(4));
-        LGI_CHK(glEnableVertexAttribArray(5));
-    }
-    LGI_CHK(glBindVertexArray(0)); // unbind
+// -----------------------------------------------------------------------------
+//
+bool BufferReadback::poll(Staging & s, uint64_t timeoutNs) {
+    if (!s.fence.wait(timeoutNs)) return false;
+    s.fence.reset();
+    return true;
+}
 
-    // Create new index array
-    if (p.index32) {
-        indexSize = 4;
-        indexType = GL_UNSIGNED_INT;
-        ib.allocate(4, p.indexCount, p.index32);
-    } else if (p.index16) {
-        indexSize = 2;
-        indexType = GL_UNSIGNED_SHORT;
-        ib.allocate(2, p.indexCount, p.index16);
+// -----------------------------------------------------------------------------
+//
+void BufferReadback::deliver(Staging & s, void * dst, size_t size) {
+    auto & sc = StateCache::current();
+    sc.bindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+    void * ptr = nullptr;
+    LGI_CHK(ptr = glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) s.size, GL_MAP_READ_BIT));
+    if (ptr) {
+        if (dst) std::memcpy(dst, ptr, std::min(size, s.size));
+        if (s.callback) s.callback(ptr, s.size);
+        LGI_CHK(glUnmapBuffer(GL_COPY_READ_BUFFER));
     }
+    sc.bindBuffer(GL_COPY_READ_BUFFER, 0);
+}
 
-    return *this;
+// -----------------------------------------------------------------------------
+//
+void BufferReadback::recycle(Staging & s) {
+    s.fence.reset();
+    s.busy     = false;
+    s.size     = 0;
+    s.callback = {};
 }
 
-SimpleMesh & SimpleMesh::cleanup() {
-    vb.cleanup();
-    ib.cleanup();
+// -----------------------------------------------------------------------------
+//
+bool BufferReadback::ready(Handle h) {
+    auto s = find(h);
+    return s && poll(*s, 0);
+}
 
-    // If we actually have a vertex array to cleanup.
-    if (va) {
-        // Delete the vertex array.
-        glDeleteVertexArrays(1, &va);
+// -----------------------------------------------------------------------------
+//
+bool BufferReadback::wait(Handle h, uint64_t timeoutNs) {
+    auto s = find(h);
+    return s && poll(*s, timeoutNs);
+}
 
-        // Reset this to mark it as cleaned up.
-        va = 0;
-    }
-    LGI_CHK(;);
-    return *this;
+// -----------------------------------------------------------------------------
+//
+bool BufferReadback::get(Handle & h, void * dst, size_t size) {
+    auto s = find(h);
+    if (!s || !poll(*s, 0)) return false;
+    deliver(*s, dst, size);
+    recycle(*s);
+    h = {};
+    return true;
 }
 
 // -----------------------------------------------------------------------------
 //
-static const char * shaderType2String(GLenum shaderType) {
-    switch (shaderType) {
-    case GL_VERTEX_SHADER:
-        return "vertex";
-    case GL_FRAGMENT_SHADER:
-        return "fragment";
-    case GL_COMPUTE_SHADER:
-        return "compute";
-    default:
-        return "";
-    }
+void BufferReadback::release(Handle & h) {
+    if (auto s = find(h)) recycle(*s);
+    h = {};
 }
 
 // -----------------------------------------------------------------------------
-static std::string addLineCount(const std::string & in) {
-    std::stringstream ss;
-    ss << "(  1) : ";
-    int line = 1;
-    for (auto ch : in) {
-        if ('\n' == ch)
-            ss << lgi::format("\n(%3d) : ", ++line);
-        else
-            ss << ch;
+//
+void BufferReadback::update() {
+    for (auto & s : _pool) {
+        if (!s.busy || !s.callback || !poll(s, 0)) continue;
+        deliver(s, nullptr, 0);
+        recycle(s);
     }
-    return ss.str();
 }
 
 // -----------------------------------------------------------------------------
 //
-GLuint loadShaderFromString(const char * source, size_t length, GLenum shaderType, const char * optionalFilename) {
-    if (!source || !*source) {
-        LGI_LOGE("Empty shader source");
-        return 0;
-    }
-    auto [trimmed, trimmedLength] = lgi::trim(source, length);
-    if (0 == trimmedLength) {
-        LGI_LOGE("Empty shader source");
-        return 0;
+size_t BufferReadback::pending() const {
+    return (size_t) std::count_if(_pool.begin(), _pool.end(), [](const Staging & s) { return s.busy; });
+}
+
+// -----------------------------------------------------------------------------
+//
+bool lgi::verifyBlockLayout(GLuint program, GLenum target, const char * blockName, size_t blockSize, const BlockMember * members,
+                            const char * const * names, size_t count) {
+    GLenum blockInterface  = GL_UNIFORM_BUFFER == target ? GL_UNIFORM_BLOCK : GL_SHADER_STORAGE_BLOCK;
+    GLenum memberInterface = GL_UNIFORM_BUFFER == target ? GL_UNIFORM : GL_BUFFER_VARIABLE;
+
+    GLuint block = GL_INVALID_INDEX;
+    LGI_CHK(block = glGetProgramResourceIndex(program, blockInterface, blockName));
+    if (GL_INVALID_INDEX == block) {
+        LGI_LOGE("block %s not found in program %u.", blockName, program);
+        return false;
     }
-    GLint sizes[] = {(GLint) trimmedLength};
-    auto  shader  = glCreateShader(shaderType);
-    LGI_CHK(glShaderSource(shader, 1, &trimmed, sizes));
-    LGI_CHK(glCompileShader(shader));
 
-    // check for shader compile errors
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (GL_TRUE != success) {
-        static thread_local char infoLog[4096];
-        glGetShaderInfoLog(shader, 4096, NULL, infoLog);
-        glDeleteShader(shader);
-        LGI_LOGE("\n================== Failed to compile %s shader '%s' ====================\n"
-                 "%s\n"
-                 "\n============================= GLSL shader source ===============================\n"
-                 "%s\n"
-                 "\n================================================================================\n",
-                 shaderType2String(shaderType), (optionalFilename && *optionalFilename) ? optionalFilename : "<no-name>", infoLog,
-                 addLineCount(trimmed).c_str());
-        return 0;
+    bool   ok       = true;
+    GLenum sizeProp = GL_BUFFER_DATA_SIZE;
+    GLint  dataSize = 0;
+    LGI_CHK(glGetProgramResourceiv(program, blockInterface, block, 1, &sizeProp, 1, nullptr, &dataSize));
+    if ((size_t) dataSize > blockSize) {
+        LGI_LOGE("block %s: program expects %d bytes, but the layout has only %zu bytes.", blockName, dataSize, blockSize);
+        ok = false;
     }
 
-    // done
-    LGI_ASSERT(shader);
-    return shader;
+    for (size_t i = 0; i < count; ++i) {
+        GLuint index = GL_INVALID_INDEX;
+        LGI_CHK(index = glGetProgramResourceIndex(program, memberInterface, names[i]));
+        if (GL_INVALID_INDEX == index) {
+            LGI_LOGW("block %s: member %s not found. It might be optimized out.", blockName, names[i]);
+            continue;
+        }
+        const GLenum props[] = {GL_OFFSET, GL_ARRAY_STRIDE, GL_MATRIX_STRIDE};
+        GLint        values[3] {};
+        LGI_CHK(glGetProgramResourceiv(program, memberInterface, index, 3, props, 3, nullptr, values));
+        auto & m = members[i];
+        if ((size_t) values[0] != m.offset || (m.arraySize > 0 && (size_t) values[1] != m.arrayStride) ||
+            (m.columns > 1 && (size_t) values[2] != m.matrixStride)) {
+            LGI_LOGE("block %s: layout of member %s mismatch. (offset, array stride, matrix stride) is (%d, %d, %d) in program, "
+                     "but (%zu, %zu, %zu) in layout.",
+                     blockName, names[i], values[0], values[1], values[2], m.offset, m.arrayStride, m.matrixStride);
+            ok = false;
+        }
+    }
+    return ok;
 }
 
 // -----------------------------------------------------------------------------
 //
-GLuint linkProgram(const std::vector<GLuint> & shaders, const char * optionalProgramName) {
-    auto program = glCreateProgram();
-    for (auto s : shaders)
-        if (s) glAttachShader(program, s);
-    glLinkProgram(program);
-    for (auto s : shaders)
-        if (s) glDetachShader(program, s);
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        glDeleteProgram(program);
-        LGI_LOGE("Failed to link program %s:\n%s", (optionalProgramName && *optionalProgramName) ? optionalProgramName : "no-name", infoLog);
-        return 0;
+void TextureObject::attach(GLenum target, GLuint id) {
+    cleanup();
+    _owned       = false;
+    _desc.target = target;
+    _desc.id     = id;
+    bind(0);
+
+    glGetTexLevelParameteriv(_desc.target, 0, GL_TEXTURE_WIDTH, (GLint *) &_desc.width);
+    LGI_ASSERT(_desc.width);
+
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, (GLint *) &_desc.height);
+    LGI_ASSERT(_desc.height);
+
+    // determine depth
+    switch (target) {
+    case GL_TEXTURE_2D_ARRAY:
+    case GL_TEXTURE_3D:
+        glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, (GLint *) &_desc.depth);
+        LGI_ASSERT(_desc.depth);
+        break;
+    case GL_TEXTURE_CUBE_MAP:
+        _desc.depth = 6;
+        break;
+    default:
+        _desc.depth = 1;
+        break;
     }
 
-    // Enable the following code to dump GL program binary to disk.
-#if 0
-    if (optionalProgramName) {
-        std::string outfilename = std::string(optionalProgramName) + ".bin";
-        std::ofstream fs;
-        fs.open(outfilename);
-        if (fs.good()) {
-            std::vector<uint8_t> buffer(1024 * 1024 * 1024); // allocate 1MB buffer.
-            GLsizei len;
-            GLenum dummyFormat;
-            LGI_CHK(glGetProgramBinary(program, (GLsizei)buffer.size(), &len, &dummyFormat, buffer.data()));
-            fs.write((const char*)buffer.data(), len);
-        }
-    }
-#endif
+    GLint maxLevel;
+    glGetTexParameteriv(target, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    _desc.mips = (uint32_t) maxLevel + 1;
+
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint *) &_desc.internalFormat);
+
+    unbind();
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::allocate2D(GLenum internalFormat, size_t w, size_t h, size_t m) {
+    cleanup();
+    internalFormat       = resolveFormat(internalFormat, w, h);
+    _desc.target         = GL_TEXTURE_2D;
+    _desc.internalFormat = internalFormat;
+    _desc.width          = (uint32_t) w;
+    _desc.height         = (uint32_t) h;
+    _desc.depth          = (uint32_t) 1;
+    _desc.mips           = (uint32_t) m;
+    _owned               = true;
+    LGI_CHK(glGenTextures(1, &_desc.id));
+    StateCache::current().bindTexture(_desc.target, _desc.id);
+    applyDefaultParameters();
+    LGI_CHK(glTexStorage2D(_desc.target, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.height));
+    StateCache::current().bindTexture(_desc.target, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::allocate2DArray(GLenum internalFormat, size_t w, size_t h, size_t l, size_t m) {
+    cleanup();
+    internalFormat       = resolveFormat(internalFormat, w, h);
+    _desc.target         = GL_TEXTURE_2D_ARRAY;
+    _desc.internalFormat = internalFormat;
+    _desc.width          = (uint32_t) w;
+    _desc.height         = (uint32_t) h;
+    _desc.depth          = (uint32_t) l;
+    _desc.mips           = (uint32_t) m;
+    _owned               = true;
+    LGI_CHK(glGenTextures(1, &_desc.id));
+    StateCache::current().bindTexture(_desc.target, _desc.id);
+    applyDefaultParameters();
+    LGI_CHK(glTexStorage3D(_desc.target, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.height, (GLsizei) _desc.depth));
+    StateCache::current().bindTexture(_desc.target, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::allocateCube(GLenum internalFormat, size_t w, size_t m) {
+    cleanup();
+    internalFormat       = resolveFormat(internalFormat, w, w);
+    _desc.target         = GL_TEXTURE_CUBE_MAP;
+    _desc.internalFormat = internalFormat;
+    _desc.width          = (uint32_t) w;
+    _desc.height         = (uint32_t) w;
+    _desc.depth          = 6;
+    _desc.mips           = (uint32_t) m;
+    _owned               = true;
+    LGI_CHK(glGenTextures(1, &_desc.id));
+    StateCache::current().bindTexture(GL_TEXTURE_CUBE_MAP, _desc.id);
+    applyDefaultParameters();
+    LGI_CHK(glTexStorage2D(GL_TEXTURE_CUBE_MAP, (GLsizei) _desc.mips, internalFormat, (GLsizei) _desc.width, (GLsizei) _desc.width));
+    StateCache::current().bindTexture(_desc.target, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::allocate(const TextureDesc & d) {
+    switch (d.target) {
+    case GL_TEXTURE_2D:
+        allocate2D(d.internalFormat, d.width, d.height, d.mips);
+        break;
+    case GL_TEXTURE_2D_ARRAY:
+        allocate2DArray(d.internalFormat, d.width, d.height, d.depth, d.mips);
+        break;
+    case GL_TEXTURE_CUBE_MAP:
+        allocateCube(d.internalFormat, d.width, d.mips);
+        break;
+    default:
+        LGI_THROW("unsupported texture target: 0x%X", d.target);
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureObject::PixelFormat TextureObject::pixelFormat(GLenum internalFormat) {
+    switch (internalFormat) {
+    case GL_R8: return {GL_RED, GL_UNSIGNED_BYTE, 1};
+    case GL_RG8: return {GL_RG, GL_UNSIGNED_BYTE, 2};
+    case GL_RGB8:
+    case GL_SRGB8: return {GL_RGB, GL_UNSIGNED_BYTE, 3};
+    case GL_RGBA8:
+    case GL_SRGB8_ALPHA8: return {GL_RGBA, GL_UNSIGNED_BYTE, 4};
+    case GL_R16: return {GL_RED, GL_UNSIGNED_SHORT, 2};
+    case GL_RG16: return {GL_RG, GL_UNSIGNED_SHORT, 4};
+    case GL_RGBA16: return {GL_RGBA, GL_UNSIGNED_SHORT, 8};
+    case GL_R16F: return {GL_RED, GL_HALF_FLOAT, 2};
+    case GL_RG16F: return {GL_RG, GL_HALF_FLOAT, 4};
+    case GL_RGB16F: return {GL_RGB, GL_HALF_FLOAT, 6};
+    case GL_RGBA16F: return {GL_RGBA, GL_HALF_FLOAT, 8};
+    case GL_R32F: return {GL_RED, GL_FLOAT, 4};
+    case GL_RG32F: return {GL_RG, GL_FLOAT, 8};
+    case GL_RGB32F: return {GL_RGB, GL_FLOAT, 12};
+    case GL_RGBA32F: return {GL_RGBA, GL_FLOAT, 16};
+    case GL_R8UI: return {GL_RED_INTEGER, GL_UNSIGNED_BYTE, 1};
+    case GL_RGBA8UI: return {GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, 4};
+    case GL_R16UI: return {GL_RED_INTEGER, GL_UNSIGNED_SHORT, 2};
+    case GL_R32UI: return {GL_RED_INTEGER, GL_UNSIGNED_INT, 4};
+    case GL_RG32UI: return {GL_RG_INTEGER, GL_UNSIGNED_INT, 8};
+    case GL_RGBA32UI: return {GL_RGBA_INTEGER, GL_UNSIGNED_INT, 16};
+    case GL_R32I: return {GL_RED_INTEGER, GL_INT, 4};
+    case GL_RGB10_A2: return {GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, 4};
+    case GL_R11F_G11F_B10F: return {GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4};
+    case GL_RGB9_E5: return {GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, 4};
+    case GL_DEPTH_COMPONENT16: return {GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, 2};
+    case GL_DEPTH_COMPONENT24: return {GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 4};
+    case GL_DEPTH_COMPONENT32F: return {GL_DEPTH_COMPONENT, GL_FLOAT, 4};
+    case GL_DEPTH24_STENCIL8: return {GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 4};
+    case GL_DEPTH32F_STENCIL8: return {GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, 8};
+    default: return {};
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+size_t TextureObject::TextureDesc::byteSize() const {
+    size_t texel;
+    switch (internalFormat) {
+    case GL_R8:
+        texel = 1;
+        break;
+    case GL_RG8:
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:
+        texel = 2;
+        break;
+    case GL_RGBA16F:
+    case GL_RG32F:
+        texel = 8;
+        break;
+    case GL_RGBA32F:
+        texel = 16;
+        break;
+    case GL_RGB32F:
+        texel = 12;
+        break;
+    case GL_RGB16F:
+        texel = 6;
+        break;
+    case GL_DEPTH32F_STENCIL8:
+        texel = 8;
+        break;
+    default: // RGBA8, R32F, RG16F, R11G11B10F, RGB10A2, DEPTH24, DEPTH32F etc.
+        texel = 4;
+        break;
+    }
+    bool     compressed = blockInfo(internalFormat).compressed();
+    size_t   total      = 0;
+    uint32_t w = width, h = height;
+    for (uint32_t i = 0; i < mips; ++i) {
+        total += (compressed ? compressedImageSize(internalFormat, w, h) : (size_t) w * h * texel) * depth;
+        w = std::max(1u, w >> 1);
+        h = std::max(1u, h >> 1);
+    }
+    return total;
+}
+
+void TextureObject::applyDefaultParameters() {
+    LGI_ASSERT(_desc.width > 0);
+    LGI_ASSERT(_desc.height > 0);
+    LGI_ASSERT(_desc.depth > 0);
+    LGI_ASSERT(_desc.mips > 0);
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_BASE_LEVEL, 0));
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MAX_LEVEL, (GLint) _desc.mips - 1));
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MIN_FILTER, _desc.mips > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST));
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    LGI_CHK(glTexParameteri(_desc.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::setPixels(size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t rowLength, GLenum format, GLenum type) const {
+    if (empty()) return;
+    StateCache::current().bindTexture(_desc.target, _desc.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (int) rowLength);
+    LGI_DCHK(glTexSubImage2D(_desc.target, (GLint) level, (GLint) x, (GLint) y, (GLsizei) w, (GLsizei) h, format, type, pixels));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    LGI_CHK(;);
+}
+
+void TextureObject::setPixels(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t rowLength, GLenum format,
+                              GLenum type) const {
+    if (empty()) return;
+
+    StateCache::current().bindTexture(_desc.target, _desc.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (int) rowLength);
+    if (_desc.isCube()) {
+        // cube faces are not addressable as layers of glTexSubImage3D until GL 4.5.
+        LGI_DCHK(glTexSubImage2D((GLenum) (GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer), (GLint) level, (GLint) x, (GLint) y, (GLsizei) w, (GLsizei) h, format,
+                                 type, pixels));
+    } else {
+        LGI_DCHK(glTexSubImage3D(_desc.target, (GLint) level, (GLint) x, (GLint) y, (GLint) layer, (GLsizei) w, (GLsizei) h, 1, format, type, pixels));
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    LGI_CHK(;);
+}
+
+// -----------------------------------------------------------------------------
+// Compressed formats. Enum values are spelled out, since GL headers other than glad may not define all of them.
+// -----------------------------------------------------------------------------
+
+namespace lgi {
+
+struct CompressedFormat {
+    GLenum   format;
+    uint32_t blockWidth, blockHeight, blockBytes;
+    bool     srgb;
+};
+
+static const CompressedFormat COMPRESSED_FORMATS[] = {
+    // BC1-BC3 (S3TC)
+    {0x83F0, 4, 4, 8, false},  // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    {0x83F1, 4, 4, 8, false},  // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+    {0x8C4C, 4, 4, 8, true},   // GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    {0x8C4D, 4, 4, 8, true},   // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+    {0x83F2, 4, 4, 16, false}, // GL_COMPRESSED_RGBA_S3TC_DXT3_EXT
+    {0x8C4E, 4, 4, 16, true},  // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT
+    {0x83F3, 4, 4, 16, false}, // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    {0x8C4F, 4, 4, 16, true},  // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+    // BC4-BC5 (RGTC)
+    {0x8DBB, 4, 4, 8, false},  // GL_COMPRESSED_RED_RGTC1
+    {0x8DBC, 4, 4, 8, false},  // GL_COMPRESSED_SIGNED_RED_RGTC1
+    {0x8DBD, 4, 4, 16, false}, // GL_COMPRESSED_RG_RGTC2
+    {0x8DBE, 4, 4, 16, false}, // GL_COMPRESSED_SIGNED_RG_RGTC2
+    // BC6H-BC7 (BPTC)
+    {0x8E8C, 4, 4, 16, false}, // GL_COMPRESSED_RGBA_BPTC_UNORM
+    {0x8E8D, 4, 4, 16, true},  // GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+    {0x8E8E, 4, 4, 16, false}, // GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT
+    {0x8E8F, 4, 4, 16, false}, // GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT
+    // ETC2/EAC
+    {0x9270, 4, 4, 8, false},  // GL_COMPRESSED_R11_EAC
+    {0x9271, 4, 4, 8, false},  // GL_COMPRESSED_SIGNED_R11_EAC
+    {0x9272, 4, 4, 16, false}, // GL_COMPRESSED_RG11_EAC
+    {0x9273, 4, 4, 16, false}, // GL_COMPRESSED_SIGNED_RG11_EAC
+    {0x9274, 4, 4, 8, false},  // GL_COMPRESSED_RGB8_ETC2
+    {0x9275, 4, 4, 8, true},   // GL_COMPRESSED_SRGB8_ETC2
+    {0x9276, 4, 4, 8, false},  // GL_COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2
+    {0x9277, 4, 4, 8, true},   // GL_COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2
+    {0x9278, 4, 4, 16, false}, // GL_COMPRESSED_RGBA8_ETC2_EAC
+    {0x9279, 4, 4, 16, true},  // GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+    // ASTC LDR. sRGB variants are at +0x20.
+    {0x93B0, 4, 4, 16, false},   // GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+    {0x93B1, 5, 4, 16, false},   // GL_COMPRESSED_RGBA_ASTC_5x4_KHR
+    {0x93B2, 5, 5, 16, false},   // GL_COMPRESSED_RGBA_ASTC_5x5_KHR
+    {0x93B3, 6, 5, 16, false},   // GL_COMPRESSED_RGBA_ASTC_6x5_KHR
+    {0x93B4, 6, 6, 16, false},   // GL_COMPRESSED_RGBA_ASTC_6x6_KHR
+    {0x93B5, 8, 5, 16, false},   // GL_COMPRESSED_RGBA_ASTC_8x5_KHR
+    {0x93B6, 8, 6, 16, false},   // GL_COMPRESSED_RGBA_ASTC_8x6_KHR
+    {0x93B7, 8, 8, 16, false},   // GL_COMPRESSED_RGBA_ASTC_8x8_KHR
+    {0x93B8, 10, 5, 16, false},  // GL_COMPRESSED_RGBA_ASTC_10x5_KHR
+    {0x93B9, 10, 6, 16, false},  // GL_COMPRESSED_RGBA_ASTC_10x6_KHR
+    {0x93BA, 10, 8, 16, false},  // GL_COMPRESSED_RGBA_ASTC_10x8_KHR
+    {0x93BB, 10, 10, 16, false}, // GL_COMPRESSED_RGBA_ASTC_10x10_KHR
+    {0x93BC, 12, 10, 16, false}, // GL_COMPRESSED_RGBA_ASTC_12x10_KHR
+    {0x93BD, 12, 12, 16, false}, // GL_COMPRESSED_RGBA_ASTC_12x12_KHR
+    {0x93D0, 4, 4, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+    {0x93D1, 5, 4, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x4_KHR
+    {0x93D2, 5, 5, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_5x5_KHR
+    {0x93D3, 6, 5, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x5_KHR
+    {0x93D4, 6, 6, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_6x6_KHR
+    {0x93D5, 8, 5, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x5_KHR
+    {0x93D6, 8, 6, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x6_KHR
+    {0x93D7, 8, 8, 16, true},    // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_8x8_KHR
+    {0x93D8, 10, 5, 16, true},   // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x5_KHR
+    {0x93D9, 10, 6, 16, true},   // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x6_KHR
+    {0x93DA, 10, 8, 16, true},   // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x8_KHR
+    {0x93DB, 10, 10, 16, true},  // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_10x10_KHR
+    {0x93DC, 12, 10, 16, true},  // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x10_KHR
+    {0x93DD, 12, 12, 16, true},  // GL_COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR
+};
+
+static const CompressedFormat * findCompressedFormat(GLenum f) {
+    for (const auto & c : COMPRESSED_FORMATS)
+        if (c.format == f) return &c;
+    return nullptr;
+}
+
+static TextureObject::BlockDecoder & fallbackDecoder() {
+    static TextureObject::BlockDecoder d;
+    return d;
+}
+
+static void decode565(uint16_t c, uint8_t * rgb) {
+    auto r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0]  = (uint8_t) ((r << 3) | (r >> 2));
+    rgb[1]  = (uint8_t) ((g << 2) | (g >> 4));
+    rgb[2]  = (uint8_t) ((b << 3) | (b >> 2));
+}
+
+// Decode the color part of a BC1/BC2/BC3 block to 16 RGBA pixels.
+static void decodeBC1Colors(const uint8_t * b, uint8_t px[16][4], bool fourColorOnly, bool hasAlpha) {
+    auto    c0 = (uint16_t) (b[0] | (b[1] << 8));
+    auto    c1 = (uint16_t) (b[2] | (b[3] << 8));
+    uint8_t palette[4][4];
+    decode565(c0, palette[0]);
+    decode565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+    for (int i = 0; i < 3; ++i) {
+        if (c0 > c1 || fourColorOnly) {
+            palette[2][i] = (uint8_t) ((2 * palette[0][i] + palette[1][i]) / 3);
+            palette[3][i] = (uint8_t) ((palette[0][i] + 2 * palette[1][i]) / 3);
+        } else {
+            palette[2][i] = (uint8_t) ((palette[0][i] + palette[1][i]) / 2);
+            palette[3][i] = 0;
+        }
+    }
+    if (c0 <= c1 && !fourColorOnly && hasAlpha) palette[3][3] = 0;
+    uint32_t idx = (uint32_t) b[4] | ((uint32_t) b[5] << 8) | ((uint32_t) b[6] << 16) | ((uint32_t) b[7] << 24);
+    for (int i = 0; i < 16; ++i) memcpy(px[i], palette[(idx >> (2 * i)) & 3], 4);
+}
+
+// Decode a BC4 (or BC3 alpha) block to 16 values.
+static void decodeBC4Channel(const uint8_t * b, uint8_t out[16]) {
+    int v[8] = {b[0], b[1]};
+    if (v[0] > v[1]) {
+        for (int i = 1; i < 7; ++i) v[1 + i] = ((7 - i) * v[0] + i * v[1]) / 7;
+    } else {
+        for (int i = 1; i < 5; ++i) v[1 + i] = ((5 - i) * v[0] + i * v[1]) / 5;
+        v[6] = 0;
+        v[7] = 255;
+    }
+    uint64_t idx = 0;
+    for (int i = 0; i < 6; ++i) idx |= (uint64_t) b[2 + i] << (8 * i);
+    for (int i = 0; i < 16; ++i) out[i] = (uint8_t) v[(idx >> (3 * i)) & 7];
+}
+
+// Software decoder of unsigned BC1-BC5, used when the driver lacks S3TC/RGTC support.
+static bool decodeBCBlocks(GLenum format, const void * blocks, size_t w, size_t h, uint8_t * rgba) {
+    auto info = findCompressedFormat(format);
+    if (!info) return false;
+    size_t blocksX = (w + 3) / 4, blocksY = (h + 3) / 4;
+    auto   src     = (const uint8_t *) blocks;
+    for (size_t by = 0; by < blocksY; ++by) {
+        for (size_t bx = 0; bx < blocksX; ++bx) {
+            const uint8_t * b = src + (by * blocksX + bx) * info->blockBytes;
+            uint8_t         px[16][4], a[16], g[16];
+            switch (format) {
+            case 0x83F0: // RGB DXT1
+            case 0x8C4C:
+                decodeBC1Colors(b, px, false, false);
+                break;
+            case 0x83F1: // RGBA DXT1
+            case 0x8C4D:
+                decodeBC1Colors(b, px, false, true);
+                break;
+            case 0x83F2: // DXT3
+            case 0x8C4E:
+                decodeBC1Colors(b + 8, px, true, true);
+                for (int i = 0; i < 16; ++i) px[i][3] = (uint8_t) (((b[i / 2] >> (4 * (i & 1))) & 15) * 17);
+                break;
+            case 0x83F3: // DXT5
+            case 0x8C4F:
+                decodeBC1Colors(b + 8, px, true, true);
+                decodeBC4Channel(b, a);
+                for (int i = 0; i < 16; ++i) px[i][3] = a[i];
+                break;
+            case 0x8DBB: // RGTC1
+                decodeBC4Channel(b, a);
+                for (int i = 0; i < 16; ++i) px[i][0] = a[i], px[i][1] = 0, px[i][2] = 0, px[i][3] = 255;
+                break;
+            case 0x8DBD: // RGTC2
+                decodeBC4Channel(b, a);
+                decodeBC4Channel(b + 8, g);
+                for (int i = 0; i < 16; ++i) px[i][0] = a[i], px[i][1] = g[i], px[i][2] = 0, px[i][3] = 255;
+                break;
+            default:
+                return false;
+            }
+            for (size_t y = 0; y < 4 && by * 4 + y < h; ++y)
+                for (size_t x = 0; x < 4 && bx * 4 + x < w; ++x) memcpy(rgba + ((by * 4 + y) * w + bx * 4 + x) * 4, px[y * 4 + x], 4);
+        }
+    }
+    return true;
+}
+
+} // namespace lgi
+
+// -----------------------------------------------------------------------------
+//
+TextureObject::BlockInfo TextureObject::blockInfo(GLenum internalFormat) {
+    auto c = lgi::findCompressedFormat(internalFormat);
+    if (!c) return {};
+    return {c->blockWidth, c->blockHeight, c->blockBytes};
+}
+
+size_t TextureObject::compressedRowPitch(GLenum internalFormat, size_t width) {
+    auto b = blockInfo(internalFormat);
+    return (width + b.width - 1) / b.width * b.bytes;
+}
+
+size_t TextureObject::compressedImageSize(GLenum internalFormat, size_t width, size_t height) {
+    auto b = blockInfo(internalFormat);
+    return compressedRowPitch(internalFormat, width) * ((height + b.height - 1) / b.height);
+}
+
+GLenum TextureObject::fallbackFormat(GLenum internalFormat) {
+    auto c = lgi::findCompressedFormat(internalFormat);
+    if (!c) return internalFormat;
+    return c->srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+void TextureObject::setFallbackDecoder(BlockDecoder d) { lgi::fallbackDecoder() = std::move(d); }
+
+bool TextureObject::decodeBlocks(GLenum internalFormat, const void * blocks, size_t w, size_t h, uint8_t * rgba) {
+    if (lgi::decodeBCBlocks(internalFormat, blocks, w, h, rgba)) return true;
+    return lgi::fallbackDecoder() && lgi::fallbackDecoder()(internalFormat, blocks, w, h, rgba);
+}
+
+// -----------------------------------------------------------------------------
+//
+bool TextureObject::isFormatSupported(GLenum internalFormat) {
+    if (!blockInfo(internalFormat).compressed()) return true;
+
+    thread_local std::unordered_map<GLenum, bool> cache;
+    auto                                          it = cache.find(internalFormat);
+    if (it != cache.end()) return it->second;
+
+    bool supported = false, queried = false;
+#if LITESPD_GL_ENABLE_GLAD
+    // The list of GL_COMPRESSED_TEXTURE_FORMATS is allowed to omit formats that are not "general purpose" (like RGTC
+    // and BPTC), so prefer the internal format query when available.
+    if (GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_internalformat_query2) {
+        GLint v = GL_FALSE;
+        glGetInternalformativ(GL_TEXTURE_2D, internalFormat, GL_INTERNALFORMAT_SUPPORTED, 1, &v);
+        supported = GL_TRUE == v;
+        queried   = true;
+    }
+#endif
+    if (!queried) {
+        GLint n = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &n);
+        std::vector<GLint> formats((size_t) std::max(n, 0));
+        if (n > 0) glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+        supported = formats.end() != std::find(formats.begin(), formats.end(), (GLint) internalFormat);
+    }
+    cache[internalFormat] = supported;
+    return supported;
+}
+
+// -----------------------------------------------------------------------------
+//
+GLenum TextureObject::resolveFormat(GLenum internalFormat, size_t w, size_t h) {
+    auto b = blockInfo(internalFormat);
+    if (!b.compressed()) return internalFormat;
+    if (w % b.width || h % b.height)
+        LGI_LOGW("texture size %zux%zu is not multiple of the %ux%u block size of format 0x%X. Some drivers reject it.", w, h, b.width, b.height,
+                 internalFormat);
+    if (isFormatSupported(internalFormat)) return internalFormat;
+    auto fallback = fallbackFormat(internalFormat);
+    LGI_LOGW("compressed texture format 0x%X is not supported. Fall back to 0x%X.", internalFormat, fallback);
+    _fallbackFrom = internalFormat;
+    return fallback;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureObject::setCompressedPixels(size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const {
+    uploadCompressed(0, level, x, y, w, h, blocks, sizeInBytes);
+}
+
+void TextureObject::setCompressedPixels(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const {
+    uploadCompressed(layer, level, x, y, w, h, blocks, sizeInBytes);
+}
+
+void TextureObject::uploadCompressed(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const {
+    if (empty() || !blocks) return;
+    GLenum format = _fallbackFrom ? _fallbackFrom : _desc.internalFormat;
+    auto   b      = blockInfo(format);
+    LGI_REQUIRE(b.compressed(), "texture format 0x%X is not a compressed format.", format);
+    LGI_REQUIRE(0 == x % b.width && 0 == y % b.height, "region origin (%zu, %zu) is not aligned to %ux%u blocks.", x, y, b.width, b.height);
+    LGI_REQUIRE(sizeInBytes == compressedImageSize(format, w, h), "expect %zu bytes of compressed data, got %zu.", compressedImageSize(format, w, h),
+                sizeInBytes);
+
+    if (_fallbackFrom) {
+        // Decode on CPU and upload to the uncompressed fallback texture.
+        std::vector<uint8_t> rgba(w * h * 4);
+        if (!decodeBlocks(format, blocks, w, h, rgba.data())) {
+            LGI_LOGE("no decoder for compressed texture format 0x%X. Texture content is left undefined.", format);
+            return;
+        }
+        if (_desc.is2D())
+            setPixels(level, x, y, w, h, rgba.data(), 0, GL_RGBA, GL_UNSIGNED_BYTE);
+        else
+            setPixels(layer, level, x, y, w, h, rgba.data(), 0, GL_RGBA, GL_UNSIGNED_BYTE);
+        return;
+    }
+
+    StateCache::current().bindTexture(_desc.target, _desc.id);
+    if (_desc.is2D() || _desc.isCube()) {
+        auto target = _desc.isCube() ? (GLenum) (GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer) : _desc.target;
+        LGI_DCHK(glCompressedTexSubImage2D(target, (GLint) level, (GLint) x, (GLint) y, (GLsizei) w, (GLsizei) h, format, (GLsizei) sizeInBytes, blocks));
+    } else {
+        LGI_DCHK(glCompressedTexSubImage3D(_desc.target, (GLint) level, (GLint) x, (GLint) y, (GLint) layer, (GLsizei) w, (GLsizei) h, 1, format,
+                                           (GLsizei) sizeInBytes, blocks));
+    }
+    LGI_CHK(;);
+}
+
+// -----------------------------------------------------------------------------
+//
+std::vector<uint8_t> TextureObject::getBaseLevelPixels(size_t layer) const {
+    TextureReadback readback;
+    auto            h = readback.read(*this, 0, (uint32_t) layer);
+    if (!h || !readback.wait(h)) return {};
+    std::vector<uint8_t> pixels(readback.size(h));
+    if (!readback.get(h, pixels.data(), pixels.size())) return {};
+    return pixels;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleFBO::cleanup() {
+    auto & sc = StateCache::current();
+    for (int i = 0; i < COLOR_BUFFER_COUNT; ++i) {
+        if (_colors[i].texture) {
+            glDeleteTextures(1, &_colors[i].texture);
+            sc.onTextureDeleted(_colors[i].texture);
+            _colors[i].texture = 0;
+        }
+    }
+    if (_depth) glDeleteTextures(1, &_depth), sc.onTextureDeleted(_depth), _depth = 0;
+    for (auto & m : _mips) {
+        if (m.fbo) glDeleteFramebuffers(1, &m.fbo), sc.onFramebufferDeleted(m.fbo), m.fbo = 0;
+    }
+    _mips.clear();
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleFBO::allocate(uint32_t w, uint32_t h, uint32_t levels, const GLenum * colorFormats) {
+    LGI_CHK(;); // make sure there's no preexisting conditions.
+
+    cleanup(); // release existing buffers.
+
+    LGI_ASSERT(w > 0 && h > 0);
+
+    auto & sc = StateCache::current();
+
+    // create mips array
+    while (w > 0 && h > 0 && (0 == levels || _mips.size() < levels)) {
+        _mips.push_back({w, h, 0});
+        LGI_CHK(glGenFramebuffers(1, &_mips.back().fbo));
+        if (w > 0) w >>= 1;
+        if (h > 0) h >>= 1;
+    };
+    levels = (uint32_t) _mips.size();
+
+    const auto minfilter = _mips.size() > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+
+    if (colorFormats) {
+        _colorTextureTarget   = GL_TEXTURE_2D;
+        GLenum drawBuffers[8] = {};
+        for (int i = 0; i < COLOR_BUFFER_COUNT; ++i) {
+            LGI_CHK(glGenTextures(1, &_colors[i].texture));
+            auto cf                   = colorFormats[i];
+            _colors[i].internalFormat = cf;
+            sc.bindTexture(GL_TEXTURE_2D, _colors[i].texture);
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) (levels - 1)));
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter));
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+            LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+            LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, (GLsizei) levels, cf, (GLsizei) _mips[0].width, (GLsizei) _mips[0].height));
+            for (size_t l = 0; l < _mips.size(); ++l) {
+                auto & m = _mips[l];
+                sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo);
+                LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, (GLenum) (GL_COLOR_ATTACHMENT0 + i), GL_TEXTURE_2D, _colors[i].texture, (GLint) l));
+            }
+            drawBuffers[i] = (GLenum) (GL_COLOR_ATTACHMENT0 + i);
+        }
+        for (auto & m : _mips) {
+            sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo);
+            LGI_CHK(glDrawBuffers(COLOR_BUFFER_COUNT, drawBuffers));
+        }
+    } else {
+        GLenum none = GL_NONE;
+        for (auto & m : _mips) {
+            sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo);
+            LGI_CHK(glDrawBuffers(1, &none));
+        }
+    }
+
+    if (HAS_DEPTH) {
+        // depth (use texture instead of renderbuffer, since it is very likely that we'll need
+        // to read depth data in the future.)
+        LGI_CHK(glGenTextures(1, &_depth));
+        sc.bindTexture(GL_TEXTURE_2D, _depth);
+        // For OpenGL ES, depth texture works only when the texture is defined with
+        // glTexImage2D() using GL_DEPTH_COMPONENT as the internal format, as specified
+        // in OES_depth_texture extension.
+        // On OpenGL CORE profile though, glTexStorage2D() works just fine.
+        // LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT, w, h));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) (_mips.size() - 1)));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        for (size_t l = 0; l < _mips.size(); ++l) {
+            auto & m = _mips[l];
+            sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo);
+            // Note: switching to 16-bit (GL_UNSIGNED_SHORT) depth buffer gives about 3ms performance boost.
+            LGI_CHK(glTexImage2D(GL_TEXTURE_2D, (GLsizei) l, GL_DEPTH_COMPONENT, (GLsizei) m.width, (GLsizei) m.height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT,
+                                 nullptr));
+            LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depth, (GLint) l));
+        }
+    }
+
+    // todo: stencil?
+
+    // make sure the FBO is ready to use.
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    LGI_REQUIRE(GL_FRAMEBUFFER_COMPLETE == status);
+    sc.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+static void saveTextureToFile(uint32_t w, uint32_t h, uint32_t channels, GLenum target, GLenum format, GLenum type, const std::string & filepath) {
+    LGI_LOGI("Save texture content to %s", filepath.c_str());
+    std::vector<float> pixels(w * h * channels);
+    LGI_CHK(glGetTexImage(target, 0, format, type, pixels.data()));
+
+    // Flip the image vertically, since OpenGL texture is bottom-up.
+    std::vector<float> flipped(w * h * channels);
+    for (size_t i = 0; i < h; ++i) {
+        const float * s = &pixels[w * channels * (h - i - 1)];
+        float *       d = &flipped[w * channels * i];
+        std::memcpy(d, s, w * channels * sizeof(float));
+    }
+
+    // todo: save to file
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleFBO::saveColorToFile(uint32_t rt, const std::string & filepath) const {
+    bindColorAsTexture(rt, 0);
+    saveTextureToFile(_mips[0].width, _mips[0].height, 4, _colorTextureTarget, GL_RGBA, GL_FLOAT, filepath);
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleFBO::saveDepthToFile(const std::string & filepath) const {
+    bindDepthAsTexture(0);
+    saveTextureToFile(_mips[0].width, _mips[0].height, 1, _colorTextureTarget, GL_DEPTH_COMPONENT, GL_FLOAT, filepath);
+}
+
+// -----------------------------------------------------------------------------
+//
+void CubeFBO::allocate(uint32_t w, uint32_t levels, GLenum internalFormat) {
+    cleanup(); // release existing buffers.
+
+    LGI_ASSERT(w > 0);
+
+    auto & sc = StateCache::current();
+
+    // create mips array
+    while (w > 0 && (0 == levels || _mips.size() < levels)) {
+        _mips.push_back({w, {}});
+        LGI_CHK(glGenFramebuffers(6, _mips.back().fbo));
+        w >>= 1;
+    };
+
+    const auto minfilter = _mips.size() > 1 ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST;
+
+    if (GL_NONE != internalFormat) {
+        LGI_CHK(glGenTextures(1, &_color));
+        sc.bindTexture(GL_TEXTURE_CUBE_MAP, _color);
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint) _mips.size() - 1));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minfilter));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+        LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+        LGI_CHK(glTexStorage2D(GL_TEXTURE_CUBE_MAP, (GLsizei) _mips.size(), internalFormat, (GLsizei) _mips[0].width, (GLsizei) _mips[0].width));
+        for (size_t l = 0; l < _mips.size(); ++l) {
+            const auto & m = _mips[l];
+            for (int i = 0; i < 6; ++i) {
+                sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]);
+                LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, (GLenum) (GL_TEXTURE_CUBE_MAP_POSITIVE_X + i), _color, (GLint) l));
+            }
+        }
+    } else {
+        GLenum none = GL_NONE;
+        for (auto & m : _mips) {
+            for (int i = 0; i < 6; ++i) {
+                sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]);
+                LGI_CHK(glDrawBuffers(1, &none));
+            }
+        }
+    }
+
+    // depth (use texture instead of renderbuffer, since it is very likely that we'll need
+    // to read depth data in the future.)
+    LGI_CHK(glGenTextures(1, &_depth));
+    sc.bindTexture(GL_TEXTURE_CUBE_MAP, _depth);
+    // For OpenGL ES, depth texture works only when the texture is defined with
+    // glTexImage2D() using GL_DEPTH_COMPONENT as the internal format, as specified
+    // in OES_depth_texture extension.
+    // On OpenGL CORE profile though, glTexStorage2D() works just fine.
+    // LGI_CHK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT, w, h));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint) _mips.size() - 1));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, minfilter));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    for (size_t l = 0; l < _mips.size(); ++l) {
+        const auto & m = _mips[l];
+        for (unsigned int i = 0; i < 6; ++i) {
+            sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]);
+            LGI_CHK(glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, (GLsizei) l, GL_DEPTH_COMPONENT, (GLsizei) m.width, (GLsizei) m.width, 0,
+                                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr));
+            LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, _depth, (GLint) l));
+        }
+    }
+
+    // todo: stencil?
+
+    // make sure the FBO is ready to use.
+    for (size_t l = 0; l < _mips.size(); ++l) {
+        const auto & m = _mips[l];
+        for (size_t i = 0; i < 6; ++i) {
+            sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo[i]);
+            auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            LGI_REQUIRE(GL_FRAMEBUFFER_COMPLETE == status);
+        }
+    }
+
+    // done
+    sc.bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+// Mipmap generator
+// -----------------------------------------------------------------------------
+
+namespace lgi {
+
+// Four floats (one RGBA pixel) in a SIMD register.
+#if LGI_MIP_SSE2
+typedef __m128 F4;
+inline F4   f4Load(const float * p) { return _mm_loadu_ps(p); }
+inline void f4Store(float * p, F4 v) { _mm_storeu_ps(p, v); }
+inline F4   f4Splat(float s) { return _mm_set1_ps(s); }
+inline F4   f4Add(F4 a, F4 b) { return _mm_add_ps(a, b); }
+inline F4   f4Mul(F4 a, F4 b) { return _mm_mul_ps(a, b); }
+#elif LGI_MIP_NEON
+typedef float32x4_t F4;
+inline F4   f4Load(const float * p) { return vld1q_f32(p); }
+inline void f4Store(float * p, F4 v) { vst1q_f32(p, v); }
+inline F4   f4Splat(float s) { return vdupq_n_f32(s); }
+inline F4   f4Add(F4 a, F4 b) { return vaddq_f32(a, b); }
+inline F4   f4Mul(F4 a, F4 b) { return vmulq_f32(a, b); }
+#else
+struct F4 {
+    float v[4];
+};
+inline F4   f4Load(const float * p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline void f4Store(float * p, F4 a) { memcpy(p, a.v, sizeof(a.v)); }
+inline F4   f4Splat(float s) { return {{s, s, s, s}}; }
+inline F4   f4Add(F4 a, F4 b) { return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}}; }
+inline F4   f4Mul(F4 a, F4 b) { return {{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}}; }
+#endif
+
+inline float halfToFloat(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp  = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t bits;
+    if (0 == exp) {
+        if (0 == mant) {
+            bits = sign;
+        } else { // denormal
+            exp = 127 - 15 + 1;
+            while (0 == (mant & 0x400)) {
+                mant <<= 1;
+                --exp;
+            }
+            bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+        }
+    } else if (31 == exp) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+inline uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    auto     sign = (uint16_t) ((bits >> 16) & 0x8000);
+    int32_t  exp  = (int32_t) ((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = bits & 0x7FFFFF;
+    if (((bits >> 23) & 0xFF) == 0xFF) return (uint16_t) (sign | 0x7C00 | (mant ? 0x200 : 0)); // inf/nan
+    if (exp >= 31) return (uint16_t) (sign | 0x7C00);                                          // overflow
+    if (exp <= 0) {                                                                             // denormal or zero
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        auto shift = (uint32_t) (14 - exp);
+        auto half  = mant >> shift;
+        if ((mant >> (shift - 1)) & 1) ++half; // round
+        return (uint16_t) (sign | half);
+    }
+    auto h = (uint32_t) sign | ((uint32_t) exp << 10) | (mant >> 13);
+    if (mant & 0x1000) ++h; // round (may carry into exponent, which is correct)
+    return (uint16_t) h;
+}
+
+struct SrgbTables {
+    float   toLinear[256];
+    uint8_t toSrgb[4096]; // indexed by linear value quantized to 12 bits.
+
+    SrgbTables() {
+        for (int i = 0; i < 256; ++i) {
+            float c     = (float) i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            float l   = (float) i / 4095.0f;
+            float c   = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = (uint8_t) std::min(255.0f, c * 255.0f + 0.5f);
+        }
+    }
+
+    static const SrgbTables & get() {
+        static const SrgbTables t;
+        return t;
+    }
+};
+
+inline float saturate(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+
+// Convert n pixels to/from linear RGBA32F.
+static void decodeRow(MipmapGenerator::Format f, const void * src, float * dst, size_t n) {
+    switch (f) {
+    case MipmapGenerator::Format::RGBA8: {
+        auto s = (const uint8_t *) src;
+        for (size_t i = 0; i < n * 4; ++i) dst[i] = (float) s[i] * (1.0f / 255.0f);
+        break;
+    }
+    case MipmapGenerator::Format::RGBA8_SRGB: {
+        auto   s   = (const uint8_t *) src;
+        auto & lut = SrgbTables::get().toLinear;
+        for (size_t i = 0; i < n * 4; i += 4) {
+            dst[i + 0] = lut[s[i + 0]];
+            dst[i + 1] = lut[s[i + 1]];
+            dst[i + 2] = lut[s[i + 2]];
+            dst[i + 3] = (float) s[i + 3] * (1.0f / 255.0f);
+        }
+        break;
+    }
+    case MipmapGenerator::Format::RGBA16F: {
+        auto s = (const uint16_t *) src;
+        for (size_t i = 0; i < n * 4; ++i) dst[i] = halfToFloat(s[i]);
+        break;
+    }
+    case MipmapGenerator::Format::RGBA32F:
+        memcpy(dst, src, n * 16);
+        break;
+    }
+}
+
+static void encodeRow(MipmapGenerator::Format f, const float * src, void * dst, size_t n) {
+    switch (f) {
+    case MipmapGenerator::Format::RGBA8: {
+        auto d = (uint8_t *) dst;
+        for (size_t i = 0; i < n * 4; ++i) d[i] = (uint8_t) (saturate(src[i]) * 255.0f + 0.5f);
+        break;
+    }
+    case MipmapGenerator::Format::RGBA8_SRGB: {
+        auto   d   = (uint8_t *) dst;
+        auto & lut = SrgbTables::get().toSrgb;
+        for (size_t i = 0; i < n * 4; i += 4) {
+            d[i + 0] = lut[(size_t) (saturate(src[i + 0]) * 4095.0f + 0.5f)];
+            d[i + 1] = lut[(size_t) (saturate(src[i + 1]) * 4095.0f + 0.5f)];
+            d[i + 2] = lut[(size_t) (saturate(src[i + 2]) * 4095.0f + 0.5f)];
+            d[i + 3] = (uint8_t) (saturate(src[i + 3]) * 255.0f + 0.5f);
+        }
+        break;
+    }
+    case MipmapGenerator::Format::RGBA16F: {
+        auto d = (uint16_t *) dst;
+        for (size_t i = 0; i < n * 4; ++i) d[i] = floatToHalf(src[i]);
+        break;
+    }
+    case MipmapGenerator::Format::RGBA32F:
+        memcpy(dst, src, n * 16);
+        break;
+    }
+}
+
+// Run fn(begin, end) over [0, count) on up to 'threads' threads.
+template<typename FN>
+static void parallelRows(uint32_t count, uint32_t threads, size_t workPerRow, FN && fn) {
+    // Not worth spawning threads for small levels.
+    constexpr size_t MIN_WORK_PER_THREAD = 64 * 1024;
+    auto             maxThreads          = (uint32_t) std::max<size_t>(1, (size_t) count * workPerRow / MIN_WORK_PER_THREAD);
+    threads                              = std::min({threads, maxThreads, count});
+    if (threads <= 1) {
+        fn(0u, count);
+        return;
+    }
+    std::vector<std::thread> pool;
+    uint32_t                 chunk = (count + threads - 1) / threads;
+    for (uint32_t b = chunk; b < count; b += chunk) pool.emplace_back([&fn, b, chunk, count] { fn(b, std::min(b + chunk, count)); });
+    fn(0u, std::min(chunk, count));
+    for (auto & t : pool) t.join();
+}
+
+// 2x2 box filter of rows [y0, y1) of the destination level.
+static void boxRows(const float * src, uint32_t sw, uint32_t sh, float * dst, uint32_t dw, uint32_t y0, uint32_t y1) {
+    const F4 quarter = f4Splat(0.25f);
+    for (uint32_t y = y0; y < y1; ++y) {
+        const float * r0 = src + (size_t) std::min(y * 2, sh - 1) * sw * 4;
+        const float * r1 = src + (size_t) std::min(y * 2 + 1, sh - 1) * sw * 4;
+        float *       d  = dst + (size_t) y * dw * 4;
+        uint32_t      x  = 0;
+        if (sw >= 2 * dw) {
+#if LGI_MIP_AVX2
+            // two destination pixels per iteration.
+            const __m256 q8 = _mm256_set1_ps(0.25f);
+            for (; x + 2 <= dw; x += 2) {
+                __m256 a = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8), _mm256_loadu_ps(r1 + x * 8));         // src pixels 2x, 2x+1
+                __m256 b = _mm256_add_ps(_mm256_loadu_ps(r0 + x * 8 + 8), _mm256_loadu_ps(r1 + x * 8 + 8)); // src pixels 2x+2, 2x+3
+                __m256 s = _mm256_add_ps(_mm256_permute2f128_ps(a, b, 0x20), _mm256_permute2f128_ps(a, b, 0x31));
+                _mm256_storeu_ps(d + x * 4, _mm256_mul_ps(s, q8));
+            }
+#endif
+            for (; x < dw; ++x) {
+                const float * a = r0 + x * 8;
+                const float * b = r1 + x * 8;
+                F4            s = f4Add(f4Add(f4Load(a), f4Load(a + 4)), f4Add(f4Load(b), f4Load(b + 4)));
+                f4Store(d + x * 4, f4Mul(s, quarter));
+            }
+        } else {
+            // source width is 1.
+            for (; x < dw; ++x) f4Store(d + x * 4, f4Mul(f4Add(f4Load(r0), f4Load(r1)), f4Splat(0.5f)));
+        }
+    }
+}
+
+// Weights of the 8-tap Kaiser windowed sinc for 2x decimation. Taps are at offsets -3.5 .. 3.5 source pixels from the
+// center of the destination pixel.
+struct KaiserWeights {
+    static constexpr int TAPS = 8;
+    float                w[TAPS];
+
+    KaiserWeights() {
+        const double alpha = 4.0, width = 4.0;
+        auto         bessel0 = [](double x) {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 20; ++k) {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        double total = 0;
+        double tmp[TAPS];
+        for (int i = 0; i < TAPS; ++i) {
+            double x = ((double) i - 3.5) / 2.0; // in destination pixels
+            double s = (0.0 == x) ? 1.0 : std::sin(3.14159265358979 * x) / (3.14159265358979 * x);
+            double r = x / (width / 2.0);
+            double k = std::abs(r) >= 1.0 ? 0.0 : bessel0(alpha * std::sqrt(1.0 - r * r)) / bessel0(alpha);
+            tmp[i]   = s * k;
+            total += tmp[i];
+        }
+        for (int i = 0; i < TAPS; ++i) w[i] = (float) (tmp[i] / total);
+    }
+
+    static const KaiserWeights & get() {
+        static const KaiserWeights k;
+        return k;
+    }
+};
+
+// Horizontal Kaiser pass: src (sw x sh) -> tmp (dw x sh), rows [y0, y1).
+static void kaiserRowsH(const float * src, uint32_t sw, float * tmp, uint32_t dw, uint32_t y0, uint32_t y1) {
+    auto & k = KaiserWeights::get();
+    for (uint32_t y = y0; y < y1; ++y) {
+        const float * s = src + (size_t) y * sw * 4;
+        float *       d = tmp + (size_t) y * dw * 4;
+        for (uint32_t x = 0; x < dw; ++x) {
+            F4 acc = f4Splat(0.0f);
+            for (int i = 0; i < KaiserWeights::TAPS; ++i) {
+                auto sx = std::clamp((int64_t) x * 2 - 3 + i, (int64_t) 0, (int64_t) sw - 1);
+                acc     = f4Add(acc, f4Mul(f4Load(s + sx * 4), f4Splat(k.w[i])));
+            }
+            f4Store(d + x * 4, acc);
+        }
+    }
+}
+
+// Vertical Kaiser pass: tmp (dw x sh) -> dst (dw x dh), rows [y0, y1).
+static void kaiserRowsV(const float * tmp, uint32_t sh, float * dst, uint32_t dw, uint32_t y0, uint32_t y1) {
+    auto & k = KaiserWeights::get();
+    for (uint32_t y = y0; y < y1; ++y) {
+        const float * rows[KaiserWeights::TAPS];
+        for (int i = 0; i < KaiserWeights::TAPS; ++i) {
+            auto sy = std::clamp((int64_t) y * 2 - 3 + i, (int64_t) 0, (int64_t) sh - 1);
+            rows[i] = tmp + (size_t) sy * dw * 4;
+        }
+        float * d = dst + (size_t) y * dw * 4;
+        for (uint32_t x = 0; x < dw; ++x) {
+            F4 acc = f4Splat(0.0f);
+            for (int i = 0; i < KaiserWeights::TAPS; ++i) acc = f4Add(acc, f4Mul(f4Load(rows[i] + x * 4), f4Splat(k.w[i])));
+            f4Store(d + x * 4, acc);
+        }
+    }
+}
+
+} // namespace lgi
+
+// -----------------------------------------------------------------------------
+//
+std::vector<std::vector<uint8_t>> MipmapGenerator::generate(const void * pixels, uint32_t width, uint32_t height, uint32_t levels) const {
+    std::vector<std::vector<uint8_t>> result;
+    if (!pixels || 0 == width || 0 == height) return result;
+
+    uint32_t fullChain = 1;
+    while ((width >> fullChain) > 0 || (height >> fullChain) > 0) ++fullChain;
+    levels = (0 == levels) ? fullChain : std::min(levels, fullChain);
+    if (levels <= 1) return result;
+
+    auto threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    auto ps          = pixelSize(format);
+
+    // decode base level to linear float.
+    std::vector<float> prev((size_t) width * height * 4), next, tmp;
+    lgi::parallelRows(height, threadCount, width, [&](uint32_t y0, uint32_t y1) {
+        for (uint32_t y = y0; y < y1; ++y) lgi::decodeRow(format, (const uint8_t *) pixels + (size_t) y * width * ps, &prev[(size_t) y * width * 4], width);
+    });
+
+    uint32_t sw = width, sh = height;
+    result.resize(levels - 1);
+    for (uint32_t l = 1; l < levels; ++l) {
+        uint32_t dw = std::max(1u, sw >> 1);
+        uint32_t dh = std::max(1u, sh >> 1);
+        next.resize((size_t) dw * dh * 4);
+        auto & out = result[l - 1];
+        out.resize((size_t) dw * dh * ps);
+        if (Filter::KAISER == filter) {
+            tmp.resize((size_t) dw * sh * 4);
+            lgi::parallelRows(sh, threadCount, (size_t) dw * 8, [&](uint32_t y0, uint32_t y1) { lgi::kaiserRowsH(prev.data(), sw, tmp.data(), dw, y0, y1); });
+            lgi::parallelRows(dh, threadCount, (size_t) dw * 8, [&](uint32_t y0, uint32_t y1) {
+                lgi::kaiserRowsV(tmp.data(), sh, next.data(), dw, y0, y1);
+                for (uint32_t y = y0; y < y1; ++y) lgi::encodeRow(format, &next[(size_t) y * dw * 4], &out[(size_t) y * dw * ps], dw);
+            });
+        } else {
+            lgi::parallelRows(dh, threadCount, (size_t) dw * 4, [&](uint32_t y0, uint32_t y1) {
+                lgi::boxRows(prev.data(), sw, sh, next.data(), dw, y0, y1);
+                for (uint32_t y = y0; y < y1; ++y) lgi::encodeRow(format, &next[(size_t) y * dw * 4], &out[(size_t) y * dw * ps], dw);
+            });
+        }
+        prev.swap(next);
+        sw = dw;
+        sh = dh;
+    }
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+//
+void MipmapGenerator::upload(const TextureObject & texture, const void * pixels, size_t layer) const {
+    if (texture.empty() || !pixels) return;
+    const auto & d    = texture.desc();
+    GLenum       type = Format::RGBA32F == format ? GL_FLOAT : (Format::RGBA16F == format ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE);
+    auto         mips = generate(pixels, d.width, d.height, d.mips);
+    auto         set  = [&](size_t level, const void * p) {
+        auto w = std::max(1u, d.width >> level);
+        auto h = std::max(1u, d.height >> level);
+        if (d.is2D())
+            texture.setPixels(level, 0, 0, w, h, p, 0, GL_RGBA, type);
+        else
+            texture.setPixels(layer, level, 0, 0, w, h, p, 0, GL_RGBA, type);
+    };
+    set(0, pixels);
+    for (size_t i = 0; i < mips.size(); ++i) set(i + 1, mips[i].data());
+}
+
+// -----------------------------------------------------------------------------
+//
+TexturePool::TexturePool(): _nextPool(texturePools) { texturePools = this; }
+
+TexturePool::~TexturePool() {
+    cleanup();
+    for (auto p = &texturePools; *p; p = &(*p)->_nextPool) {
+        if (*p == this) {
+            *p = _nextPool;
+            break;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureObject TexturePool::acquire(const TextureObject::TextureDesc & desc) {
+    // Prefer the most recently released texture. It is most likely to be still resident.
+    for (size_t i = _idle.size(); i > 0; --i) {
+        auto & e = _idle[i - 1];
+        if (!e.texture.desc().compatible(desc)) continue;
+        TextureObject t = std::move(e.texture);
+        _stats.idleBytes -= desc.byteSize();
+        _stats.idleTextures -= 1;
+        _stats.reuses += 1;
+        _idle.erase(_idle.begin() + (std::ptrdiff_t) (i - 1));
+        return t;
+    }
+    TextureObject t;
+    t.allocate(desc);
+    _stats.allocations += 1;
+    return t;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::release(TextureObject && t) {
+    if (t.empty()) return;
+    _stats.idleBytes += t.desc().byteSize();
+    _stats.idleTextures += 1;
+    _idle.push_back({std::move(t), _frame});
+}
+
+// -----------------------------------------------------------------------------
+//
+GLuint TexturePool::framebuffer(std::initializer_list<const TextureObject *> colors, const TextureObject * depth, uint32_t level) {
+    LGI_REQUIRE(colors.size() <= std::size(Framebuffer().colors), "too many color attachments: %zu", colors.size());
+    Framebuffer key;
+    key.depth = depth ? depth->id() : 0;
+    key.level = level;
+    size_t n  = 0;
+    for (auto c : colors) key.colors[n++] = c ? c->id() : 0;
+
+    for (auto & f : _fbos) {
+        if (f.depth == key.depth && f.level == key.level && 0 == memcmp(f.colors, key.colors, sizeof(key.colors))) {
+            f.lastUsed = _frame;
+            return f.fbo;
+        }
+    }
+
+    auto & sc = StateCache::current();
+    LGI_CHK(glGenFramebuffers(1, &key.fbo));
+    sc.bindFramebuffer(GL_FRAMEBUFFER, key.fbo);
+    GLenum drawBuffers[8] = {};
+    n                     = 0;
+    for (auto c : colors) {
+        if (c) {
+            LGI_REQUIRE(c->desc().is2D(), "only 2D textures can be attached to pooled frame buffers.");
+            LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, (GLenum) (GL_COLOR_ATTACHMENT0 + n), GL_TEXTURE_2D, c->id(), (GLint) level));
+            drawBuffers[n] = (GLenum) (GL_COLOR_ATTACHMENT0 + n);
+        }
+        ++n;
+    }
+    if (n > 0) {
+        LGI_CHK(glDrawBuffers((GLsizei) n, drawBuffers));
+    } else {
+        GLenum none = GL_NONE;
+        LGI_CHK(glDrawBuffers(1, &none));
+    }
+    if (depth) {
+        LGI_REQUIRE(depth->desc().is2D(), "only 2D textures can be attached to pooled frame buffers.");
+        LGI_CHK(glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth->id(), (GLint) level));
+    }
+    auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    LGI_REQUIRE(GL_FRAMEBUFFER_COMPLETE == status, "pooled frame buffer is incomplete: 0x%X", status);
+    sc.bindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    key.lastUsed = _frame;
+    _fbos.push_back(key);
+    _stats.framebuffers = _fbos.size();
+    return key.fbo;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::update() {
+    ++_frame;
+
+    // age based eviction
+    for (size_t i = _idle.size(); i > 0; --i)
+        if (_frame - _idle[i - 1].lastUsed > maxIdleFrames) evict(i - 1);
+    for (size_t i = _fbos.size(); i > 0; --i)
+        if (_frame - _fbos[i - 1].lastUsed > maxIdleFrames) deleteFramebuffer(i - 1);
+
+    // memory cap. _idle is sorted by release time, so the oldest is at the front.
+    while (_stats.idleBytes > maxIdleBytes && !_idle.empty()) evict(0);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::cleanup() {
+    while (!_idle.empty()) evict(_idle.size() - 1);
+    while (!_fbos.empty()) deleteFramebuffer(_fbos.size() - 1);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::onTextureDeleted(GLuint id) {
+    // FBOs referencing the texture would be left with a dangling attachment, and would be returned for any new texture
+    // that happens to get the same name.
+    for (size_t i = _fbos.size(); i > 0; --i) {
+        const auto & f = _fbos[i - 1];
+        if (f.depth == id || std::end(f.colors) != std::find(std::begin(f.colors), std::end(f.colors), id)) deleteFramebuffer(i - 1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::evict(size_t index) {
+    auto & t = _idle[index].texture;
+    _stats.idleBytes -= t.desc().byteSize();
+    _stats.idleTextures -= 1;
+    _stats.evictions += 1;
+    _idle.erase(_idle.begin() + (std::ptrdiff_t) index);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TexturePool::deleteFramebuffer(size_t index) {
+    auto fbo = _fbos[index].fbo;
+    glDeleteFramebuffers(1, &fbo);
+    StateCache::current().onFramebufferDeleted(fbo);
+    _fbos.erase(_fbos.begin() + (std::ptrdiff_t) index);
+    _stats.framebuffers = _fbos.size();
+}
+
+// -----------------------------------------------------------------------------
+//
+bool MappedFile::open(const std::string & path) {
+    close();
+#ifdef _WIN32
+    auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (INVALID_HANDLE_VALUE == file) {
+        LGI_LOGE("failed to open file %s", path.c_str());
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || 0 == size.QuadPart) {
+        CloseHandle(file);
+        LGI_LOGE("failed to get size of file %s, or the file is empty.", path.c_str());
+        return false;
+    }
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto view    = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        LGI_LOGE("failed to map file %s", path.c_str());
+        return false;
+    }
+    _file    = file;
+    _mapping = mapping;
+    _data    = (const uint8_t *) view;
+    _size    = (size_t) size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LGI_LOGE("failed to open file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || 0 == st.st_size) {
+        ::close(fd);
+        LGI_LOGE("failed to get size of file %s, or the file is empty.", path.c_str());
+        return false;
+    }
+    auto view = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping holds its own reference to the file.
+    if (MAP_FAILED == view) {
+        LGI_LOGE("failed to map file %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    // Pages are read front to back during upload.
+    madvise(view, (size_t) st.st_size, MADV_SEQUENTIAL);
+    _data = (const uint8_t *) view;
+    _size = (size_t) st.st_size;
+#endif
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void MappedFile::close() {
+    if (!_data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(_mapping);
+    CloseHandle(_file);
+    _file    = nullptr;
+    _mapping = nullptr;
+#else
+    munmap((void *) _data, _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
+
+namespace lgi {
+
+struct ImageFormat {
+    GLenum   internalFormat = GL_NONE;
+    GLenum   format         = GL_NONE; // pixel format and type. GL_NONE for compressed formats.
+    GLenum   type           = GL_NONE;
+    uint32_t pixelBytes     = 0; // 0 for compressed formats.
+};
+
+// Texture file content. Image pointers point into the file data.
+struct ParsedTexture {
+    struct Image {
+        uint32_t        layer, face, level;
+        const uint8_t * data;
+    };
+
+    ImageFormat        format;
+    uint32_t           width = 0, height = 0, layers = 1, faces = 1, mips = 1;
+    std::vector<Image> images;
+
+    // Upper bounds of header fields. Anything above is treated as a corrupted file, which also keeps the image size
+    // math below far away from overflow.
+    static constexpr uint32_t MAX_DIMENSION = 32768;
+    static constexpr uint32_t MAX_LAYERS    = 2048;
+
+    size_t imageSize(uint32_t level) const {
+        auto w = std::max(1u, width >> level);
+        auto h = std::max(1u, height >> level);
+        return format.pixelBytes ? (size_t) w * h * format.pixelBytes : TextureObject::compressedImageSize(format.internalFormat, w, h);
+    }
+
+    // Validate header fields, before any image size is computed from them.
+    bool validate(const char * tag) const {
+        if (0 == width || 0 == height || width > MAX_DIMENSION || height > MAX_DIMENSION) {
+            LGI_LOGE("%s: invalid image size %ux%u.", tag, width, height);
+            return false;
+        }
+        if (faces != 1 && faces != 6) {
+            LGI_LOGE("%s: invalid number of faces: %u", tag, faces);
+            return false;
+        }
+        if (6 == faces && width != height) {
+            LGI_LOGE("%s: cube faces must be square, got %ux%u.", tag, width, height);
+            return false;
+        }
+        if (0 == layers || layers > MAX_LAYERS) {
+            LGI_LOGE("%s: invalid number of layers: %u", tag, layers);
+            return false;
+        }
+        uint32_t maxMips = 1;
+        while ((std::max(width, height) >> maxMips) > 0) ++maxMips;
+        if (0 == mips || mips > maxMips) {
+            LGI_LOGE("%s: invalid number of mip levels: %u (%ux%u has at most %u)", tag, mips, width, height, maxMips);
+            return false;
+        }
+        return true;
+    }
+};
+
+template<typename T>
+static T readAs(const uint8_t * p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+static ImageFormat vkFormatToGL(uint32_t vk) {
+    switch (vk) {
+    case 9: return {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1};                                  // VK_FORMAT_R8_UNORM
+    case 16: return {GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2};                                 // VK_FORMAT_R8G8_UNORM
+    case 37: return {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};                             // VK_FORMAT_R8G8B8A8_UNORM
+    case 43: return {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};                      // VK_FORMAT_R8G8B8A8_SRGB
+    case 44: return {GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 4};                             // VK_FORMAT_B8G8R8A8_UNORM
+    case 50: return {GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE, 4};                      // VK_FORMAT_B8G8R8A8_SRGB
+    case 76: return {GL_R16F, GL_RED, GL_HALF_FLOAT, 2};                                  // VK_FORMAT_R16_SFLOAT
+    case 83: return {GL_RG16F, GL_RG, GL_HALF_FLOAT, 4};                                  // VK_FORMAT_R16G16_SFLOAT
+    case 97: return {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8};                              // VK_FORMAT_R16G16B16A16_SFLOAT
+    case 100: return {GL_R32F, GL_RED, GL_FLOAT, 4};                                      // VK_FORMAT_R32_SFLOAT
+    case 103: return {GL_RG32F, GL_RG, GL_FLOAT, 8};                                      // VK_FORMAT_R32G32_SFLOAT
+    case 109: return {GL_RGBA32F, GL_RGBA, GL_FLOAT, 16};                                 // VK_FORMAT_R32G32B32A32_SFLOAT
+    case 122: return {GL_R11F_G11F_B10F, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4};     // VK_FORMAT_B10G11R11_UFLOAT_PACK32
+    case 123: return {GL_RGB9_E5, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, 4};                // VK_FORMAT_E5B9G9R9_UFLOAT_PACK32
+    default: break;
+    }
+    // VK_FORMAT_BC1_RGB_UNORM_BLOCK (131) .. VK_FORMAT_EAC_R11G11_SNORM_BLOCK (156)
+    static const GLenum BC_ETC[] = {0x83F0, 0x8C4C, 0x83F1, 0x8C4D, 0x83F2, 0x8C4E, 0x83F3, 0x8C4F, 0x8DBB, 0x8DBC, 0x8DBD, 0x8DBE, 0x8E8F,
+                                    0x8E8E, 0x8E8C, 0x8E8D, 0x9274, 0x9275, 0x9276, 0x9277, 0x9278, 0x9279, 0x9270, 0x9271, 0x9272, 0x9273};
+    if (vk >= 131 && vk <= 156) return {BC_ETC[vk - 131], GL_NONE, GL_NONE, 0};
+    // VK_FORMAT_ASTC_4x4_UNORM_BLOCK (157) .. VK_FORMAT_ASTC_12x12_SRGB_BLOCK (184), alternating UNORM and SRGB.
+    if (vk >= 157 && vk <= 184) return {(GLenum) (((vk - 157) & 1 ? 0x93D0 : 0x93B0) + (vk - 157) / 2), GL_NONE, GL_NONE, 0};
+    return {};
+}
+
+static ImageFormat dxgiFormatToGL(uint32_t dxgi) {
+    switch (dxgi) {
+    case 2: return {GL_RGBA32F, GL_RGBA, GL_FLOAT, 16};                             // DXGI_FORMAT_R32G32B32A32_FLOAT
+    case 10: return {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8};                        // DXGI_FORMAT_R16G16B16A16_FLOAT
+    case 26: return {GL_R11F_G11F_B10F, GL_RGB, GL_UNSIGNED_INT_10F_11F_11F_REV, 4}; // DXGI_FORMAT_R11G11B10_FLOAT
+    case 28: return {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};                       // DXGI_FORMAT_R8G8B8A8_UNORM
+    case 29: return {GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};                // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+    case 34: return {GL_RG16F, GL_RG, GL_HALF_FLOAT, 4};                            // DXGI_FORMAT_R16G16_FLOAT
+    case 41: return {GL_R32F, GL_RED, GL_FLOAT, 4};                                 // DXGI_FORMAT_R32_FLOAT
+    case 49: return {GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2};                           // DXGI_FORMAT_R8G8_UNORM
+    case 54: return {GL_R16F, GL_RED, GL_HALF_FLOAT, 2};                            // DXGI_FORMAT_R16_FLOAT
+    case 61: return {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1};                           // DXGI_FORMAT_R8_UNORM
+    case 71: return {0x83F1, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC1_UNORM
+    case 72: return {0x8C4D, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC1_UNORM_SRGB
+    case 74: return {0x83F2, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC2_UNORM
+    case 75: return {0x8C4E, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC2_UNORM_SRGB
+    case 77: return {0x83F3, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC3_UNORM
+    case 78: return {0x8C4F, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC3_UNORM_SRGB
+    case 80: return {0x8DBB, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC4_UNORM
+    case 81: return {0x8DBC, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC4_SNORM
+    case 83: return {0x8DBD, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC5_UNORM
+    case 84: return {0x8DBE, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC5_SNORM
+    case 87: return {GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 4};                       // DXGI_FORMAT_B8G8R8A8_UNORM
+    case 91: return {GL_SRGB8_ALPHA8, GL_BGRA, GL_UNSIGNED_BYTE, 4};                // DXGI_FORMAT_B8G8R8A8_UNORM_SRGB
+    case 95: return {0x8E8F, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC6H_UF16
+    case 96: return {0x8E8E, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC6H_SF16
+    case 98: return {0x8E8C, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC7_UNORM
+    case 99: return {0x8E8D, GL_NONE, GL_NONE, 0};                                  // DXGI_FORMAT_BC7_UNORM_SRGB
+    default: return {};
+    }
+}
+
+static constexpr uint32_t fourCC(char a, char b, char c, char d) { return (uint32_t) a | ((uint32_t) b << 8) | ((uint32_t) c << 16) | ((uint32_t) d << 24); }
+
+// Format of legacy DDS files, described by the DDS_PIXELFORMAT structure.
+static ImageFormat ddsLegacyFormat(const uint8_t * pf) {
+    auto flags = readAs<uint32_t>(pf + 4);
+    auto cc    = readAs<uint32_t>(pf + 8);
+    auto bits  = readAs<uint32_t>(pf + 12);
+    auto rmask = readAs<uint32_t>(pf + 16);
+    if (flags & 0x4) { // DDPF_FOURCC
+        switch (cc) {
+        case fourCC('D', 'X', 'T', '1'): return {0x83F1, GL_NONE, GL_NONE, 0};
+        case fourCC('D', 'X', 'T', '3'): return {0x83F2, GL_NONE, GL_NONE, 0};
+        case fourCC('D', 'X', 'T', '5'): return {0x83F3, GL_NONE, GL_NONE, 0};
+        case fourCC('A', 'T', 'I', '1'):
+        case fourCC('B', 'C', '4', 'U'): return {0x8DBB, GL_NONE, GL_NONE, 0};
+        case fourCC('A', 'T', 'I', '2'):
+        case fourCC('B', 'C', '5', 'U'): return {0x8DBD, GL_NONE, GL_NONE, 0};
+        case 111: return {GL_R16F, GL_RED, GL_HALF_FLOAT, 2};     // D3DFMT_R16F
+        case 113: return {GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8}; // D3DFMT_A16B16G16R16F
+        case 114: return {GL_R32F, GL_RED, GL_FLOAT, 4};          // D3DFMT_R32F
+        case 116: return {GL_RGBA32F, GL_RGBA, GL_FLOAT, 16};     // D3DFMT_A32B32G32R32F
+        default: return {};
+        }
+    }
+    if ((flags & 0x40) && 32 == bits) { // DDPF_RGB
+        if (0x000000FF == rmask) return {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4};
+        if (0x00FF0000 == rmask) return {GL_RGBA8, GL_BGRA, GL_UNSIGNED_BYTE, 4};
+    }
+    if ((flags & 0x20000) && 8 == bits) return {GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1}; // DDPF_LUMINANCE
+    return {};
+}
+
+static bool parseKTX2(const uint8_t * data, size_t size, ParsedTexture & t) {
+    // Header (80 bytes) and level index (24 bytes per level) follow the 12 byte identifier.
+    if (size < 80) return false;
+    auto vkFormat = readAs<uint32_t>(data + 12);
+    t.width       = readAs<uint32_t>(data + 20);
+    t.height      = std::max(1u, readAs<uint32_t>(data + 24));
+    auto depth    = readAs<uint32_t>(data + 28);
+    t.layers      = std::max(1u, readAs<uint32_t>(data + 32));
+    t.faces       = readAs<uint32_t>(data + 36);
+    t.mips        = std::max(1u, readAs<uint32_t>(data + 40));
+    auto scheme   = readAs<uint32_t>(data + 44);
+    if (depth > 1) {
+        LGI_LOGE("KTX2: 3D textures are not supported.");
+        return false;
+    }
+    if (scheme != 0) {
+        LGI_LOGE("KTX2: supercompression scheme %u is not supported.", scheme);
+        return false;
+    }
+    t.format = vkFormatToGL(vkFormat);
+    if (!t.format.internalFormat) {
+        LGI_LOGE("KTX2: unsupported vkFormat %u.", vkFormat);
+        return false;
+    }
+    if (!t.validate("KTX2")) return false;
+    if (size < 80 + (size_t) t.mips * 24) return false;
+    for (uint32_t level = 0; level < t.mips; ++level) {
+        auto offset    = readAs<uint64_t>(data + 80 + level * 24);
+        auto length    = readAs<uint64_t>(data + 80 + level * 24 + 8);
+        auto imageSize = t.imageSize(level);
+        if (offset > size || length > size - offset || length < (uint64_t) imageSize * t.layers * t.faces) return false;
+        // Images of one level are ordered by layer, then face.
+        auto p = data + offset;
+        for (uint32_t layer = 0; layer < t.layers; ++layer)
+            for (uint32_t face = 0; face < t.faces; ++face, p += imageSize) t.images.push_back({layer, face, level, p});
+    }
+    return true;
+}
+
+static bool parseDDS(const uint8_t * data, size_t size, ParsedTexture & t) {
+    // 4 byte magic, then 124 byte DDS_HEADER, then optional 20 byte DDS_HEADER_DXT10.
+    if (size < 128) return false;
+    const uint8_t * h = data + 4;
+    t.height          = readAs<uint32_t>(h + 8);
+    t.width           = readAs<uint32_t>(h + 12);
+    auto depth        = readAs<uint32_t>(h + 20);
+    t.mips            = std::max(1u, readAs<uint32_t>(h + 24));
+    auto caps2        = readAs<uint32_t>(h + 108);
+    auto pf           = h + 72;
+    t.faces           = (caps2 & 0x200) ? 6 : 1; // DDSCAPS2_CUBEMAP
+    size_t offset     = 128;
+    if ((readAs<uint32_t>(pf + 4) & 0x4) && readAs<uint32_t>(pf + 8) == fourCC('D', 'X', '1', '0')) {
+        if (size < 148) return false;
+        t.format  = dxgiFormatToGL(readAs<uint32_t>(data + 128));
+        auto misc = readAs<uint32_t>(data + 136);
+        t.layers  = std::max(1u, readAs<uint32_t>(data + 140));
+        if (misc & 0x4) t.faces = 6; // D3D11_RESOURCE_MISC_TEXTURECUBE
+        offset = 148;
+    } else {
+        t.format = ddsLegacyFormat(pf);
+    }
+    if ((caps2 & 0x200000) && depth > 1) { // DDSCAPS2_VOLUME
+        LGI_LOGE("DDS: volume textures are not supported.");
+        return false;
+    }
+    if (!t.format.internalFormat) {
+        LGI_LOGE("DDS: unsupported pixel format.");
+        return false;
+    }
+    if (!t.validate("DDS")) return false;
+    // Images are ordered by layer, then face, then level.
+    auto p = data + offset;
+    for (uint32_t layer = 0; layer < t.layers; ++layer)
+        for (uint32_t face = 0; face < t.faces; ++face)
+            for (uint32_t level = 0; level < t.mips; ++level) {
+                auto imageSize = t.imageSize(level);
+                if (imageSize > (size_t) (data + size - p)) return false;
+                t.images.push_back({layer, face, level, p});
+                p += imageSize;
+            }
+    return true;
+}
+
+} // namespace lgi
+
+// -----------------------------------------------------------------------------
+//
+bool loadTexture(const std::string & path, TextureObject & texture) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    if (!loadTextureFromMemory(file.data(), file.size(), texture)) {
+        LGI_LOGE("failed to load texture from %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+bool loadTextureFromMemory(const void * data, size_t size, TextureObject & texture) {
+    static const uint8_t KTX2_ID[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    auto               bytes = (const uint8_t *) data;
+    lgi::ParsedTexture t;
+    bool               ok = false;
+    if (size >= 12 && 0 == memcmp(bytes, KTX2_ID, 12)) {
+        ok = lgi::parseKTX2(bytes, size, t);
+    } else if (size >= 4 && 0 == memcmp(bytes, "DDS ", 4)) {
+        ok = lgi::parseDDS(bytes, size, t);
+    } else {
+        LGI_LOGE("unrecognized texture file format.");
+        return false;
+    }
+    if (!ok) {
+        LGI_LOGE("texture file is truncated or corrupted.");
+        return false;
+    }
+    if (6 == t.faces && t.layers > 1) {
+        LGI_LOGE("cube array textures are not supported.");
+        return false;
+    }
+
+    if (6 == t.faces)
+        texture.allocateCube(t.format.internalFormat, t.width, t.mips);
+    else if (t.layers > 1)
+        texture.allocate2DArray(t.format.internalFormat, t.width, t.height, t.layers, t.mips);
+    else
+        texture.allocate2D(t.format.internalFormat, t.width, t.height, t.mips);
+
+    for (const auto & image : t.images) {
+        auto w = std::max(1u, t.width >> image.level);
+        auto h = std::max(1u, t.height >> image.level);
+        auto z = image.layer * t.faces + image.face; // layer, or face of cube texture.
+        if (!t.format.pixelBytes)
+            texture.setCompressedPixels(z, image.level, 0, 0, w, h, image.data, t.imageSize(image.level));
+        else if (texture.desc().is2D())
+            texture.setPixels(image.level, 0, 0, w, h, image.data, 0, t.format.format, t.format.type);
+        else
+            texture.setPixels(z, image.level, 0, 0, w, h, image.data, 0, t.format.format, t.format.type);
+    }
+    return true;
+}
+
+namespace lgi {
+
+// Size of one uncompressed pixel of the given client format and type.
+static size_t pixelBytes(GLenum format, GLenum type) {
+    size_t channels;
+    switch (format) {
+    case GL_RED:
+    case GL_RED_INTEGER:
+    case GL_DEPTH_COMPONENT: channels = 1; break;
+    case GL_RG:
+    case GL_RG_INTEGER: channels = 2; break;
+    case GL_RGB:
+    case GL_BGR:
+    case GL_RGB_INTEGER: channels = 3; break;
+    default: channels = 4; break;
+    }
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+    case GL_BYTE: return channels;
+    case GL_UNSIGNED_SHORT:
+    case GL_SHORT:
+    case GL_HALF_FLOAT: return channels * 2;
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+    case GL_UNSIGNED_INT_10F_11F_11F_REV:
+    case GL_UNSIGNED_INT_5_9_9_9_REV:
+    case GL_UNSIGNED_INT_24_8: return 4;
+    case GL_FLOAT_32_UNSIGNED_INT_24_8_REV: return 8;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1: return 2;
+    default: return channels * 4;
+    }
+}
+
+} // namespace lgi
+
+// -----------------------------------------------------------------------------
+//
+void TextureAtlas::allocate(GLenum internalFormat, uint32_t size, uint32_t layers, uint32_t maxLayers, uint32_t padding, uint32_t mips) {
+    cleanup();
+    LGI_REQUIRE(size > 0 && layers > 0, "invalid atlas size.");
+    _internalFormat = internalFormat;
+    _size           = size;
+    _maxLayers      = std::max(layers, maxLayers);
+    _padding        = padding;
+    _mips           = std::max(1u, mips);
+    _texture.allocate2DArray(internalFormat, size, size, layers, _mips);
+    _texture.bind(0);
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, _mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    _texture.unbind();
+    _layers.resize(layers);
+    for (auto & l : _layers) l.free = {{0, 0, size, size}};
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureAtlas::cleanup() {
+    _texture.cleanup();
+    _layers.clear();
+    _regions.clear();
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureAtlas::Region TextureAtlas::insert(uint32_t w, uint32_t h, const void * pixels, GLenum format, GLenum type) {
+    if (_texture.empty() || 0 == w || 0 == h || !pixels) return {};
+    auto align = 1u << (_mips - 1);
+    auto pw    = (w + 2 * _padding + align - 1) / align * align;
+    auto ph    = (h + 2 * _padding + align - 1) / align * align;
+    if (pw > _size || ph > _size) {
+        LGI_LOGE("image of %ux%u doesn't fit in atlas of %ux%u.", w, h, _size, _size);
+        return {};
+    }
+    uint32_t layer = 0;
+    Rect     r;
+    if (!place(pw, ph, layer, r)) {
+        if (_layers.size() >= _maxLayers) {
+            LGI_LOGE("texture atlas is full.");
+            return {};
+        }
+        grow();
+        if (!place(pw, ph, layer, r)) return {};
+    }
+
+    Region g;
+    g.id    = ++_lastId;
+    g.layer = layer;
+    g.x     = r.x + _padding;
+    g.y     = r.y + _padding;
+    g.w     = w;
+    g.h     = h;
+    g.u0    = (float) g.x / (float) _size;
+    g.u1    = (float) (g.x + w) / (float) _size;
+    g.v0    = (float) g.y / (float) _size;
+    g.v1    = (float) (g.y + h) / (float) _size;
+
+    // Build the padded image, replicating edge pixels into the padding and alignment slack.
+    auto                 ps = lgi::pixelBytes(format, type);
+    std::vector<uint8_t> padded((size_t) pw * ph * ps);
+    auto                 src = (const uint8_t *) pixels;
+    for (uint32_t y = 0; y < ph; ++y) {
+        auto sy = (uint32_t) std::clamp((int64_t) y - _padding, (int64_t) 0, (int64_t) h - 1);
+        for (uint32_t x = 0; x < pw; ++x) {
+            auto sx = (uint32_t) std::clamp((int64_t) x - _padding, (int64_t) 0, (int64_t) w - 1);
+            memcpy(&padded[((size_t) y * pw + x) * ps], src + ((size_t) sy * w + sx) * ps, ps);
+        }
+    }
+    _texture.setPixels(layer, 0, r.x, r.y, pw, ph, padded.data(), 0, format, type);
+
+    if (_mips > 1) {
+        MipmapGenerator gen;
+        bool            supported = GL_RGBA == format;
+        if (GL_UNSIGNED_BYTE == type)
+            gen.format = GL_SRGB8_ALPHA8 == _internalFormat ? MipmapGenerator::Format::RGBA8_SRGB : MipmapGenerator::Format::RGBA8;
+        else if (GL_HALF_FLOAT == type)
+            gen.format = MipmapGenerator::Format::RGBA16F;
+        else if (GL_FLOAT == type)
+            gen.format = MipmapGenerator::Format::RGBA32F;
+        else
+            supported = false;
+        if (supported) {
+            auto mips = gen.generate(padded.data(), pw, ph, _mips);
+            for (uint32_t i = 0; i < mips.size(); ++i) {
+                auto l = i + 1;
+                _texture.setPixels(layer, l, r.x >> l, r.y >> l, pw >> l, ph >> l, mips[i].data(), 0, format, type);
+            }
+        } else {
+            LGI_LOGW("can't generate atlas mips for pixel format 0x%X and type 0x%X. Lower mips are left undefined.", format, type);
+        }
+    }
+
+    _layers[layer].used += 1;
+    _regions[g.id] = {g, r};
+    return g;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureAtlas::remove(uint32_t id) {
+    auto it = _regions.find(id);
+    if (it == _regions.end()) return;
+    auto & layer = _layers[it->second.region.layer];
+    if (0 == --layer.used) {
+        layer.free = {{0, 0, _size, _size}};
+    } else {
+        layer.free.push_back(it->second.padded);
+        // Merge free rects sharing a full edge, so freed neighbors can host larger images again.
+        for (bool merged = true; merged;) {
+            merged = false;
+            for (size_t i = 0; i < layer.free.size() && !merged; ++i) {
+                for (size_t j = i + 1; j < layer.free.size() && !merged; ++j) {
+                    auto & a = layer.free[i];
+                    auto & b = layer.free[j];
+                    if (a.x == b.x && a.w == b.w && (a.y + a.h == b.y || b.y + b.h == a.y)) {
+                        a.y = std::min(a.y, b.y);
+                        a.h += b.h;
+                        merged = true;
+                    } else if (a.y == b.y && a.h == b.h && (a.x + a.w == b.x || b.x + b.w == a.x)) {
+                        a.x = std::min(a.x, b.x);
+                        a.w += b.w;
+                        merged = true;
+                    }
+                    if (merged) layer.free.erase(layer.free.begin() + (std::ptrdiff_t) j);
+                }
+            }
+        }
+        prune(layer);
+    }
+    _regions.erase(it);
+}
+
+// -----------------------------------------------------------------------------
+//
+const TextureAtlas::Region * TextureAtlas::find(uint32_t id) const {
+    auto it = _regions.find(id);
+    return it == _regions.end() ? nullptr : &it->second.region;
+}
+
+// -----------------------------------------------------------------------------
+// Find the best free rect in the first layer that has room, and mark it used.
+bool TextureAtlas::place(uint32_t w, uint32_t h, uint32_t & layer, Rect & rect) {
+    for (uint32_t i = 0; i < _layers.size(); ++i) {
+        auto &       l    = _layers[i];
+        const Rect * best = nullptr;
+        uint32_t     bestShort = ~0u, bestLong = ~0u;
+        for (const auto & f : l.free) {
+            if (f.w < w || f.h < h) continue;
+            auto dw = f.w - w, dh = f.h - h;
+            auto s = std::min(dw, dh), g = std::max(dw, dh);
+            if (s < bestShort || (s == bestShort && g < bestLong)) {
+                best      = &f;
+                bestShort = s;
+                bestLong  = g;
+            }
+        }
+        if (!best) continue;
+        layer = i;
+        rect  = {best->x, best->y, w, h};
+        split(l, rect);
+        return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+// Replace every free rect overlapping the used one by up to 4 maximal rects around it.
+void TextureAtlas::split(Layer & l, const Rect & u) {
+    std::vector<Rect> out;
+    out.reserve(l.free.size() + 4);
+    for (const auto & f : l.free) {
+        if (u.x >= f.x + f.w || u.x + u.w <= f.x || u.y >= f.y + f.h || u.y + u.h <= f.y) {
+            out.push_back(f);
+            continue;
+        }
+        if (u.x > f.x) out.push_back({f.x, f.y, u.x - f.x, f.h});
+        if (u.x + u.w < f.x + f.w) out.push_back({u.x + u.w, f.y, f.x + f.w - u.x - u.w, f.h});
+        if (u.y > f.y) out.push_back({f.x, f.y, f.w, u.y - f.y});
+        if (u.y + u.h < f.y + f.h) out.push_back({f.x, u.y + u.h, f.w, f.y + f.h - u.y - u.h});
+    }
+    l.free.swap(out);
+    prune(l);
+}
+
+// -----------------------------------------------------------------------------
+// Remove free rects contained in other free rects.
+void TextureAtlas::prune(Layer & l) {
+    auto contains = [](const Rect & a, const Rect & b) { return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h; };
+    for (size_t i = 0; i < l.free.size(); ++i) {
+        for (size_t j = i + 1; j < l.free.size();) {
+            if (contains(l.free[i], l.free[j])) {
+                l.free.erase(l.free.begin() + (std::ptrdiff_t) j);
+            } else if (contains(l.free[j], l.free[i])) {
+                l.free.erase(l.free.begin() + (std::ptrdiff_t) i);
+                j = i + 1;
+            } else {
+                ++j;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Reallocate the array with more layers, and copy existing layers over with frame buffer blits.
+void TextureAtlas::grow() {
+    auto oldLayers = (uint32_t) _layers.size();
+    auto newLayers = std::min(_maxLayers, oldLayers * 2);
+
+    TextureObject bigger;
+    bigger.allocate2DArray(_internalFormat, _size, _size, newLayers, _mips);
+    bigger.bind(0);
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, _mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    bigger.unbind();
+
+    auto & sc = StateCache::current();
+    GLuint fbo[2];
+    LGI_CHK(glGenFramebuffers(2, fbo));
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, fbo[0]);
+    sc.bindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo[1]);
+    for (uint32_t layer = 0; layer < oldLayers; ++layer) {
+        for (uint32_t level = 0; level < _mips; ++level) {
+            auto s = (GLint) std::max(1u, _size >> level);
+            LGI_CHK(glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, _texture.id(), (GLint) level, (GLint) layer));
+            LGI_CHK(glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bigger.id(), (GLint) level, (GLint) layer));
+            LGI_CHK(glBlitFramebuffer(0, 0, s, s, 0, 0, s, s, GL_COLOR_BUFFER_BIT, GL_NEAREST));
+        }
+    }
+    sc.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(2, fbo);
+    sc.onFramebufferDeleted(fbo[0]);
+    sc.onFramebufferDeleted(fbo[1]);
+
+    _texture = std::move(bigger);
+    _layers.resize(newLayers);
+    for (uint32_t i = oldLayers; i < newLayers; ++i) _layers[i].free = {{0, 0, _size, _size}};
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureReadback::cleanup() {
+    auto & sc = StateCache::current();
+    for (auto & s : _pool) {
+        if (s.buffer) {
+            glDeleteBuffers(1, &s.buffer);
+            sc.onBufferDeleted(s.buffer);
+        }
+    }
+    _pool.clear();
+    if (_fbo) {
+        glDeleteFramebuffers(1, &_fbo);
+        sc.onFramebufferDeleted(_fbo);
+        _fbo = 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Attach the texture to an internal frame buffer and read it with glReadPixels(). Unlike glGetTexImage(), this can
+// select a single layer or face, and works on GLES too.
+TextureReadback::Handle TextureReadback::read(const TextureObject & texture, uint32_t level, uint32_t layer, Callback callback) {
+    if (texture.empty()) return {};
+    const auto & d = texture.desc();
+    if (level >= d.mips || (!d.is2D() && layer >= d.depth)) {
+        LGI_LOGE("texture readback out of range: level %u, layer %u.", level, layer);
+        return {};
+    }
+    auto pf = TextureObject::pixelFormat(d.internalFormat);
+    if (!pf.bytes) {
+        LGI_LOGE("texture readback doesn't support format 0x%X.", d.internalFormat);
+        return {};
+    }
+
+    GLenum attachment = GL_COLOR_ATTACHMENT0;
+    if (GL_DEPTH_STENCIL == pf.format)
+        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+    else if (GL_DEPTH_COMPONENT == pf.format)
+        attachment = GL_DEPTH_ATTACHMENT;
+
+    auto & sc = StateCache::current();
+    if (!_fbo) { LGI_CHK(glGenFramebuffers(1, &_fbo)); }
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    if (d.is2D()) {
+        LGI_CHK(glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_2D, d.id, (GLint) level));
+    } else if (d.isCube()) {
+        LGI_CHK(glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer, d.id, (GLint) level));
+    } else {
+        LGI_CHK(glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, attachment, d.id, (GLint) level, (GLint) layer));
+    }
+    if (GL_COLOR_ATTACHMENT0 == attachment) { LGI_CHK(glReadBuffer(GL_COLOR_ATTACHMENT0)); }
+
+    auto h = pack(0, 0, std::max(1u, d.width >> level), std::max(1u, d.height >> level), pf.format, pf.type, std::move(callback));
+
+    // Detach, so the frame buffer doesn't keep a reference to the texture.
+    LGI_CHK(glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_2D, 0, 0));
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return h;
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureReadback::Handle TextureReadback::read(GLuint fbo, GLenum attachment, int32_t x, int32_t y, uint32_t w, uint32_t h, GLenum format, GLenum type,
+                                              Callback callback) {
+    auto & sc = StateCache::current();
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    if (GL_DEPTH_ATTACHMENT != attachment && GL_DEPTH_STENCIL_ATTACHMENT != attachment && GL_STENCIL_ATTACHMENT != attachment) {
+        LGI_CHK(glReadBuffer(attachment));
+    }
+    auto result = pack(x, y, w, h, format, type, std::move(callback));
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return result;
+}
+
+// -----------------------------------------------------------------------------
+// Read pixels of the current read frame buffer into a pooled pack buffer.
+TextureReadback::Handle TextureReadback::pack(int32_t x, int32_t y, uint32_t w, uint32_t h, GLenum format, GLenum type, Callback callback) {
+    auto size = (size_t) w * h * lgi::pixelBytes(format, type);
+    if (0 == size) return {};
+
+    // Pick the smallest idle pack buffer that is large enough. Otherwise, grow an idle one or create a new one.
+    Staging * fit  = nullptr;
+    Staging * grow = nullptr;
+    for (auto & i : _pool) {
+        if (i.busy) continue;
+        if (i.capacity >= size) {
+            if (!fit || i.capacity < fit->capacity) fit = &i;
+        } else if (!grow || i.capacity > grow->capacity) {
+            grow = &i;
+        }
+    }
+    Staging * s = fit ? fit : grow ? grow : &_pool.emplace_back();
+
+    auto & sc = StateCache::current();
+    if (!s->buffer) { LGI_CHK(glGenBuffers(1, &s->buffer)); }
+    sc.bindBuffer(GL_PIXEL_PACK_BUFFER, s->buffer);
+    if (s->capacity < size) {
+        LGI_CHK(glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_READ));
+        s->capacity = size;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    LGI_CHK(glReadPixels(x, y, (GLsizei) w, (GLsizei) h, format, type, nullptr));
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    s->fence.insert();
+    sc.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    s->image    = {nullptr, size, w, h, format, type};
+    s->busy     = true;
+    s->callback = std::move(callback);
+    ++s->generation;
+    return {(uint32_t) (s - _pool.data()), s->generation};
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureReadback::Staging * TextureReadback::find(Handle h) {
+    if (!h || h.index >= _pool.size()) return nullptr;
+    auto & s = _pool[h.index];
+    return (s.busy && s.generation == h.generation) ? &s : nullptr;
+}
+
+// -----------------------------------------------------------------------------
+//
+const TextureReadback::Staging * TextureReadback::find(Handle h) const {
+    if (!h || h.index >= _pool.size()) return nullptr;
+    auto & s = _pool[h.index];
+    return (s.busy && s.generation == h.generation) ? &s : nullptr;
+}
+
+// -----------------------------------------------------------------------------
+//
+bool TextureReadback::poll(Staging & s, uint64_t timeoutNs) {
+    if (!s.fence.wait(timeoutNs)) return false;
+    s.fence.reset();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureReadback::deliver(Staging & s, void * dst, size_t size) {
+    auto & sc = StateCache::current();
+    sc.bindBuffer(GL_COPY_READ_BUFFER, s.buffer);
+    void * ptr = nullptr;
+    LGI_CHK(ptr = glMapBufferRange(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) s.image.size, GL_MAP_READ_BIT));
+    if (ptr) {
+        if (dst) std::memcpy(dst, ptr, std::min(size, s.image.size));
+        if (s.callback) {
+            auto image = s.image;
+            image.data = ptr;
+            s.callback(image);
+        }
+        LGI_CHK(glUnmapBuffer(GL_COPY_READ_BUFFER));
+    }
+    sc.bindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureReadback::recycle(Staging & s) {
+    s.fence.reset();
+    s.busy     = false;
+    s.image    = {};
+    s.callback = {};
+}
+
+// -----------------------------------------------------------------------------
+//
+bool TextureReadback::ready(Handle h) {
+    auto s = find(h);
+    return s && poll(*s, 0);
+}
+
+// -----------------------------------------------------------------------------
+//
+bool TextureReadback::wait(Handle h, uint64_t timeoutNs) {
+    auto s = find(h);
+    return s && poll(*s, timeoutNs);
+}
+
+// -----------------------------------------------------------------------------
+//
+size_t TextureReadback::size(Handle h) const {
+    auto s = find(h);
+    return s ? s->image.size : 0;
+}
+
+// -----------------------------------------------------------------------------
+//
+bool TextureReadback::get(Handle & h, void * dst, size_t size) {
+    auto s = find(h);
+    if (!s || !poll(*s, 0)) return false;
+    deliver(*s, dst, size);
+    recycle(*s);
+    h = {};
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureReadback::release(Handle & h) {
+    if (auto s = find(h)) recycle(*s);
+    h = {};
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureReadback::update() {
+    for (auto & s : _pool) {
+        if (!s.busy || !s.callback || !poll(s, 0)) continue;
+        deliver(s, nullptr, 0);
+        recycle(s);
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+size_t TextureReadback::pending() const {
+    return (size_t) std::count_if(_pool.begin(), _pool.end(), [](const Staging & s) { return s.busy; });
+}
+
+void DebugSSBO::printLastResult() const {
+#if DEBUG_SSBO_ENABLED
+    if (!counter) return;
+    auto count    = std::min<size_t>((*counter), buffer.size() - 1);
+    auto dataSize = sizeof(float) * (count + 1);
+    if (0 != memcmp(buffer.data(), printed.data(), dataSize)) {
+        memcpy(printed.data(), buffer.data(), dataSize);
+        std::stringstream ss;
+        ss << "count = " << *counter << " [";
+        for (size_t i = 0; i < count; ++i) {
+            auto value = printed[i + 1];
+            if (std::isnan(value))
+                ss << std::endl;
+            else
+                ss << value << ", ";
+        }
+        ss << "]";
+        LGI_LOGI("%s", ss.str().c_str());
+    }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+//
+ScreenQuad & ScreenQuad::allocate() {
+    // Cleanup previous array if any.
+    cleanup();
+
+    // Create new array.
+    auto & sc = StateCache::current();
+    LGI_CHK(glGenVertexArrays(1, &va));
+    sc.bindVertexArray(va);
+    vb.allocate(sizeof(Vertex), 6, nullptr);
+    LGI_CHK(vb.bind());
+    LGI_CHK(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) 0));
+    LGI_CHK(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, u)));
+    LGI_CHK(glEnableVertexAttribArray(0));
+    LGI_CHK(glEnableVertexAttribArray(1));
+    sc.bindVertexArray(0); // unbind
+
+    // update the buffer with default value.
+    update();
+
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+//
+ScreenQuad & ScreenQuad::cleanup() {
+    vb.cleanup();
+
+    // If we actually have a vertex array to cleanup.
+    if (va) {
+        // Delete the vertex array.
+        glDeleteVertexArrays(1, &va);
+        StateCache::current().onVertexArrayDeleted(va);
+
+        // Reset this to mark it as cleaned up.
+        va = 0;
+    }
+    LGI_CHK(;);
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+//
+ScreenQuad & ScreenQuad::update(const glm::vec4 pos, const glm::vec4 & uv) {
+    const Vertex vertices[] = {
+        {pos.x, pos.w, uv.x, uv.w}, {pos.y, pos.w, uv.y, uv.w}, {pos.x, pos.z, uv.x, uv.z},
+        {pos.x, pos.z, uv.x, uv.z}, {pos.y, pos.w, uv.y, uv.w}, {pos.y, pos.z, uv.y, uv.z},
+    };
+    vb.update(vertices, 0, 6);
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+// Setup vertex attributes of SimpleMesh::Vertex layout for vertex buffer that is currently bound to GL_ARRAY_BUFFER.
+static void setupSimpleMeshVertexAttributes() {
+    using Vertex = SimpleMesh::Vertex;
+    LGI_CHK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, position)));
+    LGI_CHK(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, normal)));
+    LGI_CHK(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, tangent)));
+    LGI_CHK(glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, color)));
+    LGI_CHK(glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, uv0)));
+    LGI_CHK(glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void *) offsetof(Vertex, uv1)));
+    LGI_CHK(glEnableVertexAttribArray(0));
+    LGI_CHK(glEnableVertexAttribArray(1));
+    LGI_CHK(glEnableVertexAttribArray(2));
+    LGI_CHK(glEnableVertexAttribArray(3));
+    LGI_CHK(glEnableVertexAttribArray(4));
+    LGI_CHK(glEnableVertexAttribArray(5));
+}
+
+// -----------------------------------------------------------------------------
+//
+SimpleMesh & SimpleMesh::allocate(const AllocateParameters & p) {
+    // Cleanup previous array if any.
+    cleanup();
+
+    // Create new vertex array
+    auto & sc = StateCache::current();
+    LGI_CHK(glGenVertexArrays(1, &va));
+    sc.bindVertexArray(va);
+    vb.allocate(sizeof(Vertex), p.vertexCount, p.vertices);
+    if (vb) {
+        LGI_CHK(vb.bind());
+        setupSimpleMeshVertexAttributes();
+    }
+    sc.bindVertexArray(0); // unbind
+
+    // Create new index array
+    if (p.index32) {
+        indexSize = 4;
+        indexType = GL_UNSIGNED_INT;
+        ib.allocate(4, p.indexCount, p.index32);
+    } else if (p.index16) {
+        indexSize = 2;
+        indexType = GL_UNSIGNED_SHORT;
+        ib.allocate(2, p.indexCount, p.index16);
+    }
+
+    // Record the index buffer into the vertex array, so draw() doesn't need to bind it.
+    if (ib) {
+        sc.bindIndexBuffer(va, ib.bo);
+        sc.bindVertexArray(0);
+    }
+
+    return *this;
+}
+
+SimpleMesh & SimpleMesh::cleanup() {
+    vb.cleanup();
+    ib.cleanup();
+    for (size_t i = 0; i < instanceStreamCount; ++i) {
+        instances[i].vb.cleanup();
+        instances[i].attributes.clear();
+        instances[i].capacity = 0;
+    }
+    instanceStreamCount = 0;
+
+    // If we actually have a vertex array to cleanup.
+    if (va) {
+        // Delete the vertex array.
+        glDeleteVertexArrays(1, &va);
+        StateCache::current().onVertexArrayDeleted(va);
+
+        // Reset this to mark it as cleaned up.
+        va = 0;
+    }
+    LGI_CHK(;);
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+// Setup attributes of an instance stream. The vertex array of the mesh must be bound.
+static void setupInstanceAttributes(const SimpleMesh::InstanceStream & s) {
+    s.vb.bind();
+    for (const auto & a : s.attributes) {
+        if (a.integer) {
+            LGI_CHK(glVertexAttribIPointer(a.location, a.components, a.type, s.stride, (const void *) a.offset));
+        } else {
+            LGI_CHK(glVertexAttribPointer(a.location, a.components, a.type, GL_FALSE, s.stride, (const void *) a.offset));
+        }
+        LGI_CHK(glVertexAttribDivisor(a.location, 1));
+        LGI_CHK(glEnableVertexAttribArray(a.location));
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+size_t SimpleMesh::addInstanceStream(GLsizei stride, const InstanceAttribute * attributes, size_t attributeCount, size_t capacity, const void * data) {
+    LGI_REQUIRE(va, "the mesh is not allocated yet.");
+    LGI_REQUIRE(instanceStreamCount < MAX_INSTANCE_STREAMS, "too many instance streams.");
+    LGI_REQUIRE(stride > 0 && capacity > 0);
+    auto & s    = instances[instanceStreamCount];
+    s.stride    = stride;
+    s.capacity  = capacity;
+    s.attributes.assign(attributes, attributes + attributeCount);
+    s.vb.allocate((size_t) stride, capacity, data, GL_STREAM_DRAW);
+
+    auto & sc = StateCache::current();
+    sc.bindVertexArray(va);
+    setupInstanceAttributes(s);
+    sc.bindVertexArray(0);
+
+    return instanceStreamCount++;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleMesh::updateInstances(size_t stream, const void * data, size_t count) {
+    LGI_ASSERT(stream < instanceStreamCount);
+    auto & s = instances[stream];
+    if (count > s.capacity) {
+        // Grow the buffer. The new buffer object has to be hooked up to the vertex array again.
+        s.capacity = std::max(count, s.capacity * 2);
+        s.vb.allocate((size_t) s.stride, s.capacity, nullptr, GL_STREAM_DRAW);
+        auto & sc = StateCache::current();
+        sc.bindVertexArray(va);
+        setupInstanceAttributes(s);
+        sc.bindVertexArray(0);
+        s.vb.bind(); // freshly allocated storage. Nothing to orphan.
+    } else {
+        s.vb.bind();
+        // Orphan the old storage, then fill the new one.
+        LGI_DCHK(glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) s.vb.length, nullptr, GL_STREAM_DRAW));
+    }
+    LGI_DCHK(glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr) (count * (size_t) s.stride), data));
+}
+
+// -----------------------------------------------------------------------------
+//
+size_t MeshBatch::add(const SimpleMesh::AllocateParameters & p) {
+    DrawElementsIndirectCommand cmd;
+    cmd.firstIndex    = (GLuint) _indices.size();
+    cmd.baseVertex    = (GLint) _vertices.size();
+    cmd.instanceCount = 1;
+#ifdef __ANDROID__
+    cmd.baseInstance = 0; // must be zero on OpenGL ES.
+#else
+    cmd.baseInstance = (GLuint) commands.c.size();
+#endif
+
+    auto vertices = (const SimpleMesh::Vertex *) p.vertices;
+    if (vertices) _vertices.insert(_vertices.end(), vertices, vertices + p.vertexCount);
+
+    if (p.index32) {
+        _indices.insert(_indices.end(), p.index32, p.index32 + p.indexCount);
+        cmd.count = (GLuint) p.indexCount;
+    } else if (p.index16) {
+        _indices.insert(_indices.end(), p.index16, p.index16 + p.indexCount);
+        cmd.count = (GLuint) p.indexCount;
+    } else {
+        for (uint32_t i = 0; i < (uint32_t) p.vertexCount; ++i) _indices.push_back(i);
+        cmd.count = (GLuint) p.vertexCount;
+    }
+
+    commands.c.push_back(cmd);
+    return commands.c.size() - 1;
+}
+
+// -----------------------------------------------------------------------------
+//
+MeshBatch & MeshBatch::allocate() {
+    if (_va) {
+        glDeleteVertexArrays(1, &_va);
+        StateCache::current().onVertexArrayDeleted(_va);
+        _va = 0;
+    }
+    if (commands.c.empty()) return *this;
+
+    // Draw ID of each draw, fetched with divisor 1 and offset by baseInstance.
+    std::vector<uint32_t> drawIds(commands.c.size());
+    for (uint32_t i = 0; i < (uint32_t) drawIds.size(); ++i) drawIds[i] = i;
+
+    // Unbind the last drawn vertex array first, or allocating the index buffer would replace its index buffer binding.
+    auto & sc = StateCache::current();
+    sc.bindVertexArray(0);
+
+    _vb.allocate(sizeof(SimpleMesh::Vertex), _vertices.size(), _vertices.data());
+    _ib.allocate(sizeof(uint32_t), _indices.size(), _indices.data());
+    _drawIds.allocate(sizeof(uint32_t), drawIds.size(), drawIds.data());
+    commands.allocateGpuBuffer();
+
+    LGI_CHK(glGenVertexArrays(1, &_va));
+    sc.bindVertexArray(_va);
+    _vb.bind();
+    setupSimpleMeshVertexAttributes();
+    _drawIds.bind();
+    LGI_CHK(glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), nullptr));
+    LGI_CHK(glVertexAttribDivisor(DRAW_ID_LOCATION, 1));
+    LGI_CHK(glEnableVertexAttribArray(DRAW_ID_LOCATION));
+    sc.bindIndexBuffer(_va, _ib.bo);
+    sc.bindVertexArray(0);
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+//
+MeshBatch & MeshBatch::cleanup() {
+    _vertices.clear();
+    _indices.clear();
+    commands.cleanup();
+    _vb.cleanup();
+    _ib.cleanup();
+    _drawIds.cleanup();
+    if (_va) {
+        glDeleteVertexArrays(1, &_va);
+        StateCache::current().onVertexArrayDeleted(_va);
+        _va = 0;
+    }
+    return *this;
+}
+
+// -----------------------------------------------------------------------------
+//
+void MeshBatch::draw(size_t first, size_t count) const {
+    if (!_va || 0 == count) return;
+    LGI_ASSERT(first + count <= commands.g.length / sizeof(DrawElementsIndirectCommand));
+    auto & sc = StateCache::current();
+    sc.bindVertexArray(_va);
+    commands.g.bind();
+    auto offset = first * sizeof(DrawElementsIndirectCommand);
+#ifdef __ANDROID__
+    for (size_t i = 0; i < count; ++i, offset += sizeof(DrawElementsIndirectCommand)) {
+        LGI_DCHK(glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *) offset));
+    }
+#else
+    LGI_DCHK(glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void *) offset, (GLsizei) count, 0));
+#endif
+}
+
+// -----------------------------------------------------------------------------
+//
+static const char * shaderType2String(GLenum shaderType) {
+    switch (shaderType) {
+    case GL_VERTEX_SHADER:
+        return "vertex";
+    case GL_FRAGMENT_SHADER:
+        return "fragment";
+    case GL_COMPUTE_SHADER:
+        return "compute";
+    default:
+        return "";
+    }
+}
+
+// -----------------------------------------------------------------------------
+static std::string addLineCount(const std::string & in) {
+    std::stringstream ss;
+    ss << "(  1) : ";
+    int line = 1;
+    for (auto ch : in) {
+        if ('\n' == ch)
+            ss << lgi::format("\n(%3d) : ", ++line);
+        else
+            ss << ch;
+    }
+    return ss.str();
+}
+
+// -----------------------------------------------------------------------------
+//
+GLuint loadShaderFromString(const char * source, size_t length, GLenum shaderType, const char * optionalFilename) {
+    if (!source || !*source) {
+        LGI_LOGE("Empty shader source");
+        return 0;
+    }
+    auto [trimmed, trimmedLength] = lgi::trim(source, length);
+    if (0 == trimmedLength) {
+        LGI_LOGE("Empty shader source");
+        return 0;
+    }
+    GLint sizes[] = {(GLint) trimmedLength};
+    auto  shader  = glCreateShader(shaderType);
+    LGI_CHK(glShaderSource(shader, 1, &trimmed, sizes));
+    LGI_CHK(glCompileShader(shader));
+
+    // check for shader compile errors
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (GL_TRUE != success) {
+        static thread_local char infoLog[4096];
+        glGetShaderInfoLog(shader, 4096, NULL, infoLog);
+        glDeleteShader(shader);
+        LGI_LOGE("\n================== Failed to compile %s shader '%s' ====================\n"
+                 "%s\n"
+                 "\n============================= GLSL shader source ===============================\n"
+                 "%s\n"
+                 "\n================================================================================\n",
+                 shaderType2String(shaderType), (optionalFilename && *optionalFilename) ? optionalFilename : "<no-name>", infoLog,
+                 addLineCount(trimmed).c_str());
+        return 0;
+    }
+
+    // done
+    LGI_ASSERT(shader);
+    return shader;
+}
+
+// -----------------------------------------------------------------------------
+//
+GLuint linkProgram(const std::vector<GLuint> & shaders, const char * optionalProgramName) {
+    auto program = glCreateProgram();
+    for (auto s : shaders)
+        if (s) glAttachShader(program, s);
+    glLinkProgram(program);
+    for (auto s : shaders)
+        if (s) glDetachShader(program, s);
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        glDeleteProgram(program);
+        LGI_LOGE("Failed to link program %s:\n%s", (optionalProgramName && *optionalProgramName) ? optionalProgramName : "no-name", infoLog);
+        return 0;
+    }
+
+    // Enable the following code to dump GL program binary to disk.
+#if 0
+    if (optionalProgramName) {
+        std::string outfilename = std::string(optionalProgramName) + ".bin";
+        std::ofstream fs;
+        fs.open(outfilename);
+        if (fs.good()) {
+            std::vector<uint8_t> buffer(1024 * 1024 * 1024); // allocate 1MB buffer.
+            GLsizei len;
+            GLenum dummyFormat;
+            LGI_CHK(glGetProgramBinary(program, (GLsizei)buffer.size(), &len, &dummyFormat, buffer.data()));
+            fs.write((const char*)buffer.data(), len);
+        }
+    }
+#endif
+
+    // done
+    LGI_ASSERT(program);
+    return program;
+}
+
+// -----------------------------------------------------------------------------
+//
+bool SimpleSprite::init() {
+    cleanup();
+    const char * vscode = R"(#version 320 es
+        layout (location = 0) in vec2 a_position;
+        layout (location = 1) in vec2 a_uv;
+        out vec2 v_uv;
+        void main()
+        {
+            gl_Position = vec4(a_position, 0.0, 1.0);
+            v_uv = a_uv;
+        }
+    )";
+    const char * pscode = R"(#version 320 es
+        precision mediump float;
+        layout(binding = 0) uniform sampler2D u_tex0;
+        in vec2 v_uv;
+        out vec4 o_color;
+        void main()
+        {
+            o_color = texture(u_tex0, v_uv).xyzw;
+        }
+    )";
+    if (!_program.loadVsPs(vscode, pscode)) return false;
+    _tex0Binding = _program.getUniformBinding("u_tex0");
+
+    _quad.allocate();
+
+    // create sampler object
+    glGenSamplers(1, &_sampler);
+    glSamplerParameteri(_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    // done
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleSprite::cleanup() {
+    _program.cleanup();
+    _quad.cleanup();
+    if (_sampler) glDeleteSamplers(1, &_sampler), StateCache::current().onSamplerDeleted(_sampler), _sampler = 0;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleSprite::draw(GLuint texture, const glm::vec4 & pos, const glm::vec4 & uv) {
+    _quad.update(pos, uv);
+    _program.use();
+    if (_tex0Binding >= 0) {
+        auto & sc = StateCache::current();
+        sc.bindTexture((GLuint) _tex0Binding, GL_TEXTURE_2D, texture);
+        sc.bindSampler((GLuint) _tex0Binding, _sampler);
+    }
+    _quad.draw();
+}
+
+// -----------------------------------------------------------------------------
+//
+bool SimpleTextureCopy::init() {
+    const char * vscode = R"(#version 320 es
+        out vec2 v_uv;
+        void main()
+        {
+            const vec4 v[] = vec4[](
+                vec4(-1., -1.,  0., 0.),
+                vec4( 3., -1.,  2., 0.),
+                vec4(-1.,  3.,  0., 2.));
+            gl_Position = vec4(v[gl_VertexID].xy, 0., 1.);
+            v_uv = v[gl_VertexID].zw;
+        }
+    )";
+    const char * pscode = R"(
+        #version 320 es
+        precision mediump float;
+        layout(binding = 0) uniform %s u_tex0;
+        in vec2 v_uv;
+        out vec4 o_color;
+        void main()
+        {
+            o_color = texture(u_tex0, %s).xyzw;
+        }
+    )";
+
+    // tex2d program
+    {
+        auto & prog2d = _programs[GL_TEXTURE_2D];
+        auto   ps2d   = lgi::format(pscode, "sampler2D", "u_uv");
+        if (!prog2d.program.loadVsPs(vscode, pscode)) return false;
+        prog2d.tex0Binding = prog2d.program.getUniformBinding("u_tex0");
+    }
+
+    // tex2d array program
+    {
+        auto & prog2darray = _programs[GL_TEXTURE_2D_ARRAY];
+        auto   ps2darray   = lgi::format(pscode, "sampler2DArray", "vec3(u_uv, 0.)");
+        if (!prog2darray.program.loadVsPs(vscode, pscode)) return false;
+        prog2darray.tex0Binding = prog2darray.program.getUniformBinding("u_tex0");
+    }
+
+    // create sampler object
+    glGenSamplers(1, &_sampler);
+    glSamplerParameteri(_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glSamplerParameteri(_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    _quad.allocate();
+    glGenFramebuffers(1, &_fbo);
+
+    LGI_CHK(;); // make sure we have no errors.
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleTextureCopy::cleanup() {
+    _programs.clear();
+    _quad.cleanup();
+    if (_fbo) glDeleteFramebuffers(1, &_fbo), StateCache::current().onFramebufferDeleted(_fbo), _fbo = 0;
+    if (_sampler) glDeleteSamplers(1, &_sampler), StateCache::current().onSamplerDeleted(_sampler), _sampler = 0;
+}
+
+// -----------------------------------------------------------------------------
+//
+void SimpleTextureCopy::copy(const TextureSubResource & src, const TextureSubResource & dst) {
+    // get destination texture size
+    auto &   sc   = StateCache::current();
+    uint32_t dstw = 0, dsth = 0;
+    sc.bindTexture(dst.target, dst.id);
+    glGetTexLevelParameteriv(dst.target, (GLsizei) dst.level, GL_TEXTURE_WIDTH, (GLint *) &dstw);
+    glGetTexLevelParameteriv(dst.target, (GLsizei) dst.level, GL_TEXTURE_HEIGHT, (GLint *) &dsth);
+
+    // attach FBO to the destination texture
+    sc.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
+    switch (dst.target) {
+    case GL_TEXTURE_2D:
+        glFramebufferTexture1D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst.id, (GLsizei) dst.level);
+        break;
+
+    case GL_TEXTURE_2D_ARRAY:
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst.id, (GLsizei) dst.level, (GLsizei) dst.z);
+        break;
+
+    default:
+        // 3D or cube texture
+        LGI_LOGE("unsupported destination texture target.");
+        return;
+    }
+    constexpr GLenum drawbuffer = GL_COLOR_ATTACHMENT0;
+    glDrawBuffers(1, &drawbuffer);
+    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
+        LGI_LOGE("the frame buffer is not complete.");
+        return;
+    }
+
+    // get the porgram based on source target
+    auto & prog = _programs[src.target];
+    if (0 == prog.program) {
+        LGI_LOGE("unsupported source texture target.");
+        return;
+    }
+
+    // do the copy
+    prog.program.use();
+    if (prog.tex0Binding >= 0) {
+        sc.bindTexture((GLuint) prog.tex0Binding, src.target, src.id);
+        sc.bindSampler((GLuint) prog.tex0Binding, _sampler);
+    }
+    sc.viewport(0, 0, (GLsizei) dstw, (GLsizei) dsth);
+    _quad.draw();
+    sc.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
+
+    // done. make sure we are error clean.
+    LGI_DCHK(;);
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::init(size_t stagingSize, uint32_t framesInFlight) {
+    cleanup();
+    _staging.allocate(stagingSize, framesInFlight);
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::cleanup() {
+    _inFlight.clear();
+    for (size_t i = 0; i < (size_t) Priority::COUNT; ++i) {
+        _queues[i].clear();
+        _heads[i] = 0;
+    }
+    _staging.cleanup();
+    _stats = {};
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::enqueue(Priority priority, Job && job) {
+    _stats.pendingJobs += 1;
+    _stats.pendingBytes += job.data.size();
+    _queues[(size_t) priority].push_back(std::move(job));
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::uploadBuffer(GLuint buffer, size_t offset, const void * data, size_t size, Priority priority, Callback done) {
+    if (!buffer || !data || 0 == size) return;
+    Job j;
+    j.buffer = buffer;
+    j.offset = offset;
+    j.data.assign((const uint8_t *) data, (const uint8_t *) data + size);
+    j.done = std::move(done);
+    enqueue(priority, std::move(j));
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::uploadTexture(const TextureObject & texture, size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h,
+                                    const void * pixels, size_t sizeInBytes, GLenum format, GLenum type, Priority priority, Callback done) {
+    if (texture.empty() || !pixels || 0 == w || 0 == h || 0 == sizeInBytes) return;
+    LGI_REQUIRE(0 == sizeInBytes % (w * h), "pixel data size (%zu) is not multiple of pixel count (%zu).", sizeInBytes, w * h);
+    Job j;
+    j.target  = texture.target();
+    j.texture = texture.id();
+    j.layer   = layer;
+    j.level   = level;
+    j.x       = x;
+    j.y       = y;
+    j.w       = w;
+    j.h       = h;
+    j.format  = format;
+    j.type    = type;
+    j.data.assign((const uint8_t *) pixels, (const uint8_t *) pixels + sizeInBytes);
+    j.done = std::move(done);
+    enqueue(priority, std::move(j));
+}
+
+// -----------------------------------------------------------------------------
+// Upload next chunk of the job, no larger than maxBytes. Texture jobs are split by rows, and rows that don't fit in a
+// chunk are split further by pixels. Returns bytes uploaded, or 0 if the staging ring has no free space right now.
+size_t UploadScheduler::uploadChunk(Job & j, size_t maxBytes) {
+    size_t remaining = j.data.size() - j.progress;
+    // keep chunks small enough, so a few of them fit in the staging ring at the same time.
+    maxBytes = std::min(maxBytes, std::max<size_t>(_staging.size() / 4, 1));
+    size_t n = 0, rowBytes = 0, pixelBytes = 0;
+    if (j.buffer) {
+        n = std::min(remaining, maxBytes);
+    } else {
+        rowBytes   = j.data.size() / j.h;
+        pixelBytes = rowBytes / j.w;
+        if (j.progress % rowBytes || rowBytes > maxBytes)
+            n = std::min(rowBytes - j.progress % rowBytes, maxBytes / pixelBytes * pixelBytes); // (rest of) one row
+        else
+            n = std::min(remaining, maxBytes / rowBytes * rowBytes);
+    }
+    if (0 == n) return 0;
+
+    auto a = _staging.tryAlloc(n, 16); // never wait for the GPU.
+    if (!a) return 0;
+    std::memcpy(a.ptr, j.data.data() + j.progress, n);
+    _staging.flush();
+
+    auto & sc = StateCache::current();
+    if (j.buffer) {
+        sc.bindBuffer(GL_COPY_READ_BUFFER, a.buffer);
+        sc.bindBuffer(GL_COPY_WRITE_BUFFER, j.buffer);
+        LGI_DCHK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) a.offset, (GLintptr) (j.offset + j.progress), (GLsizeiptr) n));
+        sc.bindBuffer(GL_COPY_READ_BUFFER, 0);
+        sc.bindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    } else {
+        auto    firstRow = (GLint) (j.y + j.progress / rowBytes);
+        auto    x        = (GLint) (j.x + j.progress % rowBytes / pixelBytes);
+        GLsizei width    = (GLsizei) j.w;
+        GLsizei rows     = (GLsizei) (n / rowBytes);
+        if (n < rowBytes) {
+            width = (GLsizei) (n / pixelBytes);
+            rows  = 1;
+        }
+        auto offset = (const void *) (intptr_t) a.offset; // offset into the pixel unpack buffer.
+        sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, a.buffer);
+        sc.bindTexture(j.target, j.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (GL_TEXTURE_2D == j.target) {
+            LGI_DCHK(glTexSubImage2D(j.target, (GLint) j.level, x, firstRow, width, rows, j.format, j.type, offset));
+        } else if (GL_TEXTURE_CUBE_MAP == j.target) {
+            LGI_DCHK(glTexSubImage2D((GLenum) (GL_TEXTURE_CUBE_MAP_POSITIVE_X + j.layer), (GLint) j.level, x, firstRow, width, rows, j.format, j.type,
+                                     offset));
+        } else {
+            LGI_DCHK(glTexSubImage3D(j.target, (GLint) j.level, x, firstRow, (GLint) j.layer, width, rows, 1, j.format, j.type, offset));
+        }
+        sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    j.progress += n;
+    return n;
+}
+
+// -----------------------------------------------------------------------------
+// Issue pending jobs in priority order until the budget or the free staging space runs out. Returns bytes uploaded.
+size_t UploadScheduler::issue(size_t budgetBytes, uint64_t budgetNs) {
+    auto   start       = std::chrono::steady_clock::now();
+    size_t bytes       = 0;
+    Batch  batch;
+    bool   outOfBudget = false;
+    for (size_t p = 0; p < (size_t) Priority::COUNT && !outOfBudget; ++p) {
+        auto & q    = _queues[p];
+        auto & head = _heads[p];
+        while (head < q.size()) {
+            auto elapsed = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if (bytes >= budgetBytes || elapsed >= budgetNs) {
+                outOfBudget = true;
+                break;
+            }
+            auto & j = q[head];
+            // Always allow at least one row/chunk per call, so a tiny budget still makes progress.
+            auto n = uploadChunk(j, 0 == bytes ? std::max<size_t>(budgetBytes, j.buffer ? 1 : j.data.size() / j.h) : budgetBytes - bytes);
+            if (0 == n) {
+                // out of budget, or out of staging space.
+                outOfBudget = true;
+                break;
+            }
+            bytes += n;
+            _stats.pendingBytes -= n;
+            if (j.progress < j.data.size()) continue;
+            // The job is fully issued. Release its data right away.
+            if (j.done) batch.callbacks.push_back(std::move(j.done));
+            batch.jobs += 1;
+            j = {};
+            _stats.pendingJobs -= 1;
+            ++head;
+        }
+        if (head == q.size()) {
+            q.clear();
+            head = 0;
+        }
+    }
+    if (bytes > 0) {
+        batch.fence.insert();
+        _inFlight.push_back(std::move(batch));
+    }
+    if (outOfBudget) _stats.overBudgetFrames += 1;
+    _stats.totalBytes += bytes;
+    return bytes;
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::complete(bool wait) {
+    while (!_inFlight.empty()) {
+        auto & b = _inFlight.front();
+        if (!(wait ? b.fence.wait() : b.fence.signaled())) break;
+        _stats.completedJobs += b.jobs;
+        auto callbacks = std::move(b.callbacks);
+        _inFlight.erase(_inFlight.begin());
+        for (auto & c : callbacks) c();
+    }
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::update() {
+    complete(false);
+    if (_staging.empty() || 0 == _stats.pendingJobs) return;
+    auto start = std::chrono::steady_clock::now();
+    // Never wait for the GPU here. If the staging ring is still in use by previous frames, try again next frame.
+    if (!_staging.beginFrame(false)) {
+        _stats.bytesLastFrame = 0;
+        _stats.overBudgetFrames += 1;
+        return;
+    }
+    _stats.bytesLastFrame = issue(budget.bytesPerFrame, budget.nsPerFrame);
+    _staging.endFrame();
+    _stats.nsLastFrame = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// -----------------------------------------------------------------------------
+//
+void UploadScheduler::finish() {
+    while (!_staging.empty() && _stats.pendingJobs > 0) {
+        _staging.beginFrame();
+        auto n = issue(~(size_t) 0, ~0ull);
+        _staging.endFrame();
+        if (n > 0) continue;
+        if (_inFlight.empty()) {
+            LGI_LOGE("UploadScheduler: staging buffer is too small for the pending uploads.");
+            break;
+        }
+        complete(true); // staging ring is full. Wait for the GPU to drain it.
+    }
+    complete(true);
+}
+
+// -----------------------------------------------------------------------------
+//
+class TextureStreamer::Impl {
+public:
+    Impl(uint32_t workers, uint32_t slots): _slots(std::max<uint32_t>(slots, 1)) {
+        for (auto & s : _slots) LGI_CHK(glGenBuffers(1, &s.pbo));
+        for (uint32_t i = 0; i < std::max<uint32_t>(workers, 1); ++i) _workers.emplace_back([this] { run(); });
+    }
+
+    ~Impl() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _cv.notify_all();
+        for (auto & t : _workers) t.join();
+        auto & sc = StateCache::current();
+        for (auto & s : _slots) {
+            if (s.mapped) {
+                sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            if (s.pbo) {
+                glDeleteBuffers(1, &s.pbo);
+                sc.onBufferDeleted(s.pbo);
+            }
+        }
+    }
+
+    Handle load(const TextureObject & texture, GLenum format, GLenum type, size_t bytesPerPixel, Decoder decoder) {
+        if (texture.empty() || !decoder) return 0;
+        auto & d = texture.desc();
+        LGI_REQUIRE(d.is2D() || d.is2DArray() || d.isCube() || d.isCubeArray(), "TextureStreamer: unsupported texture target 0x%X.", d.target);
+        Stream st;
+        st.handle    = ++_lastHandle;
+        st.target    = d.target;
+        st.texture   = d.id;
+        st.width     = d.width;
+        st.height    = d.height;
+        st.layers    = d.depth;
+        st.mips      = d.mips;
+        st.format    = format;
+        st.type      = type;
+        st.bpp       = bytesPerPixel;
+        st.decode    = std::move(decoder);
+        st.nextLevel = (int32_t) d.mips - 1;
+        st.visible   = d.mips;
+        st.layersDone.resize(d.mips, 0);
+
+        // Hide everything but the coarsest level. It becomes visible once uploaded.
+        StateCache::current().bindTexture(d.target, d.id);
+        LGI_CHK(glGetTexParameteriv(d.target, GL_TEXTURE_BASE_LEVEL, &st.baseLevel));
+        LGI_CHK(glGetTexParameteriv(d.target, GL_TEXTURE_MAX_LEVEL, &st.maxLevel));
+        LGI_CHK(glTexParameteri(d.target, GL_TEXTURE_BASE_LEVEL, (GLint) d.mips - 1));
+        LGI_CHK(glTexParameteri(d.target, GL_TEXTURE_MAX_LEVEL, (GLint) d.mips - 1));
+        StateCache::current().bindTexture(d.target, 0);
+
+        _streams.push_back(std::move(st));
+        return _lastHandle;
+    }
+
+    void cancel(Handle h) {
+        auto st = find(h);
+        if (!st || Status::LOADING != st->status) return;
+        finish(*st, Status::CANCELLED);
+        if (0 == st->inFlight) remove(h);
+    }
+
+    void update() {
+        auto & sc = StateCache::current();
+
+        // Recycle slots whose uploads are done on GPU.
+        for (auto & s : _slots)
+            if (Slot::UPLOADING == s.state && s.fence.signaled()) {
+                s.fence.reset();
+                s.state = Slot::FREE;
+            }
+
+        // Upload decoded levels.
+        std::vector<size_t> decoded;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            decoded.swap(_decoded);
+        }
+        for (auto i : decoded) {
+            auto & s = _slots[i];
+            sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            s.mapped = false;
+            s.ptr    = nullptr;
+            s.decode = {};
+            s.state  = Slot::FREE;
+            auto st  = find(s.stream);
+            if (!st) continue;
+            st->inFlight -= 1;
+            if (!s.ok && Status::LOADING == st->status) {
+                LGI_LOGE("TextureStreamer: failed to decode layer %u, level %u of texture %u.", s.layer, s.level, st->texture);
+                finish(*st, Status::FAILED);
+            }
+            if (Status::LOADING != st->status) {
+                if (0 == st->inFlight) remove(st->handle);
+                continue;
+            }
+            upload(*st, s);
+            s.fence.insert();
+            s.state = Slot::UPLOADING;
+            if (++st->layersDone[s.level] == st->layers) reveal(*st);
+            if (0 == st->visible) {
+                finish(*st, Status::LOADED);
+                remove(st->handle);
+            }
+        }
+        sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        // Feed free slots to workers, coarsest levels over all streams first.
+        for (size_t i = 0; i < _slots.size(); ++i) {
+            auto & s = _slots[i];
+            if (Slot::FREE != s.state) continue;
+            auto st = nextStream();
+            if (!st) break;
+            if (!dispatch(*st, s)) break;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _todo.push_back(i);
+            }
+            _cv.notify_one();
+        }
+        sc.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    Status status(Handle h) const {
+        auto it = _finished.find(h);
+        if (it != _finished.end()) return it->second.status;
+        auto st = const_cast<Impl *>(this)->find(h);
+        return st ? st->status : Status::UNKNOWN;
+    }
+
+    uint32_t visibleLevel(Handle h) const {
+        auto it = _finished.find(h);
+        if (it != _finished.end()) return it->second.visible;
+        auto st = const_cast<Impl *>(this)->find(h);
+        return st ? st->visible : 0;
+    }
+
+    void forget(Handle h) { _finished.erase(h); }
+
+    size_t pending() const {
+        return (size_t) std::count_if(_streams.begin(), _streams.end(), [](const Stream & st) { return Status::LOADING == st.status; });
+    }
+
+private:
+    struct Stream {
+        Handle                handle  = 0;
+        GLenum                target  = 0;
+        GLuint                texture = 0;
+        uint32_t              width = 0, height = 0, layers = 0, mips = 0;
+        GLenum                format = 0, type = 0;
+        size_t                bpp = 0;
+        Decoder               decode;
+        int32_t               nextLevel = -1; // next level to dispatch. Negative, if everything is dispatched.
+        uint32_t              nextLayer = 0;
+        uint32_t              inFlight  = 0;  // number of slots being decoded for this stream.
+        uint32_t              visible   = 0;  // finest visible level.
+        std::vector<uint32_t> layersDone;     // number of uploaded layers of each level.
+        GLint                 baseLevel = 0, maxLevel = 1000; // texture's own mip range, restored when the stream is done.
+        Status                status = Status::LOADING;       // failed and cancelled streams linger until their slots return.
+
+        uint32_t levelWidth(uint32_t level) const { return std::max(1u, width >> level); }
+        uint32_t levelHeight(uint32_t level) const { return std::max(1u, height >> level); }
+    };
+
+    struct Result {
+        Status   status  = Status::UNKNOWN;
+        uint32_t visible = 0;
+    };
+
+    struct Slot {
+        enum State {
+            FREE,
+            DECODING,
+            UPLOADING,
+        };
+
+        GLuint   pbo      = 0;
+        size_t   capacity = 0;
+        State    state    = FREE;
+        bool     mapped   = false;
+        Fence    fence;
+        Handle   stream = 0;
+        Decoder  decode; // copy of the stream's decoder, so workers never touch the stream list.
+        uint32_t layer = 0, level = 0;
+        void *   ptr  = nullptr;
+        size_t   size = 0;
+        bool     ok   = false; // written by worker.
+    };
+
+    Stream * find(Handle h) {
+        for (auto & st : _streams)
+            if (st.handle == h) return &st;
+        return nullptr;
+    }
+
+    void remove(Handle h) {
+        for (auto it = _streams.begin(); it != _streams.end(); ++it)
+            if (it->handle == h) {
+                _streams.erase(it);
+                return;
+            }
+    }
+
+    // Stream with the coarsest level not dispatched yet. Oldest stream wins ties.
+    Stream * nextStream() {
+        Stream * next = nullptr;
+        for (auto & st : _streams)
+            if (Status::LOADING == st.status && st.nextLevel >= 0 && (!next || st.nextLevel > next->nextLevel)) next = &st;
+        return next;
+    }
+
+    // Restore the texture's own mip range and remember how the stream ended.
+    void finish(Stream & st, Status status) {
+        st.status            = status;
+        _finished[st.handle] = {status, st.visible};
+        auto & sc            = StateCache::current();
+        sc.bindTexture(st.target, st.texture);
+        LGI_CHK(glTexParameteri(st.target, GL_TEXTURE_BASE_LEVEL, st.baseLevel));
+        LGI_CHK(glTexParameteri(st.target, GL_TEXTURE_MAX_LEVEL, st.maxLevel));
+        sc.bindTexture(st.target, 0);
+    }
+
+    // Map the slot's buffer and assign next layer/level of the stream to it.
+    bool dispatch(Stream & st, Slot & s) {
+        auto level = (uint32_t) st.nextLevel;
+        auto size  = (size_t) st.levelWidth(level) * st.levelHeight(level) * st.bpp;
+        StateCache::current().bindBuffer(GL_PIXEL_UNPACK_BUFFER, s.pbo);
+        if (s.capacity < size) {
+            LGI_CHK(glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_DRAW));
+            s.capacity = size;
+        }
+        // Slot is free only after the GPU is done with it, so invalidating the whole buffer is safe.
+        s.ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr) size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!s.ptr) {
+            LGI_LOGE("TextureStreamer: failed to map pixel unpack buffer of %zu bytes.", size);
+            return false;
+        }
+        s.mapped = true;
+        s.state  = Slot::DECODING;
+        s.stream = st.handle;
+        s.decode = st.decode;
+        s.layer  = st.nextLayer;
+        s.level  = level;
+        s.size   = size;
+        s.ok     = false;
+        st.inFlight += 1;
+        if (++st.nextLayer == st.layers) {
+            st.nextLayer = 0;
+            st.nextLevel -= 1;
+        }
+        return true;
+    }
+
+    void upload(const Stream & st, const Slot & s) {
+        auto w = (GLsizei) st.levelWidth(s.level);
+        auto h = (GLsizei) st.levelHeight(s.level);
+        StateCache::current().bindTexture(st.target, st.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (GL_TEXTURE_2D == st.target) {
+            LGI_DCHK(glTexSubImage2D(st.target, (GLint) s.level, 0, 0, w, h, st.format, st.type, nullptr));
+        } else if (GL_TEXTURE_CUBE_MAP == st.target) {
+            LGI_DCHK(glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + s.layer, (GLint) s.level, 0, 0, w, h, st.format, st.type, nullptr));
+        } else {
+            LGI_DCHK(glTexSubImage3D(st.target, (GLint) s.level, 0, 0, (GLint) s.layer, w, h, 1, st.format, st.type, nullptr));
+        }
+    }
+
+    // Lower base level to the finest level that has itself and all coarser levels fully uploaded.
+    void reveal(Stream & st) {
+        auto visible = st.visible;
+        while (visible > 0 && st.layersDone[visible - 1] == st.layers) --visible;
+        if (visible == st.visible) return;
+        st.visible = visible;
+        StateCache::current().bindTexture(st.target, st.texture);
+        LGI_CHK(glTexParameteri(st.target, GL_TEXTURE_BASE_LEVEL, (GLint) visible));
+    }
+
+    void run() {
+        for (;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this] { return _quit || !_todo.empty(); });
+                if (_quit) return;
+                i = _todo.front();
+                _todo.pop_front();
+            }
+            auto & s = _slots[i];
+            try {
+                s.ok = s.decode(s.layer, s.level, s.ptr, s.size);
+            } catch (std::exception & ex) {
+                LGI_LOGE("TextureStreamer: decoder threw exception: %s", ex.what());
+                s.ok = false;
+            } catch (...) {
+                LGI_LOGE("TextureStreamer: decoder threw unknown exception.");
+                s.ok = false;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _decoded.push_back(i);
+        }
+    }
+
+    std::vector<Slot>                  _slots; // never resized after construction, since workers hold indices into it.
+    std::vector<Stream>                _streams;
+    std::unordered_map<Handle, Result> _finished; // how finished streams ended, until forgotten.
+    Handle                             _lastHandle = 0;
+    std::vector<std::thread>           _workers;
+    std::mutex                         _mutex;
+    std::condition_variable            _cv;
+    std::deque<size_t>                 _todo;    // slots waiting for a worker. Protected by _mutex.
+    std::vector<size_t>                _decoded; // slots decoded by workers, waiting for upload. Protected by _mutex.
+    bool                               _quit = false;
+};
+
+// -----------------------------------------------------------------------------
+//
+void TextureStreamer::init(uint32_t workers, uint32_t slots) {
+    cleanup();
+    _impl = new Impl(workers, slots);
+}
+
+// -----------------------------------------------------------------------------
+//
+void TextureStreamer::cleanup() {
+    delete _impl;
+    _impl = nullptr;
+}
+
+// -----------------------------------------------------------------------------
+//
+TextureStreamer::Handle TextureStreamer::load(const TextureObject & texture, GLenum format, GLenum type, size_t bytesPerPixel, Decoder decoder) {
+    LGI_REQUIRE(_impl, "TextureStreamer is not initialized.");
+    return _impl->load(texture, format, type, bytesPerPixel, std::move(decoder));
+}
+
+void TextureStreamer::cancel(Handle h) {
+    if (_impl) _impl->cancel(h);
+}
+
+void TextureStreamer::update() {
+    if (_impl) _impl->update();
+}
+
+TextureStreamer::Status TextureStreamer::status(Handle h) const { return _impl ? _impl->status(h) : Status::UNKNOWN; }
+
+uint32_t TextureStreamer::visibleLevel(Handle h) const { return _impl ? _impl->visibleLevel(h) : 0; }
+
+void TextureStreamer::forget(Handle h) {
+    if (_impl) _impl->forget(h);
+}
+
+size_t TextureStreamer::pending() const { return _impl ? _impl->pending() : 0; }
 
-    // done
-    LGI_ASSERT(program);
-    return program;
+// -----------------------------------------------------------------------------
+//
+const char * const VirtualTexture::GLSL = R"(
+// params: (pages in x, pages in y, tile size, border). cacheInfo: (cache layer size, coarsest page table level).
+float vtMipLevel(vec2 uv, vec4 params) {
+    vec2 texels = uv * params.xy * (params.z - 2.0 * params.w);
+    vec2 dx     = dFdx(texels);
+    vec2 dy     = dFdy(texels);
+    return max(0.0, 0.5 * log2(max(dot(dx, dx), dot(dy, dy))));
+}
+
+vec4 vtFeedback(vec2 uv, vec4 params, vec2 cacheInfo) {
+    uint  level = uint(min(floor(vtMipLevel(uv, params)), cacheInfo.y));
+    uvec2 page  = uvec2(clamp(uv, 0.0, 0.99999) * params.xy) >> level;
+    return vec4(float(page.x & 255u), float(page.y & 255u), float((page.x >> 8u) | ((page.y >> 8u) << 4u)), float(level + 1u)) / 255.0;
+}
+
+vec4 vtSample(sampler2D pageTable, sampler2DArray cache, vec4 params, vec2 cacheInfo, vec2 uv) {
+    int   level   = int(min(floor(vtMipLevel(uv, params)), cacheInfo.y));
+    uvec4 e       = uvec4(texelFetch(pageTable, ivec2(clamp(uv, 0.0, 0.99999) * params.xy) >> level, level) * 255.0 + 0.5);
+    vec2  pages   = max(floor(params.xy / exp2(float(e.a))), vec2(1.0));
+    vec2  inPage  = fract(uv * pages);
+    float content = params.z - 2.0 * params.w;
+    vec2  texel   = vec2(e.rg) * params.z + params.w + inPage * content;
+    return texture(cache, vec3(texel / cacheInfo.x, float(e.b)));
 }
+)";
 
 // -----------------------------------------------------------------------------
 //
-bool SimpleSprite::init() {
+void VirtualTexture::init(const CreateParams & cp) {
     cleanup();
-    const char * vscode = R"(#version 320 es
-        layout (location = 0) in vec2 a_position;
-        layout (location = 1) in vec2 a_uv;
-        out vec2 v_uv;
-        void main()
-        {
-            gl_Position = vec4(a_position, 0.0, 1.0);
-            v_uv = a_uv;
-        }
-    )";
-    const char * pscode = R"(#version 320 es
-        precision mediump float;
-        layout(binding = 0) uniform sampler2D u_tex0;
-        in vec2 v_uv;
-        out vec4 o_color;
-        void main()
-        {
-            o_color = texture(u_tex0, v_uv).xyzw;
-        }
-    )";
-    if (!_program.loadVsPs(vscode, pscode)) return false;
-    _tex0Binding = _program.getUniformBinding("u_tex0");
+    LGI_REQUIRE(cp.loader, "VirtualTexture: tile loader is required.");
+    LGI_REQUIRE(cp.tileSize > 2 * cp.border && cp.cacheSize >= cp.tileSize, "VirtualTexture: invalid tile or cache size.");
+    auto content = cp.tileSize - 2 * cp.border;
+    LGI_REQUIRE(0 == cp.width % content && 0 == cp.height % content, "VirtualTexture: size must be multiple of tile content size (%u).", content);
+    _cp     = cp;
+    _pagesX = cp.width / content;
+    _pagesY = cp.height / content;
+    LGI_REQUIRE(0 == (_pagesX & (_pagesX - 1)) && 0 == (_pagesY & (_pagesY - 1)), "VirtualTexture: page count (%ux%u) must be power of 2.", _pagesX,
+                _pagesY);
+    LGI_REQUIRE(_pagesX <= 4096 && _pagesY <= 4096, "VirtualTexture: too many pages (%ux%u). Feedback encoding supports up to 4096.", _pagesX, _pagesY);
+
+    _levels = 1;
+    while ((_pagesX >> _levels) > 0 || (_pagesY >> _levels) > 0) ++_levels;
+    uint32_t pages = 0;
+    for (uint32_t l = 0; l < _levels; ++l) {
+        _levelOffsets.push_back(pages);
+        pages += levelPagesX(l) * levelPagesY(l);
+    }
+    _pageSlots.assign(pages, ~0u);
+    _queued.assign(pages, 0);
+    _tableData.assign(pages, 0);
+
+    _tilesPerRow  = cp.cacheSize / cp.tileSize;
+    auto capacity = _tilesPerRow * _tilesPerRow * cp.cacheLayers;
+    LGI_REQUIRE(_tilesPerRow <= 256 && cp.cacheLayers <= 256, "VirtualTexture: cache is too large for 8-bit page table entries.");
+    _slots.assign(capacity, {});
+    for (uint32_t i = capacity; i > 0; --i) _freeSlots.push_back(i - 1);
+    _tile.resize((size_t) cp.tileSize * cp.tileSize * cp.pixelSize);
+    _stats.capacity = capacity;
+
+    _cache.allocate2DArray(cp.internalFormat, cp.cacheSize, cp.cacheSize, cp.cacheLayers);
+    _cache.bind(0);
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    LGI_CHK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    _cache.unbind();
+    _pageTable.allocate2D(GL_RGBA8, _pagesX, _pagesY, _levels);
+
+    // The coarsest page covers the whole texture. It is requested up front and never evicted, so every lookup has
+    // something to fall back to.
+    auto top = pageIndex(0, 0, _levels - 1);
+    _missing.push_back(top);
+    _queued[top] = 1;
+}
 
-    _quad.allocate();
+// -----------------------------------------------------------------------------
+//
+void VirtualTexture::cleanup() {
+    _readback.cleanup();
+    _inFlight = {};
+    if (_feedbackPbo) {
+        glDeleteBuffers(1, &_feedbackPbo);
+        StateCache::current().onBufferDeleted(_feedbackPbo);
+        _feedbackPbo = 0;
+    }
+    _feedbackSize = 0;
+    _feedback.cleanup();
+    _cache.cleanup();
+    _pageTable.cleanup();
+    _levelOffsets.clear();
+    _pageSlots.clear();
+    _queued.clear();
+    _slots.clear();
+    _freeSlots.clear();
+    _missing.clear();
+    _requested.clear();
+    _tableData.clear();
+    _dirtyPages.clear();
+    _dirtyRects.clear();
+    _pagesX = _pagesY = _levels = _tilesPerRow = 0;
+    _stats = {};
+}
 
-    // create sampler object
-    glGenSamplers(1, &_sampler);
-    glSamplerParameteri(_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glSamplerParameteri(_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+// -----------------------------------------------------------------------------
+//
+void VirtualTexture::beginFeedback(uint32_t width, uint32_t height) {
+    LGI_ASSERT(width > 0 && height > 0);
+    if (0 == _feedback.getLevels() || _feedback.getWidth(0) != width || _feedback.getHeight(0) != height) _feedback.allocate(width, height, 1, GL_RGBA8);
+    _feedback.bind();
+    glClearColor(0.f, 0.f, 0.f, 0.f); // alpha 0 means "no page".
+    LGI_CHK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+}
 
-    // done
-    return true;
+// -----------------------------------------------------------------------------
+//
+void VirtualTexture::endFeedback() {
+    if (_inFlight) return; // previous feedback is not back yet. Skip this one.
+    auto   w    = _feedback.getWidth(0);
+    auto   h    = _feedback.getHeight(0);
+    auto   size = (size_t) w * h * 4;
+    auto & sc   = StateCache::current();
+    if (!_feedbackPbo) { LGI_CHK(glGenBuffers(1, &_feedbackPbo)); }
+    sc.bindBuffer(GL_PIXEL_PACK_BUFFER, _feedbackPbo);
+    if (_feedbackSize < size) {
+        LGI_CHK(glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) size, nullptr, GL_STREAM_READ));
+        _feedbackSize = size;
+    }
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, _feedback.getFBO(0));
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    LGI_CHK(glReadPixels(0, 0, (GLsizei) w, (GLsizei) h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+    sc.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    sc.bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    _inFlight = _readback.read(_feedbackPbo, 0, size, [this](const void * data, size_t bytes) {
+        _inFlight = {};
+        onFeedback((const uint8_t *) data, bytes / 4);
+    });
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleSprite::cleanup() {
-    _program.cleanup();
-    _quad.cleanup();
-    if (_sampler) glDeleteSamplers(1, &_sampler), _sampler = 0;
+void VirtualTexture::pageCoords(uint32_t page, uint32_t & x, uint32_t & y, uint32_t & level) const {
+    level = (uint32_t) (std::upper_bound(_levelOffsets.begin(), _levelOffsets.end(), page) - _levelOffsets.begin()) - 1;
+    auto i = page - _levelOffsets[level];
+    x      = i % levelPagesX(level);
+    y      = i / levelPagesX(level);
+}
+
+// -----------------------------------------------------------------------------
+// Collect distinct pages from the feedback buffer. Decoding matches vtFeedback() in GLSL.
+void VirtualTexture::onFeedback(const uint8_t * pixels, size_t count) {
+    _requested.clear();
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t * p = pixels + i * 4;
+        if (0 == p[3]) continue;
+        uint32_t level = p[3] - 1u;
+        uint32_t x     = p[0] | ((p[2] & 15u) << 8);
+        uint32_t y     = p[1] | ((uint32_t) (p[2] >> 4) << 8);
+        if (level >= _levels || x >= levelPagesX(level) || y >= levelPagesY(level)) continue;
+        _requested.push_back(pageIndex(x, y, level));
+    }
+    std::sort(_requested.begin(), _requested.end());
+    _requested.erase(std::unique(_requested.begin(), _requested.end()), _requested.end());
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleSprite::draw(GLuint texture, const glm::vec4 & pos, const glm::vec4 & uv) {
-    _quad.update(pos, uv);
-    _program.use();
-    if (_tex0Binding >= 0) {
-        glActiveTexture(GL_TEXTURE0 + (GLenum) _tex0Binding);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glBindSampler((GLuint) _tex0Binding, _sampler);
+uint32_t VirtualTexture::allocateSlot() {
+    if (!_freeSlots.empty()) {
+        auto s = _freeSlots.back();
+        _freeSlots.pop_back();
+        return s;
     }
-    _quad.draw();
+    // Evict the least recently used tile that is not needed by the current frame. The coarsest page is pinned.
+    auto     top    = pageIndex(0, 0, _levels - 1);
+    uint32_t victim = ~0u;
+    for (uint32_t i = 0; i < _slots.size(); ++i) {
+        const auto & s = _slots[i];
+        if (s.page == top || s.lastUsed >= _frame) continue;
+        if (~0u == victim || s.lastUsed < _slots[victim].lastUsed) victim = i;
+    }
+    if (~0u == victim) return ~0u; // everything in the cache is in use. The cache is too small for the view.
+    _pageSlots[_slots[victim].page] = ~0u;
+    _dirtyPages.push_back(_slots[victim].page);
+    _slots[victim].page = ~0u;
+    _stats.evictions += 1;
+    return victim;
 }
 
 // -----------------------------------------------------------------------------
 //
-bool SimpleTextureCopy::init() {
-    const char * vscode = R"(#version 320 es
-        out vec2 v_uv;
-        void main()
-        {
-            const vec4 v[] = vec4[](
-                vec4(-1., -1.,  0., 0.),
-                vec4( 3., -1.,  2., 0.),
-                vec4(-1.,  3.,  0., 2.));
-            gl_Position = vec4(v[gl_VertexID].xy, 0., 1.);
-            v_uv = v[gl_VertexID].zw;
-        }
-    )";
-    const char * pscode = R"(
-        #version 320 es
-        precision mediump float;
-        layout(binding = 0) uniform %s u_tex0;
-        in vec2 v_uv;
-        out vec4 o_color;
-        void main()
-        {
-            o_color = texture(u_tex0, %s).xyzw;
+void VirtualTexture::update() {
+    if (_pageSlots.empty()) return;
+    ++_frame;
+    _readback.update(); // may call onFeedback()
+
+    // Touch requested pages and all their ancestors, and queue the missing ones.
+    if (!_requested.empty()) {
+        _stats.requestsLastFrame = _requested.size();
+        for (auto page : _requested) {
+            uint32_t x, y, level;
+            pageCoords(page, x, y, level);
+            for (; level < _levels; ++level, x >>= 1, y >>= 1) {
+                auto p = pageIndex(x, y, level);
+                if (~0u != _pageSlots[p]) {
+                    if (_slots[_pageSlots[p]].lastUsed == _frame) break; // ancestors are touched already.
+                    _slots[_pageSlots[p]].lastUsed = _frame;
+                } else if (!_queued[p]) {
+                    _queued[p] = 1;
+                    _missing.push_back(p);
+                }
+            }
         }
-    )";
-
-    // tex2d program
-    {
-        auto & prog2d = _programs[GL_TEXTURE_2D];
-        auto   ps2d   = lgi::format(pscode, "sampler2D", "u_uv");
-        if (!prog2d.program.loadVsPs(vscode, pscode)) return false;
-        prog2d.tex0Binding = prog2d.program.getUniformBinding("u_tex0");
+        _requested.clear();
+        // Coarse levels first: they cover more screen area, and finer pages fall back to them.
+        std::stable_sort(_missing.begin(), _missing.end(), [this](uint32_t a, uint32_t b) {
+            uint32_t ax, ay, al, bx, by, bl;
+            pageCoords(a, ax, ay, al);
+            pageCoords(b, bx, by, bl);
+            return al > bl;
+        });
     }
 
-    // tex2d array program
-    {
-        auto & prog2darray = _programs[GL_TEXTURE_2D_ARRAY];
-        auto   ps2darray   = lgi::format(pscode, "sampler2DArray", "vec3(u_uv, 0.)");
-        if (!prog2darray.program.loadVsPs(vscode, pscode)) return false;
-        prog2darray.tex0Binding = prog2darray.program.getUniformBinding("u_tex0");
+    // Stream in missing tiles.
+    size_t uploads = 0, processed = 0;
+    for (; processed < _missing.size() && uploads < _cp.maxUploadsPerFrame; ++processed) {
+        auto page     = _missing[processed];
+        _queued[page] = 0;
+        if (~0u != _pageSlots[page]) continue;
+        uint32_t x, y, level;
+        pageCoords(page, x, y, level);
+        if (!_cp.loader(x, y, level, _tile.data())) continue;
+        auto slot = allocateSlot();
+        if (~0u == slot) {
+            _queued[page] = 1; // retry next frame.
+            break;
+        }
+        auto tilesPerLayer = _tilesPerRow * _tilesPerRow;
+        auto layer         = slot / tilesPerLayer;
+        auto tx            = slot % _tilesPerRow;
+        auto ty            = slot % tilesPerLayer / _tilesPerRow;
+        _cache.setPixels(layer, 0, tx * _cp.tileSize, ty * _cp.tileSize, _cp.tileSize, _cp.tileSize, _tile.data(), 0, _cp.format, _cp.type);
+        _slots[slot]     = {page, _frame};
+        _pageSlots[page] = slot;
+        _dirtyPages.push_back(page);
+        ++uploads;
     }
+    _missing.erase(_missing.begin(), _missing.begin() + (std::ptrdiff_t) processed);
 
-    // create sampler object
-    glGenSamplers(1, &_sampler);
-    glSamplerParameteri(_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glSamplerParameteri(_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glSamplerParameterf(_sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    if (!_dirtyPages.empty()) updatePageTable();
+    _stats.uploadsLastFrame = uploads;
+    _stats.pendingTiles     = _missing.size();
+    _stats.residentTiles    = _slots.size() - _freeSlots.size();
+}
 
-    _quad.allocate();
-    glGenFramebuffers(1, &_fbo);
+// -----------------------------------------------------------------------------
+// Rewrite the page table under each dirty page, from its level down to level 0. Non resident pages point to their
+// closest resident ancestor, so nothing outside these subtrees changes. Only the rewritten regions are uploaded.
+void VirtualTexture::updatePageTable() {
+    // Levels are stored finest first, so descending page index visits coarse pages first. Subtrees of finer dirty pages
+    // are then often covered by a coarser one already.
+    std::sort(_dirtyPages.begin(), _dirtyPages.end(), std::greater<uint32_t>());
+    _dirtyPages.erase(std::unique(_dirtyPages.begin(), _dirtyPages.end()), _dirtyPages.end());
+
+    auto tilesPerLayer = _tilesPerRow * _tilesPerRow;
+    _dirtyRects.clear();
+    for (auto page : _dirtyPages) {
+        uint32_t px, py, pl;
+        pageCoords(page, px, py, pl);
+        auto covered = std::any_of(_dirtyRects.begin(), _dirtyRects.end(),
+                                   [&](const PageRect & r) { return r.level == pl && px >= r.x0 && px < r.x1 && py >= r.y0 && py < r.y1; });
+        if (covered) continue;
+        for (uint32_t level = pl + 1; level > 0; --level) {
+            auto     l = level - 1;
+            auto     s = pl - l;
+            PageRect r {l, px << s, py << s, std::min((px + 1) << s, levelPagesX(l)), std::min((py + 1) << s, levelPagesY(l))};
+            for (uint32_t y = r.y0; y < r.y1; ++y) {
+                for (uint32_t x = r.x0; x < r.x1; ++x) {
+                    auto     p     = pageIndex(x, y, l);
+                    auto     slot  = _pageSlots[p];
+                    uint32_t entry = 0;
+                    if (~0u != slot) {
+                        // RGBA8: slot x, slot y, layer, mip level of the resident tile.
+                        entry = (slot % _tilesPerRow) | ((slot % tilesPerLayer / _tilesPerRow) << 8) | ((slot / tilesPerLayer) << 16) | (l << 24);
+                    } else if (l + 1 < _levels) {
+                        entry = _tableData[pageIndex(std::min(x >> 1, levelPagesX(l + 1) - 1), std::min(y >> 1, levelPagesY(l + 1) - 1), l + 1)];
+                    }
+                    _tableData[p] = entry;
+                }
+            }
+            _dirtyRects.push_back(r);
+        }
+    }
+    _dirtyPages.clear();
 
-    LGI_CHK(;); // make sure we have no errors.
-    return true;
+    for (const auto & r : _dirtyRects)
+        _pageTable.setPixels(r.level, r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, &_tableData[pageIndex(r.x0, r.y0, r.level)], levelPagesX(r.level), GL_RGBA,
+                             GL_UNSIGNED_BYTE);
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleTextureCopy::cleanup() {
-    _programs.clear();
-    _quad.cleanup();
-    if (_fbo) glDeleteFramebuffers(1, &_fbo), _fbo = 0;
-    if (_sampler) glDeleteSamplers(1, &_sampler), _sampler = 0;
+void CommandBuffer::execute() const {
+    auto &       sc  = StateCache::current();
+    const auto * ptr = _arena.data();
+    const auto * end = ptr + _arena.size();
+
+    // read fixed sized payload of current command. Use memcpy since the arena makes no alignment promise to the payload.
+    auto read = [&](auto & payload) { std::memcpy(&payload, ptr + sizeof(Header), sizeof(payload)); };
+
+    while (ptr < end) {
+        Header h;
+        std::memcpy(&h, ptr, sizeof(h));
+        switch (h.op) {
+        case Op::USE_PROGRAM: {
+            GLuint program;
+            read(program);
+            sc.useProgram(program);
+            break;
+        }
+        case Op::BIND_VERTEX_ARRAY: {
+            GLuint va;
+            read(va);
+            sc.bindVertexArray(va);
+            break;
+        }
+        case Op::BIND_TEXTURE: {
+            BindTexture p;
+            read(p);
+            sc.bindTexture(p.unit, p.target, p.id);
+            break;
+        }
+        case Op::BIND_SAMPLER: {
+            BindTexture p;
+            read(p);
+            sc.bindSampler(p.unit, p.id);
+            break;
+        }
+        case Op::BIND_BUFFER: {
+            BindBuffer p;
+            read(p);
+            sc.bindBuffer(p.target, p.bo);
+            break;
+        }
+        case Op::BIND_BUFFER_RANGE: {
+            BindBuffer p;
+            read(p);
+            sc.bindBufferRange(p.target, p.index, p.bo, p.offset, p.size);
+            break;
+        }
+        case Op::BIND_FRAMEBUFFER: {
+            GLuint fbo;
+            read(fbo);
+            sc.bindFramebuffer(GL_FRAMEBUFFER, fbo);
+            break;
+        }
+        case Op::VIEWPORT: {
+            Viewport p;
+            read(p);
+            sc.viewport(p.x, p.y, p.w, p.h);
+            break;
+        }
+        case Op::UNIFORM: {
+            Uniform p;
+            read(p);
+            // Copy the value out to properly aligned storage. Large float arrays are read in place.
+            const void * data = ptr + sizeof(Header) + sizeof(p);
+            float        value[16];
+            if (UniformType::FLOAT != p.type || 1 == p.count) std::memcpy(value, data, std::min(sizeof(value), h.size - sizeof(Header) - sizeof(p)));
+            const auto * f = (1 == p.count) ? value : (const float *) data;
+            const auto * i = (const GLint *) value;
+            const auto * u = (const GLuint *) value;
+            switch (p.type) {
+            case UniformType::INT:
+                LGI_DCHK(glUniform1i(p.location, i[0]));
+                break;
+            case UniformType::UINT:
+                LGI_DCHK(glUniform1ui(p.location, u[0]));
+                break;
+            case UniformType::FLOAT:
+                LGI_DCHK(glUniform1fv(p.location, p.count, f));
+                break;
+            case UniformType::VEC2:
+                LGI_DCHK(glUniform2fv(p.location, 1, value));
+                break;
+            case UniformType::VEC3:
+                LGI_DCHK(glUniform3fv(p.location, 1, value));
+                break;
+            case UniformType::VEC4:
+                LGI_DCHK(glUniform4fv(p.location, 1, value));
+                break;
+            case UniformType::IVEC2:
+                LGI_DCHK(glUniform2iv(p.location, 1, i));
+                break;
+            case UniformType::IVEC3:
+                LGI_DCHK(glUniform3iv(p.location, 1, i));
+                break;
+            case UniformType::IVEC4:
+                LGI_DCHK(glUniform4iv(p.location, 1, i));
+                break;
+            case UniformType::UVEC2:
+                LGI_DCHK(glUniform2uiv(p.location, 1, u));
+                break;
+            case UniformType::UVEC3:
+                LGI_DCHK(glUniform3uiv(p.location, 1, u));
+                break;
+            case UniformType::UVEC4:
+                LGI_DCHK(glUniform4uiv(p.location, 1, u));
+                break;
+            case UniformType::MAT3:
+                LGI_DCHK(glUniformMatrix3fv(p.location, 1, false, value));
+                break;
+            case UniformType::MAT4:
+                LGI_DCHK(glUniformMatrix4fv(p.location, 1, false, value));
+                break;
+            }
+            break;
+        }
+        case Op::DRAW_ARRAYS: {
+            DrawArrays p;
+            read(p);
+            if (1 == p.instances) {
+                LGI_DCHK(glDrawArrays(p.mode, p.first, p.count));
+            } else {
+                LGI_DCHK(glDrawArraysInstanced(p.mode, p.first, p.count, p.instances));
+            }
+            break;
+        }
+        case Op::DRAW_ELEMENTS: {
+            DrawElements p;
+            read(p);
+            if (1 == p.instances) {
+                LGI_DCHK(glDrawElements(p.mode, p.count, p.type, (const void *) p.offset));
+            } else {
+                LGI_DCHK(glDrawElementsInstanced(p.mode, p.count, p.type, (const void *) p.offset, p.instances));
+            }
+            break;
+        }
+        case Op::DISPATCH: {
+            Dispatch p;
+            read(p);
+            LGI_DCHK(glDispatchCompute(p.x, p.y, p.z));
+            break;
+        }
+        case Op::MEMORY_BARRIER: {
+            GLbitfield barriers;
+            read(barriers);
+            LGI_DCHK(glMemoryBarrier(barriers));
+            break;
+        }
+        case Op::UPDATE_BUFFER: {
+            UpdateBuffer p;
+            read(p);
+            sc.bindBuffer(p.target, p.bo);
+            LGI_DCHK(glBufferSubData(p.target, (GLintptr) p.offset, (GLsizeiptr) p.size, ptr + sizeof(Header) + sizeof(p)));
+            break;
+        }
+        case Op::SET_PIXELS: {
+            SetPixels p;
+            read(p);
+            const void * pixels = ptr + sizeof(Header) + sizeof(p);
+            sc.bindTexture(p.target, p.id);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            if (GL_TEXTURE_2D == p.target) {
+                LGI_DCHK(glTexSubImage2D(p.target, p.level, p.x, p.y, p.w, p.h, p.format, p.type, pixels));
+            } else {
+                LGI_DCHK(glTexSubImage3D(p.target, p.level, p.x, p.y, p.z, p.w, p.h, 1, p.format, p.type, pixels));
+            }
+            break;
+        }
+        }
+        ptr += h.size;
+    }
 }
 
 // -----------------------------------------------------------------------------
 //
-void SimpleTextureCopy::copy(const TextureSubResource & src, const TextureSubResource & dst) {
-    // get destination texture size
-    uint32_t dstw = 0, dsth = 0;
-    glBindTexture(dst.target, dst.id);
-    glGetTexLevelParameteriv(dst.target, (GLsizei) dst.level, GL_TEXTURE_WIDTH, (GLint *) &dstw);
-    glGetTexLevelParameteriv(dst.target, (GLsizei) dst.level, GL_TEXTURE_HEIGHT, (GLint *) &dsth);
-
-    // attach FBO to the destination texture
-    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-    switch (dst.target) {
-    case GL_TEXTURE_2D:
-        glFramebufferTexture1D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst.id, (GLsizei) dst.level);
-        break;
-
-    case GL_TEXTURE_2D_ARRAY:
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, dst.id, (GLsizei) dst.level, (GLsizei) dst.z);
-        break;
-
-    default:
-        // 3D or cube texture
-        LGI_LOGE("unsupported destination texture target.");
-        return;
-    }
-    constexpr GLenum drawbuffer = GL_COLOR_ATTACHMENT0;
-    glDrawBuffers(1, &drawbuffer);
-    if (GL_FRAMEBUFFER_COMPLETE != glCheckFramebufferStatus(GL_FRAMEBUFFER)) {
-        LGI_LOGE("the frame buffer is not complete.");
-        return;
+uint64_t DrawQueue::makeKey(const Packet & p) {
+    // Map depth to unsigned integer that sorts in the same order as the float value.
+    uint32_t d;
+    std::memcpy(&d, &p.depth, sizeof(d));
+    d = (d & 0x80000000u) ? ~d : (d | 0x80000000u);
+
+    uint64_t textures = 0;
+    for (auto t : p.textures) textures = textures * 31 + t;
+
+    // Object names are truncated to fit in the key. Collisions only affect the sorting quality, not correctness.
+    uint64_t program = p.program & 0x3FFF;
+    uint64_t texture = textures & 0xFFF;
+    uint64_t va      = p.va & 0x1FFF;
+
+    if (!p.transparent) {
+        // [63] 0 | [62:49] program | [48:37] textures | [36:24] vertex array | [23:0] depth, front-to-back
+        return (program << 49) | (texture << 37) | (va << 24) | (d >> 8);
+    } else {
+        // [63] 1 | [62:31] depth, back-to-front | [30:17] program | [16:5] textures | [4:0] vertex array
+        return (1ull << 63) | (uint64_t(~d) << 31) | (program << 17) | (texture << 5) | (va & 0x1F);
     }
+}
 
-    // get the porgram based on source target
-    auto & prog = _programs[src.target];
-    if (0 == prog.program) {
-        LGI_LOGE("unsupported source texture target.");
-        return;
+// -----------------------------------------------------------------------------
+// LSD radix sort of packet indices, 8 bits per pass. Passes where all keys share the same digit are skipped.
+void DrawQueue::sort() {
+    auto n = _keys.size();
+    _order.resize(n);
+    _temp.resize(n);
+    for (uint32_t i = 0; i < (uint32_t) n; ++i) _order[i] = i;
+    if (n < 2) return;
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t histogram[257] = {};
+        for (auto k : _keys) ++histogram[((k >> shift) & 0xFF) + 1];
+        if (histogram[((_keys[0] >> shift) & 0xFF) + 1] == n) continue;
+        for (size_t i = 1; i < std::size(histogram); ++i) histogram[i] += histogram[i - 1];
+        for (auto i : _order) _temp[histogram[(_keys[i] >> shift) & 0xFF]++] = i;
+        _order.swap(_temp);
     }
+}
 
-    // do the copy
-    prog.program.use();
-    if (prog.tex0Binding >= 0) {
-        glActiveTexture(GL_TEXTURE0 + (GLuint) prog.tex0Binding);
-        glBindTexture(src.target, src.id);
-        glBindSampler((GLuint) prog.tex0Binding, _sampler);
+// -----------------------------------------------------------------------------
+//
+void DrawQueue::flush() {
+    _stats         = {};
+    _stats.packets = _packets.size();
+    if (_packets.empty()) return;
+
+    sort();
+
+    // count state changes of a packet sequence.
+    auto countStateChanges = [&](auto && packetAt) {
+        size_t         changes = 0;
+        const Packet * prev    = nullptr;
+        for (size_t i = 0; i < _packets.size(); ++i) {
+            const auto & p = packetAt(i);
+            if (!prev || prev->program != p.program) ++changes;
+            if (!prev || prev->va != p.va) ++changes;
+            for (size_t t = 0; t < MAX_TEXTURES; ++t)
+                if (p.textureTargets[t] && (!prev || prev->textures[t] != p.textures[t] || prev->textureTargets[t] != p.textureTargets[t])) ++changes;
+            prev = &p;
+        }
+        return changes;
+    };
+    _stats.unsortedState = countStateChanges([&](size_t i) -> const Packet & { return _packets[i]; });
+    _stats.stateChanges  = countStateChanges([&](size_t i) -> const Packet & { return _packets[_order[i]]; });
+
+    auto & sc = StateCache::current();
+    for (auto i : _order) {
+        const auto & p = _packets[i];
+        sc.useProgram(p.program);
+        for (size_t t = 0; t < MAX_TEXTURES; ++t)
+            if (p.textureTargets[t]) sc.bindTexture((GLuint) t, p.textureTargets[t], p.textures[t]);
+        for (size_t u = 0; u < p.uniformCount; ++u) p.uniforms[u].apply();
+        sc.bindVertexArray(p.va);
+        if (GL_NONE == p.indexType) {
+            LGI_DCHK(glDrawArraysInstanced(p.mode, 0, p.count, p.instances));
+        } else {
+            LGI_DCHK(glDrawElementsInstanced(p.mode, p.count, p.indexType, nullptr, p.instances));
+        }
     }
-    glViewport(0, 0, (GLsizei) dstw, (GLsizei) dsth);
-    _quad.draw();
-    glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
 
-    // done. make sure we are error clean.
-    LGI_DCHK(;);
+    clear();
 }
 
 // -----------------------------------------------------------------------------
@@ -1205,13 +5537,68 @@ std::string GpuTimestamps::print(const char * ident) const {
     return ss.str();
 }
 
+// -----------------------------------------------------------------------------
+// Retire the oldest frame in flight, if the GPU is done with it (or wait for it). Returns true if retired.
+bool FrameManager::retire(bool wait) {
+    if (_inFlight.empty()) return false;
+    auto & f = _inFlight.front();
+    if (!(wait ? f.fence.wait() : f.fence.signaled())) return false;
+    for (auto & r : f.recyclers) r();
+    _completed = f.index + 1;
+    _inFlight.erase(_inFlight.begin());
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+//
+void FrameManager::setMaxFramesInFlight(uint32_t n) {
+    n = std::max(n, 1u);
+    if (n == _maxFramesInFlight) return;
+    waitIdle();
+    _maxFramesInFlight = n;
+}
+
+// -----------------------------------------------------------------------------
+//
+void FrameManager::beginFrame() {
+    // Recycle whatever the GPU has finished, then make sure the CPU is no more than N frames ahead of the GPU.
+    while (retire(false)) {}
+    while (_inFlight.size() >= _maxFramesInFlight) retire(true);
+}
+
+// -----------------------------------------------------------------------------
+//
+void FrameManager::endFrame() {
+    auto & f = _inFlight.emplace_back();
+    f.index  = _frameIndex++;
+    f.fence.insert();
+    f.recyclers = std::move(_pending);
+    _pending.clear();
+}
+
+// -----------------------------------------------------------------------------
+//
+void FrameManager::waitIdle() {
+    while (retire(true)) {}
+    // nothing was submitted after the pending callbacks were registered. the GPU is idle at this point.
+    for (auto & r : _pending) r();
+    _pending.clear();
+}
+
+// -----------------------------------------------------------------------------
+//
+void FrameManager::cleanup() {
+    waitIdle();
+    _inFlight.clear();
+}
+
 // -----------------------------------------------------------------------------
 //
 #if LITESPD_GL_ENABLE_GLFW3
 #include <GLFW/glfw3.h>
 class RenderContext::Impl {
 public:
-    Impl(const RenderContext::CreateParams & cp) {
+    Impl(const RenderContext::CreateParams & cp): frames(cp.framesInFlight) {
         if (cp.externalWindow) { LGI_THROW("External window is not supported in GLFW3 backend."); }
         GLFWwindow * current = nullptr;
         if (cp.shared) {
@@ -1231,9 +5618,13 @@ public:
         if (!_window) LGI_THROW("Failed to create shared GLFW window.");
         glfwShowWindow(_window);
         glfwMakeContextCurrent(_window);
+        StateCache::makeCurrent(&cache);
     }
 
     virtual ~Impl() {
+        // recycle per-frame resources while the context is still alive.
+        frames.cleanup();
+        if (&StateCache::current() == &cache) StateCache::makeCurrent(nullptr);
         if (_window) glfwDestroyWindow(_window), _window = nullptr;
     }
 
@@ -1244,16 +5635,23 @@ public:
         }
         if (glfwWindowShouldClose(_window)) return false;
         glfwMakeContextCurrent(_window);
+        StateCache::makeCurrent(&cache);
         return true;
     }
 
-    static void clearCurrent() { glfwMakeContextCurrent(nullptr); }
+    static void clearCurrent() {
+        glfwMakeContextCurrent(nullptr);
+        StateCache::makeCurrent(nullptr);
+    }
 
     void endFrame() {
         glfwSwapBuffers(_window);
         glfwPollEvents();
     }
 
+    StateCache   cache;  // binding states of this context.
+    FrameManager frames; // frames in flight of this context.
+
 private:
     GLFWwindow * _window = nullptr;
 };
@@ -1559,7 +5957,7 @@ RenderContext::RenderContext(const CreateParams & cp) {
     _impl = new Impl(cp);
 #if LITESPD_GL_ENABLE_GLAD
     initGlad();
-    if (cp.debug) initializeOpenGLDebugRuntime();
+    if (cp.debug) initializeOpenGLDebugRuntime(cp.debugSynchronous);
 #endif
     LGI_CHK(;); // make sure we have no errors.
 
@@ -1578,10 +5976,19 @@ RenderContext & RenderContext::operator=(RenderContext && that) {
     }
     return *this;
 }
-bool RenderContext::beginFrame() { return _impl->beginFrame(); }
+bool RenderContext::beginFrame() {
+    if (!_impl->beginFrame()) return false;
+    _impl->frames.beginFrame();
+    return true;
+}
 void RenderContext::endFrame() {
-    if (_impl) _impl->endFrame();
+    if (getErrorCheckPolicy() >= ErrorCheckPolicy::PER_FRAME) lgi::reportGLErrors("end of frame", __FILE__, __LINE__);
+    if (_impl) {
+        _impl->frames.endFrame();
+        _impl->endFrame();
+    }
 }
+FrameManager & RenderContext::frames() { return _impl->frames; }
 void RenderContext::clearCurrent() { Impl::clearCurrent(); }
 
 class RenderContextStack::Impl {
@@ -1630,12 +6037,17 @@ public:
     }
 
     void apply() {
-        if (!_stack.empty()) { _stack.top().restore(); }
+        if (!_stack.empty()) {
+            _stack.top().restore();
+            // We don't know which state cache belongs to the restored context.
+            StateCache::makeCurrent(nullptr);
+        }
     }
 
     void pop() {
         if (!_stack.empty()) {
             _stack.top().restore();
+            StateCache::makeCurrent(nullptr);
             _stack.pop();
         }
     }
@@ -59,6 +59,29 @@ SOFTWARE.
 #define LITESPD_GL_ENABLE_GLM 0
 #endif
 
+/// \def LITESPD_GL_ERROR_CHECK_POLICY
+/// Default policy of checking GL errors: 0 = off, 1 = once per frame, 2 = once per ErrorScope, 3 = after every GL
+/// call. The policy can be changed at runtime with setErrorCheckPolicy(). Set to 0 to compile out all GL error checks,
+/// in which case the runtime policy is ignored. Default is 3 for debug build and 1 otherwise.
+#ifndef LITESPD_GL_ERROR_CHECK_POLICY
+#if LITESPD_GL_ENABLE_DEBUG_BUILD
+#define LITESPD_GL_ERROR_CHECK_POLICY 3
+#else
+#define LITESPD_GL_ERROR_CHECK_POLICY 1
+#endif
+#endif
+
+/// \def LITESPD_GL_MAX_LOG_LEVEL
+/// Log messages above this level are compiled out: 0 = error, 1 = warning, 2 = info, 3 = verbose, 4 = debug. Use
+/// setLogLevel() to filter further at runtime. Default is 4 for debug build and 3 otherwise.
+#ifndef LITESPD_GL_MAX_LOG_LEVEL
+#if LITESPD_GL_ENABLE_DEBUG_BUILD
+#define LITESPD_GL_MAX_LOG_LEVEL 4
+#else
+#define LITESPD_GL_MAX_LOG_LEVEL 3
+#endif
+#endif
+
 /// \def LITESPD_GL_THROW
 /// The macro to throw runtime exception.
 /// \param errorString The error string to throw. Can be std::string or const
@@ -79,7 +102,9 @@ SOFTWARE.
 #endif
 
 /// \def LITESPD_GL_LOG_ERROR
-/// The macro to log error message. The default implementation prints to stderr.
+/// The macro to log error message. The default implementation prints to stderr. Like all LITESPD_GL_LOG_XXX macros, it
+/// is usually invoked by the background log writer, so __FILE__ and __LINE__ in it don't point to the call site. The
+/// message is prefixed with "file(line): " of the call site instead.
 /// \paam message The error message to log. The type is const char *.
 #ifndef LITESPD_GL_LOG_ERROR
 #define LITESPD_GL_LOG_ERROR(message) fprintf(stderr, "[ ERROR ] %s\n", message)
@@ -152,12 +177,16 @@ SOFTWARE.
 
 #include <cassert>
 #include <cstdio>
+#include <array>
 #include <cstring> // memcpy
+#include <functional>
 #include <string>
+#include <tuple>
 #include <sstream>
 #include <vector>
 #include <variant>
 #include <unordered_map>
+#include <unordered_set>
 
 // ---------------------------------------------------------------------------------------------------------------------
 // Define LGI macros. LGI stands for Litespd-GL-Implementation. Macros started
@@ -177,16 +206,30 @@ SOFTWARE.
     T(T &&)             = default; \
     T & operator=(T &&) = default;
 
+#if defined(__GNUC__) || defined(__clang__)
+#define LGI_PRINTF_FORMAT(fmtIndex, firstArgIndex) __attribute__((format(printf, fmtIndex, firstArgIndex)))
+#else
+#define LGI_PRINTF_FORMAT(fmtIndex, firstArgIndex)
+#endif
+
 #define LGI_STR(x) LGI_STR_HELPER(x)
 
 #define LGI_STR_HELPER(x) #x
 
-#define LGI_LOGE(...) LITESPD_GL_LOG_ERROR(LITESPD_GL_NAMESPACE::lgi::format(__VA_ARGS__).c_str())
-#define LGI_LOGW(...) LITESPD_GL_LOG_WARNING(LITESPD_GL_NAMESPACE::lgi::format(__VA_ARGS__).c_str())
-#define LGI_LOGI(...) LITESPD_GL_LOG_INFO(LITESPD_GL_NAMESPACE::lgi::format(__VA_ARGS__).c_str())
-#define LGI_LOGV(...) LITESPD_GL_LOG_VERBOSE(LITESPD_GL_NAMESPACE::lgi::format(__VA_ARGS__).c_str())
-#if LITESPD_GL_ENABLE_DEBUG_BUILD
-#define LGI_LOGD(...) LITESPD_GL_LOG_DEBUG(LITESPD_GL_NAMESPACE::lgi::format(__VA_ARGS__).c_str())
+// Log messages are formatted only when the level is enabled at both compile time and runtime. The formatted message
+// is then handed to the LITESPD_GL_LOG_XXX macro of the level by a background writer thread. See lgi::log() for details.
+#define LGI_LOG(level, ...)                                                                                         \
+    do {                                                                                                            \
+        if (LITESPD_GL_MAX_LOG_LEVEL >= (int) LITESPD_GL_NAMESPACE::LogLevel::level &&                              \
+            LITESPD_GL_NAMESPACE::lgi::logEnabled(LITESPD_GL_NAMESPACE::LogLevel::level))                           \
+            LITESPD_GL_NAMESPACE::lgi::log(LITESPD_GL_NAMESPACE::LogLevel::level, __FILE__, __LINE__, __VA_ARGS__); \
+    } while (false)
+#define LGI_LOGE(...) LGI_LOG(ERROR_, __VA_ARGS__)
+#define LGI_LOGW(...) LGI_LOG(WARNING, __VA_ARGS__)
+#define LGI_LOGI(...) LGI_LOG(INFO, __VA_ARGS__)
+#define LGI_LOGV(...) LGI_LOG(VERBOSE, __VA_ARGS__)
+#if LITESPD_GL_MAX_LOG_LEVEL >= 4
+#define LGI_LOGD(...) LGI_LOG(DEBUG_, __VA_ARGS__)
 #else
 #define LGI_LOGD(...) void(0)
 #endif
@@ -208,18 +251,23 @@ SOFTWARE.
         }                                                                              \
     } while (false)
 
-// Check OpenGL error. This check is enabled in both debug and release build.
-#define LGI_CHK(func)                                                                             \
-    if (true) {                                                                                   \
-        func;                                                                                     \
-        if (glGetError == NULL) {                                                                 \
-            LGI_LOGE("gl not initialized properly...");                                           \
-        } else {                                                                                  \
-            GLenum err = glGetError();                                                            \
-            if (GL_NO_ERROR != err) { LGI_LOGE("function %s failed. (error=0x%x)", #func, err); } \
-        }                                                                                         \
-    } else                                                                                        \
+// Check OpenGL error after the call, if current error check policy is ErrorCheckPolicy::PER_CALL. This check is
+// available in both debug and release build, unless LITESPD_GL_ERROR_CHECK_POLICY is 0.
+#if LITESPD_GL_ERROR_CHECK_POLICY
+#define LGI_CHK(func)                                                                                         \
+    if (true) {                                                                                               \
+        func;                                                                                                 \
+        if (LITESPD_GL_NAMESPACE::ErrorCheckPolicy::PER_CALL == LITESPD_GL_NAMESPACE::getErrorCheckPolicy()) \
+            LITESPD_GL_NAMESPACE::lgi::reportGLErrors("function " #func, __FILE__, __LINE__);                 \
+    } else                                                                                                    \
+        void(0)
+#else
+#define LGI_CHK(func) \
+    if (true) {       \
+        func;         \
+    } else            \
         void(0)
+#endif
 
 // Use LGI_DCHK() at where that you want to have some sanity check only in
 // debug build,
@@ -262,12 +310,62 @@ namespace LITESPD_GL_NAMESPACE {
 #pragma warning(disable : 4201) // nonstandard extension used: nameless struct/union
 #endif
 
+/// Log levels. Each level is sent to its own LITESPD_GL_LOG_XXX macro.
+enum class LogLevel {
+    ERROR_  = 0,
+    WARNING = 1,
+    INFO    = 2,
+    VERBOSE = 3,
+    DEBUG_  = 4,
+};
+
+/// Set the most detailed log level that is allowed through at runtime. Levels compiled out by
+/// LITESPD_GL_MAX_LOG_LEVEL stay disabled regardless.
+void setLogLevel(LogLevel);
+
+LogLevel getLogLevel();
+
+/// Wait for all pending log messages of all threads to be written out. Errors are always flushed right away.
+void flushLog();
+
 namespace lgi {
 /// @brief Format string using printf style format.
 std::string        format(const char * fmt, ...);
 inline std::string format() { return {}; }
+
+bool logEnabled(LogLevel);
+
+/// @brief Format the message into the per-thread log ring buffer of the calling thread.
+/// @param file, line Call site, kept with the message and reported along with errors. file must be a string literal.
+void log(LogLevel, const char * file, int line, const char * fmt, ...) LGI_PRINTF_FORMAT(4, 5);
+
+/// @brief Drain and log all pending GL errors, attributing them to the innermost (or most recent) ErrorScope.
+/// @param where Describes the check point. Used in the error message.
+void reportGLErrors(const char * where, const char * file, int line);
 } // namespace lgi
 
+/// When to check GL errors. See LITESPD_GL_ERROR_CHECK_POLICY for details.
+enum class ErrorCheckPolicy {
+    OFF       = 0, ///< never check GL errors.
+    PER_FRAME = 1, ///< check once at the end of each frame (RenderContext::endFrame).
+    PER_SCOPE = 2, ///< check when entering and leaving each ErrorScope, plus once per frame.
+    PER_CALL  = 3, ///< check after every GL call made by the library, plus all above.
+};
+
+/// Set GL error check policy of all threads. Has no effect if LITESPD_GL_ERROR_CHECK_POLICY is 0.
+void setErrorCheckPolicy(ErrorCheckPolicy);
+
+ErrorCheckPolicy getErrorCheckPolicy();
+
+/// Name a region of GL calls. GL errors detected inside the region, or at the end of frame after the region, are
+/// reported with the region name. The name string must outlive the scope.
+class ErrorScope {
+public:
+    explicit ErrorScope(const char * name);
+    ~ErrorScope();
+    LGI_NO_COPY_NO_MOVE(ErrorScope);
+};
+
 #if LITESPD_GL_ENABLE_GLAD
 /// @brief Load all GL extension functions using GLAD.
 void initGlad(bool printGLInfo = false);
@@ -330,6 +428,338 @@ inline GLint getInt(GLenum name, GLuint index) {
     return value;
 }
 
+// -----------------------------------------------------------------------------
+// Shadow copy of the binding states of a GL context. All helper classes in this library route their binds through the
+// state cache of current context, so redundant binds never reach the driver.
+//
+// The cache only knows about binds made through it. Call invalidate() after changing bindings with raw GL calls, so
+// that the next bind of each kind is issued to GL unconditionally.
+class StateCache {
+public:
+    /// Value of a cached binding that is unknown to the cache.
+    static constexpr GLuint UNKNOWN = ~0u;
+
+    /// Number of texture units and sampler units being tracked. Binds to units beyond that are always issued.
+    static constexpr size_t MAX_TEXTURE_UNITS = 32;
+
+    /// Number of indexed binding points of each indexed buffer target being tracked. Binds beyond that are always issued.
+    static constexpr size_t MAX_INDEXED_BUFFER_BINDINGS = 32;
+
+    struct Stats {
+        uint64_t issued   = 0; ///< number of binds that are passed down to GL.
+        uint64_t filtered = 0; ///< number of redundant binds that are skipped.
+    };
+
+    StateCache() { invalidate(); }
+
+    LGI_NO_COPY_NO_MOVE(StateCache);
+
+    /// Returns the state cache of the context that is current to the calling thread. If no cache has been made current
+    /// by makeCurrent(), a thread local fallback cache is returned.
+    static StateCache & current();
+
+    /// Set the state cache of the current context of the calling thread. Set to null to use the thread local fallback
+    /// cache. The fallback cache is invalidated every time it becomes current.
+    static void makeCurrent(StateCache *);
+
+    /// Forget all cached states.
+    void invalidate();
+
+    const Stats & stats() const { return _stats; }
+
+    void resetStats() { _stats = {}; }
+
+    void useProgram(GLuint program) {
+        if (filter(_program, program)) return;
+        LGI_DCHK(glUseProgram(program));
+    }
+
+    void bindVertexArray(GLuint va) {
+        if (filter(_vertexArray, va)) return;
+        LGI_DCHK(glBindVertexArray(va));
+        // Element array buffer binding is part of the vertex array state.
+        _buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+
+    /// Binding GL_ELEMENT_ARRAY_BUFFER always unbinds the current vertex array first. Otherwise, allocating or updating
+    /// an unrelated index buffer would silently replace the index buffer of the last drawn vertex array. Use
+    /// bindIndexBuffer() to record an index buffer into a vertex array.
+    void bindBuffer(GLenum target, GLuint bo) {
+        if (GL_ELEMENT_ARRAY_BUFFER == target && 0 != _vertexArray) bindVertexArray(0);
+        auto slot = bufferSlot(target);
+        if (slot < BUFFER_SLOT_COUNT && filter(_buffers[slot], bo)) return;
+        if (slot >= BUFFER_SLOT_COUNT) ++_stats.issued;
+        LGI_DCHK(glBindBuffer(target, bo));
+    }
+
+    /// Record the index buffer into the vertex array. Leaves the vertex array bound.
+    void bindIndexBuffer(GLuint va, GLuint ib) {
+        bindVertexArray(va);
+        ++_stats.issued;
+        LGI_DCHK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib));
+        _buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = ib;
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint bo) { bindBufferRange(target, index, bo, 0, 0); }
+
+    /// Bind a range of the buffer to an indexed binding point. Size of zero means the whole buffer.
+    void bindBufferRange(GLenum target, GLuint index, GLuint bo, GLintptr offset, GLsizeiptr size) {
+        auto             slot = indexedBufferSlot(target);
+        IndexedBinding * b    = (slot < INDEXED_BUFFER_SLOT_COUNT && index < MAX_INDEXED_BUFFER_BINDINGS) ? &_indexedBuffers[slot][index] : nullptr;
+        if (b && b->buffer == bo && b->offset == offset && b->size == size) {
+            ++_stats.filtered;
+            return;
+        }
+        ++_stats.issued;
+        if (0 == size) {
+            LGI_DCHK(glBindBufferBase(target, index, bo));
+        } else {
+            LGI_DCHK(glBindBufferRange(target, index, bo, offset, size));
+        }
+        if (b) *b = {bo, offset, size};
+        // Indexed bind also changes the generic binding point of the target.
+        auto generic = bufferSlot(target);
+        if (generic < BUFFER_SLOT_COUNT) _buffers[generic] = bo;
+    }
+
+    void activeTexture(GLuint unit) {
+        if (filter(_activeTexture, unit)) return;
+        LGI_DCHK(glActiveTexture(GL_TEXTURE0 + unit));
+    }
+
+    /// Bind texture to current active texture unit.
+    void bindTexture(GLenum target, GLuint id) {
+        auto slot = textureSlot(target);
+        if (_activeTexture < MAX_TEXTURE_UNITS && slot < TEXTURE_SLOT_COUNT) {
+            if (filter(_textures[_activeTexture][slot], id)) return;
+        } else {
+            ++_stats.issued;
+        }
+        LGI_DCHK(glBindTexture(target, id));
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint id) {
+        // Check the cache first, so that a redundant bind doesn't change the active texture unit either.
+        auto slot = textureSlot(target);
+        if (unit < MAX_TEXTURE_UNITS && slot < TEXTURE_SLOT_COUNT && _textures[unit][slot] == id) {
+            ++_stats.filtered;
+            return;
+        }
+        activeTexture(unit);
+        bindTexture(target, id);
+    }
+
+    void bindSampler(GLuint unit, GLuint sampler) {
+        if (unit < MAX_TEXTURE_UNITS) {
+            if (filter(_samplers[unit], sampler)) return;
+        } else {
+            ++_stats.issued;
+        }
+        LGI_DCHK(glBindSampler(unit, sampler));
+    }
+
+    /// Bind frame buffer. GL_FRAMEBUFFER binds to both draw and read targets.
+    void bindFramebuffer(GLenum target, GLuint fbo) {
+        bool draw = GL_FRAMEBUFFER == target || GL_DRAW_FRAMEBUFFER == target;
+        bool read = GL_FRAMEBUFFER == target || GL_READ_FRAMEBUFFER == target;
+        if ((!draw || _drawFramebuffer == fbo) && (!read || _readFramebuffer == fbo)) {
+            ++_stats.filtered;
+            return;
+        }
+        ++_stats.issued;
+        LGI_DCHK(glBindFramebuffer(target, fbo));
+        if (draw) _drawFramebuffer = fbo;
+        if (read) _readFramebuffer = fbo;
+    }
+
+    void viewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+        if (_viewportValid && _viewport[0] == x && _viewport[1] == y && _viewport[2] == w && _viewport[3] == h) {
+            ++_stats.filtered;
+            return;
+        }
+        ++_stats.issued;
+        LGI_DCHK(glViewport(x, y, w, h));
+        _viewport[0]   = x;
+        _viewport[1]   = y;
+        _viewport[2]   = w;
+        _viewport[3]   = h;
+        _viewportValid = true;
+    }
+
+    /// \name Deletion hooks
+    /// Call these right after deleting GL objects, so that the cache won't mistake a recycled object name for an
+    /// existing binding.
+    //@{
+    void onProgramDeleted(GLuint);
+    void onVertexArrayDeleted(GLuint);
+    void onBufferDeleted(GLuint);
+    void onTextureDeleted(GLuint);
+    void onSamplerDeleted(GLuint);
+    void onFramebufferDeleted(GLuint);
+    //@}
+
+private:
+    static constexpr size_t BUFFER_SLOT_COUNT         = 13;
+    static constexpr size_t INDEXED_BUFFER_SLOT_COUNT = 4;
+    static constexpr size_t TEXTURE_SLOT_COUNT        = 7;
+
+    struct IndexedBinding {
+        GLuint     buffer = UNKNOWN;
+        GLintptr   offset = 0;
+        GLsizeiptr size   = 0;
+    };
+
+    GLuint         _program;
+    GLuint         _vertexArray;
+    GLuint         _buffers[BUFFER_SLOT_COUNT];
+    IndexedBinding _indexedBuffers[INDEXED_BUFFER_SLOT_COUNT][MAX_INDEXED_BUFFER_BINDINGS];
+    GLuint         _activeTexture;
+    GLuint         _textures[MAX_TEXTURE_UNITS][TEXTURE_SLOT_COUNT];
+    GLuint         _samplers[MAX_TEXTURE_UNITS];
+    GLuint         _drawFramebuffer;
+    GLuint         _readFramebuffer;
+    GLint          _viewport[4];
+    bool           _viewportValid;
+    Stats          _stats;
+
+    // Returns true if the bind is redundant. Or else, update the cached value and returns false.
+    bool filter(GLuint & cached, GLuint value) {
+        if (cached == value) {
+            ++_stats.filtered;
+            return true;
+        }
+        ++_stats.issued;
+        cached = value;
+        return false;
+    }
+
+    static size_t bufferSlot(GLenum target) {
+        switch (target) {
+        case GL_ARRAY_BUFFER:
+            return 0;
+        case GL_ELEMENT_ARRAY_BUFFER:
+            return 1;
+        case GL_COPY_READ_BUFFER:
+            return 2;
+        case GL_COPY_WRITE_BUFFER:
+            return 3;
+        case GL_PIXEL_PACK_BUFFER:
+            return 4;
+        case GL_PIXEL_UNPACK_BUFFER:
+            return 5;
+        case GL_UNIFORM_BUFFER:
+            return 6;
+        case GL_SHADER_STORAGE_BUFFER:
+            return 7;
+        case GL_DRAW_INDIRECT_BUFFER:
+            return 8;
+        case GL_DISPATCH_INDIRECT_BUFFER:
+            return 9;
+        case GL_ATOMIC_COUNTER_BUFFER:
+            return 10;
+        case GL_TEXTURE_BUFFER:
+            return 11;
+        case GL_TRANSFORM_FEEDBACK_BUFFER:
+            return 12;
+        default:
+            return BUFFER_SLOT_COUNT;
+        }
+    }
+
+    static size_t indexedBufferSlot(GLenum target) {
+        switch (target) {
+        case GL_UNIFORM_BUFFER:
+            return 0;
+        case GL_SHADER_STORAGE_BUFFER:
+            return 1;
+        case GL_ATOMIC_COUNTER_BUFFER:
+            return 2;
+        case GL_TRANSFORM_FEEDBACK_BUFFER:
+            return 3;
+        default:
+            return INDEXED_BUFFER_SLOT_COUNT;
+        }
+    }
+
+    static size_t textureSlot(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D:
+            return 0;
+        case GL_TEXTURE_2D_ARRAY:
+            return 1;
+        case GL_TEXTURE_CUBE_MAP:
+            return 2;
+        case GL_TEXTURE_3D:
+            return 3;
+        case GL_TEXTURE_CUBE_MAP_ARRAY:
+            return 4;
+        case GL_TEXTURE_2D_MULTISAMPLE:
+            return 5;
+        case GL_TEXTURE_BUFFER:
+            return 6;
+        default:
+            return TEXTURE_SLOT_COUNT;
+        }
+    }
+};
+
+// -----------------------------------------------------------------------------
+// RAII wrapper of GL sync object.
+class Fence {
+public:
+    LGI_NO_COPY(Fence);
+
+    Fence() = default;
+
+    Fence(Fence && that): _sync(that._sync) { that._sync = 0; }
+
+    Fence & operator=(Fence && that) {
+        if (this != &that) {
+            reset();
+            _sync      = that._sync;
+            that._sync = 0;
+        }
+        return *this;
+    }
+
+    ~Fence() { reset(); }
+
+    /// Insert a new fence into the GL command stream, replacing the existing one.
+    void insert() {
+        reset();
+        LGI_CHK(_sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+
+    void reset() {
+        if (_sync) glDeleteSync(_sync), _sync = 0;
+    }
+
+    bool empty() const { return 0 == _sync; }
+
+    /// Check if the GPU has passed the fence, without blocking. An empty fence is always signaled.
+    bool signaled() { return wait(0); }
+
+    /// Block until the GPU passes the fence, or the timeout expires. Returns true if the fence is signaled.
+    bool wait(uint64_t timeoutNs = ~0ull) {
+        if (!_sync) return true;
+        // Flush the command stream, or the fence might never be signaled.
+        auto result = glClientWaitSync(_sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeoutNs);
+        if (GL_TIMEOUT_EXPIRED == result) return false;
+        if (GL_WAIT_FAILED == result) LGI_LOGE("glClientWaitSync() failed.");
+        return true;
+    }
+
+    /// Make the GPU (rather than the CPU) wait for the fence. Useful for syncing between shared contexts.
+    void gpuWait() const {
+        if (_sync) { LGI_CHK(glWaitSync(_sync, 0, GL_TIMEOUT_IGNORED)); }
+    }
+
+    GLsync handle() const { return _sync; }
+
+private:
+    GLsync _sync = 0;
+};
+
 // -----------------------------------------------------------------------------
 //
 template<GLenum TARGET>
@@ -449,13 +879,93 @@ struct QueryObject {
     }
 };
 
+// -----------------------------------------------------------------------------
+/// How BufferObject::update() writes data to the GPU buffer.
+enum class BufferUpdateStrategy {
+    SUB_DATA,           ///< glBufferSubData.
+    ORPHAN,             ///< re-specify the whole buffer with glBufferData, so the driver can hand out fresh storage
+                        ///< instead of waiting for the GPU. Partial updates fall back to MAP_INVALIDATE.
+    MAP_INVALIDATE,     ///< glMapBufferRange with GL_MAP_INVALIDATE_RANGE_BIT.
+    MAP_UNSYNCHRONIZED, ///< glMapBufferRange with GL_MAP_UNSYNCHRONIZED_BIT. The caller must make sure the GPU is not
+                        ///< using the range anymore, e.g. with a fence.
+    COUNT,
+};
+
+// -----------------------------------------------------------------------------
+/// Per-thread counters of buffer updates, grouped by strategy. Use them to pick the fastest strategy on a driver.
+struct BufferUpdateStats {
+    struct Counter {
+        uint64_t calls = 0;
+        uint64_t bytes = 0;
+        uint64_t ns    = 0; ///< CPU time spent in the update calls.
+    };
+
+    Counter counters[(size_t) BufferUpdateStrategy::COUNT];
+
+    const Counter & operator[](BufferUpdateStrategy s) const { return counters[(size_t) s]; }
+
+    void reset() { *this = {}; }
+
+    std::string print() const;
+
+    static BufferUpdateStats & get();
+};
+
+namespace lgi {
+// Write data to the buffer currently bound to the target, using the specified strategy.
+void updateBuffer(GLenum target, size_t length, GLenum usage, BufferUpdateStrategy strategy, size_t offset, size_t size, const void * data);
+} // namespace lgi
+
 // -----------------------------------------------------------------------------
 // Helper class to manage GL buffer object.
 template<GLenum TARGET, size_t MIN_GPU_BUFFER_LENGH = 0>
 struct BufferObject {
-    GLuint bo            = 0;
-    size_t length        = 0; // buffer length in bytes.
-    GLenum mapped_target = 0;
+    GLuint               bo            = 0;
+    size_t               length        = 0; // buffer length in bytes.
+    GLenum               mapped_target = 0;
+    GLenum               usage         = GL_STATIC_DRAW;
+    BufferUpdateStrategy strategy      = BufferUpdateStrategy::SUB_DATA; // how update() writes data.
+
+    /// Scoped write mapping of a buffer range. The buffer is unmapped when the guard goes out of scope.
+    class WriteMap {
+    public:
+        WriteMap(BufferObject & buffer, size_t offset, size_t size, GLbitfield access): _buffer(&buffer), _access(access) {
+            _ptr = buffer.map(offset, size, GL_MAP_WRITE_BIT | access);
+        }
+
+        ~WriteMap() {
+            if (_buffer) _buffer->unmap();
+        }
+
+        WriteMap(WriteMap && that): _buffer(that._buffer), _ptr(that._ptr), _access(that._access) {
+            that._buffer = nullptr;
+            that._ptr    = nullptr;
+        }
+
+        LGI_NO_COPY(WriteMap);
+        WriteMap & operator=(WriteMap &&) = delete;
+
+        void * data() const { return _ptr; }
+
+        template<typename T>
+        T * as() const {
+            return (T *) _ptr;
+        }
+
+        explicit operator bool() const { return nullptr != _ptr; }
+
+        /// Flush a sub range (relative to the mapped range). Only valid when mapped with GL_MAP_FLUSH_EXPLICIT_BIT.
+        void flush(size_t offset, size_t size) const {
+            LGI_ASSERT(_access & GL_MAP_FLUSH_EXPLICIT_BIT);
+            _buffer->bind();
+            LGI_DCHK(glFlushMappedBufferRange(TARGET, (GLintptr) offset, (GLsizeiptr) size));
+        }
+
+    private:
+        BufferObject * _buffer;
+        void *         _ptr = nullptr;
+        GLbitfield     _access;
+    };
 
     LGI_NO_COPY(BufferObject);
     LGI_NO_MOVE(BufferObject);
@@ -467,20 +977,26 @@ struct BufferObject {
     static GLenum GetTarget() { return TARGET; }
 
     template<GLenum T = TARGET>
-    void allocate(size_t size, size_t count, const void * ptr, GLenum usage = GL_STATIC_DRAW) {
+    void allocate(size_t size, size_t count, const void * ptr, GLenum usage_ = GL_STATIC_DRAW) {
         cleanup();
         if (0 == size * count) return;
         LGI_CHK(glGenBuffers(1, &bo));
         // Note: ARM Mali GPU doesn't work well with zero sized buffers. So
         // we create buffer that is large enough to hold at least one element.
-        length = std::max(count, MIN_GPU_BUFFER_LENGH) * size;
-        LGI_CHK(glBindBuffer(T, bo));
+        length    = std::max(count, MIN_GPU_BUFFER_LENGH) * size;
+        usage     = usage_;
+        auto & sc = StateCache::current();
+        sc.bindBuffer(T, bo);
         LGI_CHK(glBufferData(T, (GLsizeiptr) length, ptr, usage));
-        LGI_CHK(glBindBuffer(T, 0)); // unbind
+        sc.bindBuffer(T, 0); // unbind
     }
 
     void cleanup() {
-        if (bo) glDeleteBuffers(1, &bo), bo = 0;
+        if (bo) {
+            glDeleteBuffers(1, &bo);
+            StateCache::current().onBufferDeleted(bo);
+            bo = 0;
+        }
         length = 0;
     }
 
@@ -488,28 +1004,28 @@ struct BufferObject {
 
     template<typename T, GLenum T2 = TARGET>
     void update(const T * ptr, size_t offset = 0, size_t count = 1) {
-        LGI_DCHK(glBindBuffer(T2, bo));
-        LGI_DCHK(glBufferSubData(T2, (GLintptr) (offset * sizeof(T)), (GLsizeiptr) (count * sizeof(T)), ptr));
+        StateCache::current().bindBuffer(T2, bo);
+        lgi::updateBuffer(T2, length, usage, strategy, offset * sizeof(T), count * sizeof(T), ptr);
     }
 
     template<GLenum T2 = TARGET>
     void bind() const {
-        LGI_DCHK(glBindBuffer(T2, bo));
+        StateCache::current().bindBuffer(T2, bo);
     }
 
     template<GLenum T2 = TARGET>
     static void unbind() {
-        LGI_DCHK(glBindBuffer(T2, 0));
+        StateCache::current().bindBuffer(T2, 0);
     }
 
     template<GLenum T2 = TARGET>
     void bindBase(GLuint base) const {
-        LGI_DCHK(glBindBufferBase(T2, base, bo));
+        StateCache::current().bindBufferBase(T2, base, bo);
     }
 
     template<typename T, GLenum T2 = TARGET>
     void getData(T * ptr, size_t offset, size_t count) {
-        LGI_DCHK(glBindBuffer(T2, bo));
+        StateCache::current().bindBuffer(T2, bo);
         void * mapped = nullptr;
         LGI_DCHK(mapped = glMapBufferRange(T2, (GLintptr) (offset * sizeof(T)), (GLsizeiptr) (count * sizeof(T)), GL_MAP_READ_BIT));
         if (mapped) {
@@ -518,13 +1034,14 @@ struct BufferObject {
         }
     }
 
+    /// Map a range of the buffer. Offset and size are in bytes.
     template<GLenum T2 = TARGET>
-    void * map(size_t offset, size_t count) {
-        bind();
+    void * map(size_t offset, size_t size, GLbitfield access = GL_MAP_READ_BIT) {
+        bind<T2>();
         void * ptr = nullptr;
-        LGI_DCHK(ptr = glMapBufferRange(T2, offset, count, GL_MAP_READ_BIT));
+        LGI_DCHK(ptr = glMapBufferRange(T2, (GLintptr) offset, (GLsizeiptr) size, access));
         assert(ptr);
-        mapped_target = TARGET;
+        mapped_target = T2;
         return ptr;
     }
 
@@ -533,9 +1050,13 @@ struct BufferObject {
         return map<T2>(0, length);
     }
 
+    /// Map a range of the buffer for writing. The range is unmapped when the returned guard is destroyed.
+    /// @param access Additional access flags, e.g. GL_MAP_UNSYNCHRONIZED_BIT or GL_MAP_FLUSH_EXPLICIT_BIT.
+    WriteMap mapWrite(size_t offset, size_t size, GLbitfield access = GL_MAP_INVALIDATE_RANGE_BIT) { return WriteMap(*this, offset, size, access); }
+
     void unmap() {
         if (mapped_target) {
-            bind();
+            StateCache::current().bindBuffer(mapped_target, bo);
             LGI_DCHK(glUnmapBuffer(mapped_target));
             mapped_target = 0;
         }
@@ -544,20 +1065,136 @@ struct BufferObject {
     operator GLuint() const { return bo; }
 };
 
+// -----------------------------------------------------------------------------
+// Track dirty element ranges of an array. Overlapping and adjacent ranges are coalesced.
+class DirtyRanges {
+public:
+    struct Range {
+        size_t begin, end;
+    };
+
+    void add(size_t begin, size_t end) {
+        if (begin >= end) return;
+        // fast path: extend the last range, which is the common case of sequential modifications.
+        if (!_ranges.empty()) {
+            auto & last = _ranges.back();
+            if (begin < last.begin) _sorted = false;
+            if (begin <= last.end && end >= last.begin) {
+                last.begin = std::min(last.begin, begin);
+                last.end   = std::max(last.end, end);
+                return;
+            }
+        }
+        _ranges.push_back({begin, end});
+    }
+
+    void clear() {
+        _ranges.clear();
+        _sorted = true;
+    }
+
+    bool empty() const { return _ranges.empty(); }
+
+    /// Sorted and coalesced dirty ranges.
+    const std::vector<Range> & ranges() {
+        if (!_sorted) coalesce();
+        return _ranges;
+    }
+
+    /// Number of dirty elements.
+    size_t count() {
+        size_t n = 0;
+        for (auto & r : ranges()) n += r.end - r.begin;
+        return n;
+    }
+
+private:
+    std::vector<Range> _ranges;
+    bool               _sorted = true;
+
+    void coalesce();
+};
+
+// -----------------------------------------------------------------------------
+/// Statistics of TypedBufferObject::syncGpuBuffer().
+struct BufferSyncStats {
+    uint64_t syncs         = 0;
+    uint64_t fullUploads   = 0;
+    uint64_t uploadCalls   = 0;
+    uint64_t uploadedBytes = 0;
+    uint64_t skippedBytes  = 0; ///< bytes not uploaded, thanks to dirty tracking.
+
+    void reset() { *this = {}; }
+};
+
+namespace lgi {
+// Call upload(first, count) for each dirty range of c, or once for the whole array if the dirty portion exceeds the
+// threshold. If nothing is marked dirty, c is assumed to have been modified directly and is uploaded as a whole.
+template<typename T, typename UPLOAD>
+void syncDirtyRanges(const std::vector<T> & c, DirtyRanges & dirty, float fullUploadThreshold, BufferSyncStats & stats, UPLOAD upload) {
+    ++stats.syncs;
+    if (c.empty()) {
+        dirty.clear();
+        return;
+    }
+    size_t total = c.size() * sizeof(T);
+    if (dirty.empty() || (float) dirty.count() > fullUploadThreshold * (float) c.size()) {
+        upload(0, c.size());
+        ++stats.fullUploads;
+        ++stats.uploadCalls;
+        stats.uploadedBytes += total;
+    } else {
+        size_t uploaded = 0;
+        for (auto & r : dirty.ranges()) {
+            if (r.begin >= c.size()) break;
+            auto end = std::min(r.end, c.size());
+            upload(r.begin, end - r.begin);
+            ++stats.uploadCalls;
+            uploaded += (end - r.begin) * sizeof(T);
+        }
+        stats.uploadedBytes += uploaded;
+        stats.skippedBytes += total - uploaded;
+    }
+    dirty.clear();
+}
+} // namespace lgi
+
 // -----------------------------------------------------------------------------
 //
 template<typename T, GLenum TARGET, size_t MIN_GPU_BUFFER_LENGTH = 0>
 struct TypedBufferObject {
     std::vector<T>                                  c; // CPU data
     gl::BufferObject<TARGET, MIN_GPU_BUFFER_LENGTH> g; // GPU data
+    DirtyRanges                                     dirty;                      // elements modified since last sync.
+    float                                           fullUploadThreshold = 0.5f; // upload all, if more than this portion is dirty.
+    BufferSyncStats                                 syncStats;
+
+    void allocateGpuBuffer() {
+        g.allocate(sizeof(T), c.size(), c.data());
+        dirty.clear();
+    }
+
+    /// Access element for writing, and mark it dirty.
+    T & modify(size_t i) {
+        dirty.add(i, i + 1);
+        return c[i];
+    }
+
+    void markDirty(size_t first, size_t count = 1) { dirty.add(first, first + count); }
 
-    void allocateGpuBuffer() { g.allocate(c.size(), c.data()); }
+    /// Mark the whole array dirty. Call this after modifying c directly, if some elements are marked dirty already.
+    void markAllDirty() { dirty.add(0, c.size()); }
 
-    void syncGpuBuffer() { g.update(c.data(), 0, c.size()); }
+    /// Upload dirty elements to GPU. Uploads the whole array if nothing is marked dirty, so code that writes c directly
+    /// keeps working without dirty tracking.
+    void syncGpuBuffer() {
+        lgi::syncDirtyRanges(c, dirty, fullUploadThreshold, syncStats, [&](size_t first, size_t count) { g.update(c.data() + first, first, count); });
+    }
 
     // Synchornosly copy buffer content from GPU to CPU.
     // Note that this call is EXTREMELY expensive, since it stalls both CPU and
     // GPU.
+    // Use BufferReadback to read back without stalling.
     void syncToCpu() {
         glFinish();
         g.getData(c.data(), 0, c.size());
@@ -570,112 +1207,560 @@ struct TypedBufferObject {
 };
 
 // -----------------------------------------------------------------------------
-//
-template<typename T, GLenum TARGET1, GLenum TARGET2, size_t MIN_GPU_BUFFER_LENGTH = 0>
-struct TypedBufferObject2 {
-    std::vector<T>                                   c;  // CPU data
-    gl::BufferObject<TARGET1, MIN_GPU_BUFFER_LENGTH> g1; // GPU data
-    gl::BufferObject<TARGET2, MIN_GPU_BUFFER_LENGTH> g2; // GPU data
+// Typed buffer that can be bound to any of the listed targets, e.g. as both vertex buffer and SSBO. The content lives
+// in one GL buffer object, so it is allocated and uploaded only once.
+template<typename T, size_t MIN_GPU_BUFFER_LENGTH, GLenum... TARGETS>
+struct MultiTargetBufferObject {
+    static_assert(sizeof...(TARGETS) > 0, "at least one target is required.");
+
+    static constexpr GLenum TARGET_LIST[] = {TARGETS...};
+
+    std::vector<T>                                          c; // CPU data
+    gl::BufferObject<TARGET_LIST[0], MIN_GPU_BUFFER_LENGTH> g; // GPU data, shared by all targets.
+    DirtyRanges                                             dirty;                      // elements modified since last sync.
+    float                                                   fullUploadThreshold = 0.5f; // upload all, if more than this portion is dirty.
+    BufferSyncStats                                         syncStats;
 
     void allocateGpuBuffer() {
-        g1.allocate(c.size(), c.data());
-        g2.allocate(c.size(), c.data());
+        g.allocate(sizeof(T), c.size(), c.data());
+        dirty.clear();
+    }
+
+    /// Access element for writing, and mark it dirty.
+    T & modify(size_t i) {
+        dirty.add(i, i + 1);
+        return c[i];
     }
 
+    void markDirty(size_t first, size_t count = 1) { dirty.add(first, first + count); }
+
+    /// Mark the whole array dirty. Call this after modifying c directly, if some elements are marked dirty already.
+    void markAllDirty() { dirty.add(0, c.size()); }
+
+    /// Upload dirty elements to GPU. Uploads the whole array if nothing is marked dirty, so code that writes c directly
+    /// keeps working without dirty tracking.
     void syncGpuBuffer() {
-        g1.update(c.data(), 0, c.size());
-        g2.update(c.data(), 0, c.size());
+        lgi::syncDirtyRanges(c, dirty, fullUploadThreshold, syncStats, [&](size_t first, size_t count) { g.update(c.data() + first, first, count); });
     }
 
     void cleanup() {
         c.clear();
-        g1.cleanup();
-        g2.cleanup();
+        g.cleanup();
     }
 
     template<GLenum TT>
     void bind() const {
-        if constexpr (TT == TARGET1) {
-            g1.bind();
-        } else {
-            static_assert(TT == TARGET2);
-            g2.bind();
-        }
+        static_assert(((TT == TARGETS) || ...), "not one of the buffer targets.");
+        g.template bind<TT>();
     }
 
     template<GLenum TT>
     void bindBase(GLuint base) const {
-        if constexpr (TT == TARGET1) {
-            g1.bindBase(base);
-        } else {
-            static_assert(TT == TARGET2);
-            g2.bindBase(base);
-        }
+        static_assert(((TT == TARGETS) || ...), "not one of the buffer targets.");
+        g.template bindBase<TT>(base);
     }
+
+    operator GLuint() const { return g.bo; }
 };
 
+/// Keeps the old name only. This is a breaking change: the type used to hold two GL buffers, g1 and g2, one for each
+/// target, and both are gone. Code using them must switch to the single buffer g, and to bind<TARGET>() and
+/// bindBase<TARGET>() in place of g1.bind() and g2.bind().
+template<typename T, GLenum TARGET1, GLenum TARGET2, size_t MIN_GPU_BUFFER_LENGTH = 0>
+using TypedBufferObject2 = MultiTargetBufferObject<T, MIN_GPU_BUFFER_LENGTH, TARGET1, TARGET2>;
+
 // -----------------------------------------------------------------------------
+// Ring buffer for per-frame dynamic data (vertices, indices, uniforms and etc.). Each frame sub-allocates aligned
+// chunks from a persistently and coherently mapped buffer, so writing data is a plain memcpy with no driver copy. One
+// fence is inserted per frame in flight, so a region is never overwritten while the GPU may still read it.
 //
-class VertexArrayObject {
-    GLuint _va = 0;
-
+// When glBufferStorage is not available, falls back to orphaning the buffer at the beginning of each frame. In that
+// case allocations are written to a CPU shadow copy, and flush() must be called before issuing draw calls that read
+// them. flush() is a no-op for persistent buffers.
+class RingBuffer {
 public:
-    ~VertexArrayObject() { cleanup(); }
+    struct Allocation {
+        void * ptr    = nullptr; ///< CPU address to write data to. Valid until the end of the frame.
+        GLuint buffer = 0;       ///< the GL buffer to bind.
+        size_t offset = 0;       ///< offset in bytes, for glBindBufferRange() or as vertex/index offset.
+        size_t size   = 0;
 
-    void allocate() {
-        cleanup();
-        LGI_CHK(glGenVertexArrays(1, &_va));
-    }
+        explicit operator bool() const { return nullptr != ptr; }
+    };
 
-    void cleanup() {
-        if (_va) glDeleteVertexArrays(1, &_va), _va = 0;
-    }
+    LGI_NO_COPY(RingBuffer);
+    LGI_NO_MOVE(RingBuffer);
 
-    void bind() const { LGI_DCHK(glBindVertexArray(_va)); }
+    RingBuffer() = default;
 
-    void unbind() const { LGI_DCHK(glBindVertexArray(0)); }
+    ~RingBuffer() { cleanup(); }
 
-    operator GLuint() const { return _va; }
-};
+    /// @param size Total size of the ring in bytes. Should be large enough for framesInFlight frames of data.
+    /// @param persistent Set to false to force the orphaning path, even if persistent mapping is available.
+    void allocate(size_t size, uint32_t framesInFlight = 3, bool persistent = true);
 
-// -----------------------------------------------------------------------------
-//
-struct AutoShader {
-    GLuint shader;
+    void cleanup();
 
-    AutoShader(GLuint s = 0): shader(s) {}
-    ~AutoShader() { cleanup(); }
+    bool empty() const { return 0 == _buffer; }
 
-    void cleanup() {
-        if (shader) glDeleteShader(shader), shader = 0;
-    }
+    bool persistent() const { return _persistent; }
 
-    LGI_NO_COPY(AutoShader);
+    GLuint buffer() const { return _buffer; }
 
-    // can move
-    AutoShader(AutoShader && rhs): shader(rhs.shader) { rhs.shader = 0; }
-    AutoShader & operator=(AutoShader && rhs) {
-        if (this != &rhs) {
-            cleanup();
-            shader     = rhs.shader;
-            rhs.shader = 0;
-        }
-        return *this;
+    size_t size() const { return _size; }
+
+    /// Must be called at the beginning of each frame, before any call to alloc(). Blocks if the GPU falls more than
+    /// framesInFlight frames behind. With wait set to false, returns false instead of blocking. In that case the frame
+    /// is not started, and endFrame() must not be called.
+    bool beginFrame(bool wait = true);
+
+    /// Must be called after the last GL command that reads memory allocated in current frame.
+    void endFrame();
+
+    /// Allocate memory for current frame. Returns empty allocation if the ring is out of space.
+    /// @param alignment Alignment of the returned offset. 0 means GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+    Allocation alloc(size_t size, size_t alignment = 0);
+
+    /// Same as alloc(), but never waits for the GPU to release space. Returns empty allocation if there's not enough
+    /// free space right now.
+    Allocation tryAlloc(size_t size, size_t alignment = 0);
+
+    /// Allocate memory for current frame and copy data into it.
+    template<typename T>
+    Allocation alloc(const T * data, size_t count, size_t alignment = alignof(T)) {
+        auto a = alloc(sizeof(T) * count, alignment);
+        if (a) std::memcpy(a.ptr, data, sizeof(T) * count);
+        return a;
     }
 
-    operator GLuint() const { return shader; }
-};
+    /// Upload data written since last flush. Only needed by the orphaning path.
+    void flush();
 
-class SamplerObject {
-    GLuint _id = 0;
+private:
+    struct Frame {
+        Fence  fence;
+        size_t end = 0; ///< value of _head at the end of the frame.
+    };
+
+    GLuint               _buffer         = 0;
+    size_t               _size           = 0;
+    size_t               _alignment      = 16;
+    uint32_t             _framesInFlight = 0;
+    bool                 _persistent     = false;
+    uint8_t *            _mapped         = nullptr; // persistently mapped pointer, or the shadow copy.
+    std::vector<uint8_t> _shadow;                   // CPU shadow copy for the orphaning path.
+    std::vector<Frame>   _frames;                   // frames in flight, oldest first.
+    size_t               _head    = 0;              // total bytes ever allocated, including paddings.
+    size_t               _tail    = 0;              // everything before this is no longer used by GPU.
+    size_t               _flushed = 0;              // orphaning path only: offset of data not uploaded yet.
+
+    void       retireFrame(bool wait);
+    Allocation reserve(size_t size, size_t alignment, bool wait);
+};
 
+// -----------------------------------------------------------------------------
+// Sub-allocate small GPU buffers out of a few large buffer pages, using a buddy scheme. Saves GL buffer objects and
+// the per-buffer padding, and keeps fragmentation bounded. Blocks are naturally aligned to their size, which also
+// satisfies the offset alignment of the target (e.g. GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for uniform buffers).
+class BufferAllocator {
 public:
-    SamplerObject() {}
-    ~SamplerObject() { cleanup(); }
+    struct Allocation {
+        GLuint   buffer = 0; ///< the page buffer. Bind it with glBindBufferRange(), or use offset as vertex/index offset.
+        size_t   offset = 0; ///< offset in bytes into the page buffer.
+        size_t   size   = 0; ///< requested size in bytes.
+        uint32_t page   = 0;
+        uint32_t order  = 0; ///< block size is (minBlockSize << order).
+
+        explicit operator bool() const { return 0 != buffer; }
+    };
 
-    LGI_NO_COPY(SamplerObject);
+    struct Stats {
+        size_t pages            = 0;
+        size_t capacity         = 0; ///< total size of all pages in bytes.
+        size_t allocations      = 0;
+        size_t requestedBytes   = 0; ///< sum of requested sizes.
+        size_t allocatedBytes   = 0; ///< sum of block sizes. The difference to requestedBytes is internal waste.
+        size_t freeBytes        = 0;
+        size_t largestFreeBlock = 0;
+
+        /// 0 means all free space is in one block. Close to 1 means free space is scattered in small blocks.
+        float fragmentation() const { return freeBytes ? 1.0f - (float) largestFreeBlock / (float) freeBytes : 0.0f; }
+    };
 
-    // can move
+    LGI_NO_COPY(BufferAllocator);
+    LGI_NO_MOVE(BufferAllocator);
+
+    BufferAllocator() = default;
+
+    ~BufferAllocator() { cleanup(); }
+
+    /// @param target Used to determine the default alignment. Pages themselves can be bound to any target.
+    /// @param pageSize Size of each page. Rounded up to power of 2. Larger allocations get a dedicated page.
+    /// @param minBlockSize Size of the smallest block. Rounded up to power of 2, and at least 16.
+    void init(GLenum target, size_t pageSize = 16 * 1024 * 1024, GLenum usage = GL_STATIC_DRAW, size_t minBlockSize = 256);
+
+    void cleanup();
+
+    /// @param alignment Must be power of 2. 0 means the default alignment of the target.
+    Allocation alloc(size_t size, size_t alignment = 0);
+
+    /// Release the allocation back to the allocator, and reset it.
+    void free(Allocation &);
+
+    /// Write data to the allocation. Offset is relative to the beginning of the allocation.
+    void update(const Allocation &, const void * data, size_t size, size_t offset = 0);
+
+    Stats stats() const;
+
+private:
+    struct Page {
+        GLuint                                  buffer   = 0;
+        uint32_t                                maxOrder = 0;
+        size_t                                  used     = 0; // bytes of allocated blocks.
+        std::vector<std::unordered_set<size_t>> free;         // offsets of free blocks of each order.
+    };
+
+    std::vector<Page> _pages;
+    GLenum            _usage        = GL_STATIC_DRAW;
+    size_t            _pageSize     = 0;
+    size_t            _minBlockSize = 256;
+    size_t            _alignment    = 16;
+    size_t            _allocations  = 0;
+    size_t            _requested    = 0;
+
+    uint32_t orderOf(size_t size) const;
+    uint32_t newPage(uint32_t maxOrder);
+    bool     allocFromPage(uint32_t page, uint32_t order, size_t & offset);
+};
+
+// -----------------------------------------------------------------------------
+// Asynchronous GPU to CPU buffer readback. read() copies the source range into a staging buffer on the GPU timeline
+// and inserts a fence, without waiting for anything. The result can be polled, waited on, or delivered to a callback
+// by update() a frame or more later. Staging buffers are pooled and reused across requests.
+class BufferReadback {
+public:
+    struct Handle {
+        uint32_t index      = ~0u;
+        uint32_t generation = 0;
+
+        explicit operator bool() const { return ~0u != index; }
+    };
+
+    /// Called by update() when the data is ready. The pointer is only valid during the call. Don't issue new
+    /// requests from within the callback.
+    using Callback = std::function<void(const void * data, size_t size)>;
+
+    LGI_NO_COPY(BufferReadback);
+    LGI_NO_MOVE(BufferReadback);
+
+    BufferReadback() = default;
+
+    ~BufferReadback() { cleanup(); }
+
+    void cleanup();
+
+    /// Schedule a copy of [offset, offset + size) of the source buffer. Never blocks. If a callback is specified,
+    /// the request is released automatically after the callback is invoked by update().
+    Handle read(GLuint buffer, size_t offset, size_t size, Callback callback = {});
+
+    template<GLenum TARGET, size_t N>
+    Handle read(const BufferObject<TARGET, N> & bo, size_t offset, size_t size, Callback callback = {}) {
+        return read(bo.bo, offset, size, std::move(callback));
+    }
+
+    /// Check if the copy is done, without blocking.
+    bool ready(Handle);
+
+    /// Block until the copy is done, or the timeout expires. Returns true if the data is ready.
+    bool wait(Handle, uint64_t timeoutNs = ~0ull);
+
+    /// Copy the result to dst and release the request. Returns false, without blocking, if the data is not ready yet.
+    bool get(Handle &, void * dst, size_t size);
+
+    /// Drop the request without reading the data.
+    void release(Handle &);
+
+    /// Invoke callbacks of finished requests. Call once per frame.
+    void update();
+
+    /// Number of requests that are not released yet.
+    size_t pending() const;
+
+private:
+    struct Staging {
+        GLuint   buffer     = 0;
+        size_t   capacity   = 0;
+        size_t   size       = 0;
+        Fence    fence;
+        uint32_t generation = 0;
+        bool     busy       = false;
+        Callback callback;
+    };
+
+    std::vector<Staging> _pool;
+
+    Staging * find(Handle);
+    bool      poll(Staging &, uint64_t timeoutNs);
+    void      deliver(Staging &, void * dst, size_t size);
+    void      recycle(Staging &);
+};
+
+// -----------------------------------------------------------------------------
+/// Memory layout rules of uniform and shader storage blocks.
+enum class BlockLayout {
+    STD140,
+    STD430,
+};
+
+namespace lgi {
+// Layout of one member of a uniform/storage block. All values are in bytes.
+struct BlockMember {
+    size_t offset       = 0;
+    size_t align        = 0;
+    size_t size         = 0; ///< total size, including all array elements.
+    size_t arrayStride  = 0; ///< 0 for non-array members.
+    size_t matrixStride = 0; ///< 0 for non-matrix members.
+    size_t arraySize    = 0; ///< 0 for non-array members.
+    size_t columns      = 1;
+    size_t components   = 1; ///< components of each column.
+};
+
+constexpr size_t alignUp(size_t value, size_t alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+// Returns {components, columns} of GLSL types that can be used in a block.
+template<typename T>
+constexpr std::pair<size_t, size_t> blockMemberShape() {
+    if constexpr (std::is_same_v<T, float> || std::is_same_v<T, int> || std::is_same_v<T, unsigned int>)
+        return {1, 1};
+    else if constexpr (std::is_same_v<T, glm::vec2> || std::is_same_v<T, glm::ivec2> || std::is_same_v<T, glm::uvec2>)
+        return {2, 1};
+    else if constexpr (std::is_same_v<T, glm::vec3> || std::is_same_v<T, glm::ivec3> || std::is_same_v<T, glm::uvec3>)
+        return {3, 1};
+    else if constexpr (std::is_same_v<T, glm::vec4> || std::is_same_v<T, glm::ivec4> || std::is_same_v<T, glm::uvec4>)
+        return {4, 1};
+    else if constexpr (std::is_same_v<T, glm::mat3>)
+        return {3, 3};
+    else if constexpr (std::is_same_v<T, glm::mat4>)
+        return {4, 4};
+    else {
+        struct DependentFalse : public std::false_type {};
+        static_assert(DependentFalse::value, "unsupported block member type");
+    }
+}
+
+// Compute layout of a member of type T (which could be an array type like float[4]) by the rules of GLSL spec 7.6.2.2.
+template<BlockLayout LAYOUT, typename T>
+constexpr BlockMember blockMember() {
+    constexpr auto shape = blockMemberShape<std::remove_extent_t<T>>();
+    constexpr bool std140 = BlockLayout::STD140 == LAYOUT;
+
+    BlockMember m;
+    m.components = shape.first;
+    m.columns    = shape.second;
+    m.arraySize  = std::extent_v<T>;
+
+    // base alignment of a vector: N for scalar, 2N for vec2, 4N for vec3 and vec4.
+    size_t vecAlign = 1 == m.components ? 4 : 2 == m.components ? 8 : 16;
+    size_t elemSize = 0, elemAlign = 0;
+    if (m.columns > 1) {
+        // matrices are stored as arrays of column vectors.
+        m.matrixStride = std140 ? alignUp(vecAlign, 16) : vecAlign;
+        elemAlign      = m.matrixStride;
+        elemSize       = m.matrixStride * m.columns;
+    } else {
+        elemAlign = vecAlign;
+        elemSize  = m.components * 4;
+    }
+
+    if (m.arraySize > 0) {
+        // std140 rounds array stride and alignment up to vec4.
+        m.align       = std140 ? alignUp(elemAlign, 16) : elemAlign;
+        m.arrayStride = alignUp(elemSize, m.align);
+        m.size        = m.arrayStride * m.arraySize;
+    } else {
+        m.align = elemAlign;
+        m.size  = elemSize;
+    }
+    return m;
+}
+
+template<BlockLayout LAYOUT, typename... MEMBERS>
+constexpr std::array<BlockMember, sizeof...(MEMBERS)> blockMembers() {
+    std::array<BlockMember, sizeof...(MEMBERS)> members = {blockMember<LAYOUT, MEMBERS>()...};
+    size_t                                       offset  = 0;
+    for (size_t i = 0; i < members.size(); ++i) {
+        members[i].offset = alignUp(offset, members[i].align);
+        offset            = members[i].offset + members[i].size;
+    }
+    return members;
+}
+
+template<BlockLayout LAYOUT, size_t N>
+constexpr size_t blockSize(const std::array<BlockMember, N> & members) {
+    size_t end = 0, align = 4;
+    for (auto & m : members) {
+        end   = m.offset + m.size;
+        align = std::max(align, m.align);
+    }
+    return alignUp(end, BlockLayout::STD140 == LAYOUT ? alignUp(align, 16) : align);
+}
+
+// Verify the layout against the reflection of the linked program. Logs all mismatches.
+bool verifyBlockLayout(GLuint program, GLenum target, const char * blockName, size_t blockSize, const BlockMember * members,
+                       const char * const * names, size_t count);
+} // namespace lgi
+
+// -----------------------------------------------------------------------------
+// A uniform or shader storage block, described by its member types in declaration order. Offsets are computed at
+// compile time following the std140/std430 rules. Members are packed into a CPU copy of the block, which is then
+// uploaded with one buffer write. Supported member types are int, uint, float, glm vectors, glm::mat3, glm::mat4, and
+// arrays of them. For example:
+//
+//      // uniform PerFrame { mat4 viewProj; vec3 lightDir; float time; vec4 colors[4]; };
+//      UniformBlock<glm::mat4, glm::vec3, float, glm::vec4[4]> perFrame;
+//      perFrame.allocate();
+//      perFrame.verify(program, "PerFrame", {"viewProj", "lightDir", "time", "colors"});
+//      perFrame.set<0>(viewProj).set<2>(time).set<3>(glm::vec4(1.f), 2);
+//      perFrame.update();
+//      perFrame.bindBase(0);
+template<BlockLayout LAYOUT, GLenum TARGET, typename... MEMBERS>
+class ShaderBlock {
+public:
+    static_assert(sizeof...(MEMBERS) > 0, "empty block");
+
+    static constexpr size_t                              COUNT   = sizeof...(MEMBERS);
+    static constexpr std::array<lgi::BlockMember, COUNT> LAYOUT_ = lgi::blockMembers<LAYOUT, MEMBERS...>();
+    static constexpr size_t                              SIZE    = lgi::blockSize<LAYOUT>(LAYOUT_);
+
+    template<size_t I>
+    using MemberType = std::remove_extent_t<std::tuple_element_t<I, std::tuple<MEMBERS...>>>;
+
+    template<size_t I>
+    static constexpr size_t offset() {
+        return LAYOUT_[I].offset;
+    }
+
+    LGI_NO_COPY(ShaderBlock);
+    LGI_NO_MOVE(ShaderBlock);
+
+    ShaderBlock() = default;
+
+    ~ShaderBlock() { cleanup(); }
+
+    void allocate(GLenum usage = GL_DYNAMIC_DRAW) { _buffer.allocate(SIZE, 1, _data.data(), usage); }
+
+    void cleanup() { _buffer.cleanup(); }
+
+    /// Set value of member I (or element arrayIndex of member I, if it is an array) in the CPU copy of the block.
+    template<size_t I>
+    ShaderBlock & set(const MemberType<I> & value, size_t arrayIndex = 0) {
+        constexpr auto & m = LAYOUT_[I];
+        LGI_ASSERT(arrayIndex < std::max<size_t>(m.arraySize, 1));
+        auto dst = _data.data() + m.offset + arrayIndex * m.arrayStride;
+        auto src = (const uint8_t *) &value;
+        if constexpr (m.columns > 1) {
+            // C++ matrix columns are tightly packed. GLSL columns are matrixStride apart.
+            for (size_t c = 0; c < m.columns; ++c) std::memcpy(dst + c * m.matrixStride, src + c * m.components * 4, m.components * 4);
+        } else {
+            std::memcpy(dst, src, m.components * 4);
+        }
+        return *this;
+    }
+
+    const uint8_t * data() const { return _data.data(); }
+
+    /// Upload the whole block to GPU in one write.
+    void update() { _buffer.update(_data.data(), 0, SIZE); }
+
+    void bindBase(GLuint index) const { _buffer.bindBase(index); }
+
+    BufferObject<TARGET> & buffer() { return _buffer; }
+
+    /// Check the compile time layout against the linked program. Member names are as reported by program
+    /// introspection, e.g. "BlockInstance.member" for blocks with instance name. Members optimized out by the
+    /// compiler are skipped.
+    bool verify(GLuint program, const char * blockName, std::initializer_list<const char *> names) const {
+        LGI_REQUIRE(names.size() == COUNT, "expect %zu member names, got %zu.", COUNT, names.size());
+        return lgi::verifyBlockLayout(program, TARGET, blockName, SIZE, LAYOUT_.data(), names.begin(), COUNT);
+    }
+
+private:
+    std::array<uint8_t, SIZE> _data {};
+    BufferObject<TARGET>      _buffer;
+};
+
+template<typename... MEMBERS>
+using UniformBlock = ShaderBlock<BlockLayout::STD140, GL_UNIFORM_BUFFER, MEMBERS...>;
+
+template<typename... MEMBERS>
+using StorageBlock = ShaderBlock<BlockLayout::STD430, GL_SHADER_STORAGE_BUFFER, MEMBERS...>;
+
+// -----------------------------------------------------------------------------
+//
+class VertexArrayObject {
+    GLuint _va = 0;
+
+public:
+    ~VertexArrayObject() { cleanup(); }
+
+    void allocate() {
+        cleanup();
+        LGI_CHK(glGenVertexArrays(1, &_va));
+    }
+
+    void cleanup() {
+        if (_va) {
+            glDeleteVertexArrays(1, &_va);
+            StateCache::current().onVertexArrayDeleted(_va);
+            _va = 0;
+        }
+    }
+
+    void bind() const { StateCache::current().bindVertexArray(_va); }
+
+    void unbind() const { StateCache::current().bindVertexArray(0); }
+
+    operator GLuint() const { return _va; }
+};
+
+// -----------------------------------------------------------------------------
+//
+struct AutoShader {
+    GLuint shader;
+
+    AutoShader(GLuint s = 0): shader(s) {}
+    ~AutoShader() { cleanup(); }
+
+    void cleanup() {
+        if (shader) glDeleteShader(shader), shader = 0;
+    }
+
+    LGI_NO_COPY(AutoShader);
+
+    // can move
+    AutoShader(AutoShader && rhs): shader(rhs.shader) { rhs.shader = 0; }
+    AutoShader & operator=(AutoShader && rhs) {
+        if (this != &rhs) {
+            cleanup();
+            shader     = rhs.shader;
+            rhs.shader = 0;
+        }
+        return *this;
+    }
+
+    operator GLuint() const { return shader; }
+};
+
+class SamplerObject {
+    GLuint _id = 0;
+
+public:
+    SamplerObject() {}
+    ~SamplerObject() { cleanup(); }
+
+    LGI_NO_COPY(SamplerObject);
+
+    // can move
     SamplerObject(SamplerObject && that) {
         _id      = that._id;
         that._id = 0;
@@ -697,12 +1782,16 @@ public:
     }
 
     void cleanup() {
-        if (_id) glDeleteSamplers(1, &_id), _id = 0;
+        if (_id) {
+            glDeleteSamplers(1, &_id);
+            StateCache::current().onSamplerDeleted(_id);
+            _id = 0;
+        }
     }
 
     void bind(size_t unit) const {
         LGI_ASSERT(glIsSampler(_id));
-        glBindSampler((GLuint) unit, _id);
+        StateCache::current().bindSampler((GLuint) unit, _id);
     }
 
     void setParameter(GLenum pname, GLint param) const {
@@ -711,10 +1800,7 @@ public:
     }
 };
 
-inline void bindTexture(GLenum target, uint32_t stage, GLuint texture) {
-    LGI_DCHK(glActiveTexture(GL_TEXTURE0 + stage));
-    LGI_DCHK(glBindTexture(target, texture));
-}
+inline void bindTexture(GLenum target, uint32_t stage, GLuint texture) { StateCache::current().bindTexture(stage, target, texture); }
 
 class TextureObject {
 public:
@@ -723,12 +1809,14 @@ public:
     TextureObject & operator=(const TextureObject &) = delete;
 
     // can move
-    TextureObject(TextureObject && rhs) noexcept: _desc(rhs._desc) { rhs._desc.id = 0; }
+    TextureObject(TextureObject && rhs) noexcept: _desc(rhs._desc), _owned(rhs._owned), _fallbackFrom(rhs._fallbackFrom) { rhs._desc.id = 0; }
     TextureObject & operator=(TextureObject && rhs) noexcept {
         if (this != &rhs) {
             cleanup();
-            _desc        = rhs._desc;
-            rhs._desc.id = 0;
+            _desc         = rhs._desc;
+            _owned        = rhs._owned;
+            _fallbackFrom = rhs._fallbackFrom;
+            rhs._desc.id  = 0;
         }
         return *this;
     }
@@ -757,6 +1845,15 @@ public:
         bool isCube() const { return GL_TEXTURE_CUBE_MAP == target; }
 
         bool isCubeArray() const { return GL_TEXTURE_CUBE_MAP_ARRAY == target; }
+
+        /// Returns true if the two descriptors describe interchangeable textures. The id is ignored.
+        bool compatible(const TextureDesc & rhs) const {
+            return target == rhs.target && internalFormat == rhs.internalFormat && width == rhs.width && height == rhs.height && depth == rhs.depth &&
+                   mips == rhs.mips;
+        }
+
+        /// Estimated video memory size of the texture, including all mips.
+        size_t byteSize() const;
     };
 
     const TextureDesc & desc() const { return _desc; }
@@ -777,6 +1874,57 @@ public:
 
     void allocateCube(GLenum f, size_t w, size_t m = 1);
 
+    /// Allocate a texture matching the descriptor (except the id).
+    void allocate(const TextureDesc &);
+
+    /// Block footprint of a compressed internal format.
+    struct BlockInfo {
+        uint32_t width  = 1;
+        uint32_t height = 1;
+        uint32_t bytes  = 0; ///< bytes per block. 0 for uncompressed formats.
+
+        bool compressed() const { return bytes > 0; }
+    };
+
+    /// Returns block info of BC1-BC7, ETC2/EAC and ASTC formats, or {1, 1, 0} for anything else.
+    static BlockInfo blockInfo(GLenum internalFormat);
+
+    /// Bytes per row of blocks of a compressed image.
+    static size_t compressedRowPitch(GLenum internalFormat, size_t width);
+
+    /// Bytes of one layer of a compressed image. Partial blocks at the right and bottom edges are rounded up.
+    static size_t compressedImageSize(GLenum internalFormat, size_t width, size_t height);
+
+    /// Client format and type matching an uncompressed internal format, i.e. the layout that reads back from the
+    /// texture without conversion.
+    struct PixelFormat {
+        GLenum   format = GL_NONE;
+        GLenum   type   = GL_NONE;
+        uint32_t bytes  = 0; ///< bytes per pixel. 0 for compressed or unknown formats.
+    };
+
+    static PixelFormat pixelFormat(GLenum internalFormat);
+
+    /// Returns true if the current context can sample textures of the format. Results are cached per thread.
+    static bool isFormatSupported(GLenum internalFormat);
+
+    /// Uncompressed format that replaces an unsupported compressed one: GL_SRGB8_ALPHA8 for sRGB formats, GL_RGBA8
+    /// for everything else (BC6H loses its HDR range).
+    static GLenum fallbackFormat(GLenum internalFormat);
+
+    /// Decodes compressed blocks covering w x h pixels to tightly packed RGBA8. Used to feed textures whose compressed
+    /// format is not supported. Unsigned BC1-BC5 are decoded by the library; other formats need a decoder set here.
+    using BlockDecoder = std::function<bool(GLenum format, const void * blocks, size_t w, size_t h, uint8_t * rgba)>;
+
+    static void setFallbackDecoder(BlockDecoder);
+
+    /// Decode compressed blocks covering w x h pixels to tightly packed RGBA8, with the built-in decoder or the one set
+    /// by setFallbackDecoder(). Returns false if neither supports the format.
+    static bool decodeBlocks(GLenum internalFormat, const void * blocks, size_t w, size_t h, uint8_t * rgba);
+
+    /// The compressed format requested at allocation, if it has been replaced by fallbackFormat(). GL_NONE otherwise.
+    GLenum fallbackFrom() const { return _fallbackFrom; }
+
     void setPixels(size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels,
                    size_t rowlength, // number of pixels in each row. set to 0, if pixels are tightly packed.
                    GLenum format, GLenum type) const;
@@ -784,10 +1932,22 @@ public:
     // Set to rowPitchInBytes 0, if pixels are tightly packed.
     void setPixels(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t rowLength, GLenum format, GLenum type) const;
 
-    // jedi::ManagedRawImage getBaseLevelPixels() const;
+    /// Upload compressed blocks to a 2D or cube face texture. x and y must be multiples of the block size, and
+    /// sizeInBytes must be compressedImageSize(w, h).
+    void setCompressedPixels(size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const;
+
+    /// Upload compressed blocks to one layer of an array texture.
+    void setCompressedPixels(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const;
+
+    /// Read the base level of one layer (or cube face) back in the native pixel format of the texture. Rows are tightly
+    /// packed, bottom row first. This stalls the pipeline. Use TextureReadback in per frame code.
+    std::vector<uint8_t> getBaseLevelPixels(size_t layer = 0) const;
 
     void cleanup() {
-        if (_owned && _desc.id) { LGI_CHK(glDeleteTextures(1, &_desc.id)); }
+        if (_owned && _desc.id) {
+            LGI_CHK(glDeleteTextures(1, &_desc.id));
+            StateCache::current().onTextureDeleted(_desc.id);
+        }
         _desc.id             = 0;
         _desc.target         = GL_NONE;
         _desc.internalFormat = GL_NONE;
@@ -795,21 +1955,22 @@ public:
         _desc.height         = 0;
         _desc.depth          = 0;
         _desc.mips           = 0;
+        _fallbackFrom        = GL_NONE;
     }
 
-    void bind(size_t stage) const {
-        LGI_DCHK(glActiveTexture((GLenum) (GL_TEXTURE0 + stage)));
-        LGI_DCHK(glBindTexture(_desc.target, _desc.id));
-    }
+    void bind(size_t stage) const { StateCache::current().bindTexture((GLuint) stage, _desc.target, _desc.id); }
 
-    void unbind() const { glBindTexture(_desc.target, 0); }
+    void unbind() const { StateCache::current().bindTexture(_desc.target, 0); }
 
     operator GLuint() const { return _desc.id; }
 
 private:
     TextureDesc _desc;
-    bool        _owned = false;
+    bool        _owned        = false;
+    GLenum      _fallbackFrom = GL_NONE;
     void        applyDefaultParameters();
+    GLenum      resolveFormat(GLenum internalFormat, size_t w, size_t h);
+    void        uploadCompressed(size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * blocks, size_t sizeInBytes) const;
 };
 
 // -----------------------------------------------------------------------------
@@ -863,31 +2024,26 @@ public:
     uint32_t getFBO(size_t level) const { return _mips[level].fbo; }
 
     void setColorTextureFilter(uint32_t rt, GLint minFilter, GLint maxFilter) {
-        LGI_DCHK(glBindTexture(_colorTextureTarget, _colors[rt].texture));
+        StateCache::current().bindTexture(_colorTextureTarget, _colors[rt].texture);
         LGI_DCHK(glTexParameteri(_colorTextureTarget, GL_TEXTURE_MIN_FILTER, minFilter));
         LGI_DCHK(glTexParameteri(_colorTextureTarget, GL_TEXTURE_MAG_FILTER, maxFilter));
     }
 
     void bind(size_t level = 0) const {
-        for (GLsizei i = 0; i < COLOR_BUFFER_COUNT + 1; ++i) {
-            glActiveTexture(GLenum(GL_TEXTURE0 + i));
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+        auto & sc = StateCache::current();
+        // Unbinding is filtered by the state cache when the units are empty already.
+        for (GLsizei i = 0; i < COLOR_BUFFER_COUNT + 1; ++i) sc.bindTexture((GLuint) i, GL_TEXTURE_2D, 0);
         const auto & m = _mips[level];
-        glBindFramebuffer(GL_FRAMEBUFFER, m.fbo);
-        glViewport(0, 0, (GLsizei) m.width, (GLsizei) m.height);
+        sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo);
+        sc.viewport(0, 0, (GLsizei) m.width, (GLsizei) m.height);
     }
 
     void bindColorAsTexture(uint32_t rt, uint32_t stage) const {
         LGI_ASSERT(rt < (uint32_t) COLOR_BUFFER_COUNT);
-        glActiveTexture(GLenum(GL_TEXTURE0 + stage));
-        glBindTexture(_colorTextureTarget, _colors[rt].texture);
+        StateCache::current().bindTexture(stage, _colorTextureTarget, _colors[rt].texture);
     }
 
-    void bindDepthAsTexture(uint32_t stage) const {
-        glActiveTexture(GLenum(GL_TEXTURE0 + stage));
-        glBindTexture(GL_TEXTURE_2D, _depth);
-    }
+    void bindDepthAsTexture(uint32_t stage) const { StateCache::current().bindTexture(stage, GL_TEXTURE_2D, _depth); }
 
     GLenum getColorTarget() const { return _colorTextureTarget; }
     GLuint getColorTexture(size_t rt) const { return _colors[rt].texture; }
@@ -912,11 +2068,12 @@ public:
     ~CubeFBO() { cleanup(); }
 
     void cleanup() {
-        if (_color) glDeleteTextures(1, &_color), _color = 0;
-        if (_depth) glDeleteTextures(1, &_depth), _depth = 0;
+        auto & sc = StateCache::current();
+        if (_color) glDeleteTextures(1, &_color), sc.onTextureDeleted(_color), _color = 0;
+        if (_depth) glDeleteTextures(1, &_depth), sc.onTextureDeleted(_depth), _depth = 0;
         for (size_t i = 0; i < _mips.size(); ++i) {
             for (int f = 0; f < 6; ++f) {
-                if (_mips[i].fbo[f]) glDeleteFramebuffers(1, &_mips[i].fbo[f]), _mips[i].fbo[f] = 0;
+                if (_mips[i].fbo[f]) glDeleteFramebuffers(1, &_mips[i].fbo[f]), sc.onFramebufferDeleted(_mips[i].fbo[f]), _mips[i].fbo[f] = 0;
             }
         }
         _mips.clear();
@@ -933,26 +2090,345 @@ public:
     GLuint getDepthTexture() const { return _depth; }
 
     void bind(uint32_t face, uint32_t level = 0) const {
-        const auto & m = _mips[level];
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-        glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[face]);
-        glViewport(0, 0, (GLsizei) m.width, (GLsizei) m.width);
+        const auto & m  = _mips[level];
+        auto &       sc = StateCache::current();
+        sc.bindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
+        sc.bindFramebuffer(GL_FRAMEBUFFER, m.fbo[face]);
+        sc.viewport(0, 0, (GLsizei) m.width, (GLsizei) m.width);
     }
 
     void bindColorAsTexture(int slot = -1) const {
         auto stage = (slot >= 0) ? slot : 0;
-        glActiveTexture(GLenum(GL_TEXTURE0 + stage));
-        glBindTexture(GL_TEXTURE_CUBE_MAP, _color);
+        StateCache::current().bindTexture((GLuint) stage, GL_TEXTURE_CUBE_MAP, _color);
     }
 
     void bindDepthAsTexture(int slot = -1) const {
         auto stage = (slot >= 0) ? slot : 1;
-        glActiveTexture(GLenum(GL_TEXTURE0 + stage));
-        glBindTexture(GL_TEXTURE_CUBE_MAP, _depth);
+        StateCache::current().bindTexture((GLuint) stage, GL_TEXTURE_CUBE_MAP, _depth);
     }
 };
 
+// -----------------------------------------------------------------------------
+// CPU mip chain generator. Filtering runs in linear float space with SIMD kernels (AVX2/SSE2/NEON, scalar fallback),
+// and rows of each level are split across threads.
+struct MipmapGenerator {
+    enum class Format {
+        RGBA8,      ///< GL_RGBA8, filtered as is.
+        RGBA8_SRGB, ///< GL_SRGB8_ALPHA8, RGB channels are linearized before filtering. Alpha is linear.
+        RGBA16F,    ///< GL_RGBA16F
+        RGBA32F,    ///< GL_RGBA32F
+    };
+
+    enum class Filter {
+        BOX,    ///< 2x2 average. Fast.
+        KAISER, ///< Separable 8-tap Kaiser windowed sinc. Sharper, with less aliasing.
+    };
+
+    Format   format  = Format::RGBA8;
+    Filter   filter  = Filter::BOX;
+    uint32_t threads = 0; ///< 0 means std::thread::hardware_concurrency().
+
+    static size_t pixelSize(Format f) { return Format::RGBA32F == f ? 16 : (Format::RGBA16F == f ? 8 : 4); }
+
+    /// Generate levels 1..levels-1 from the tightly packed base level. Each level is half the size of the
+    /// previous one (rounded down, minimum 1). Set levels to 0 for the full chain.
+    std::vector<std::vector<uint8_t>> generate(const void * pixels, uint32_t width, uint32_t height, uint32_t levels = 0) const;
+
+    /// Upload the base level and all generated mips of one layer to the texture, via TextureObject::setPixels.
+    void upload(const TextureObject & texture, const void * pixels, size_t layer = 0) const;
+};
+
+// -----------------------------------------------------------------------------
+// Pool of transient textures (render targets, intermediate buffers, etc). Released textures are kept around and handed
+// out again to requests with a compatible TextureDesc, so steady state rendering allocates nothing. Idle textures are
+// evicted when they have not been reused for a few frames, or when the idle memory exceeds the cap.
+class TexturePool {
+public:
+    struct Stats {
+        uint64_t allocations  = 0; ///< textures created by the pool.
+        uint64_t reuses       = 0; ///< requests served from idle textures.
+        uint64_t evictions    = 0; ///< idle textures deleted.
+        size_t   idleTextures = 0;
+        size_t   idleBytes    = 0;
+        size_t   framebuffers = 0;
+    };
+
+    LGI_NO_COPY(TexturePool);
+    LGI_NO_MOVE(TexturePool);
+
+    TexturePool();
+
+    ~TexturePool();
+
+    uint32_t maxIdleFrames = 4;                 ///< idle textures unused for more frames than this are evicted.
+    size_t   maxIdleBytes  = 256 * 1024 * 1024; ///< idle textures beyond this size are evicted, oldest first.
+
+    /// Returns a texture matching the descriptor (id ignored). Content is undefined.
+    TextureObject acquire(const TextureObject::TextureDesc & desc);
+
+    TextureObject acquire2D(GLenum f, size_t w, size_t h, size_t m = 1) {
+        TextureObject::TextureDesc d;
+        d.target         = GL_TEXTURE_2D;
+        d.internalFormat = f;
+        d.width          = (uint32_t) w;
+        d.height         = (uint32_t) h;
+        d.depth          = 1;
+        d.mips           = (uint32_t) m;
+        return acquire(d);
+    }
+
+    /// Return the texture to the pool. It may be handed out again in the same frame, so release a texture only
+    /// after the last command using it is submitted.
+    void release(TextureObject && t);
+
+    /// Returns a cached frame buffer object with the given 2D textures attached to the specified level. The FBO is
+    /// owned by the pool and deleted when any of its textures is evicted or deleted, or when unused for maxIdleFrames.
+    /// Texture deletions are tracked through StateCache::onTextureDeleted() on the thread that created the pool, so a
+    /// texture name recycled by GL never hits an FBO attached to the deleted texture.
+    GLuint framebuffer(std::initializer_list<const TextureObject *> colors, const TextureObject * depth = nullptr, uint32_t level = 0);
+
+    /// Age idle textures and evict stale ones. Call once per frame.
+    void update();
+
+    /// Delete all idle textures and cached FBOs.
+    void cleanup();
+
+    /// Drop cached FBOs that the texture is attached to. Called by StateCache::onTextureDeleted().
+    void onTextureDeleted(GLuint);
+
+    const Stats & stats() const { return _stats; }
+
+private:
+    struct Idle {
+        TextureObject texture;
+        uint64_t      lastUsed;
+    };
+
+    struct Framebuffer {
+        GLuint   fbo       = 0;
+        GLuint   colors[8] = {};
+        GLuint   depth     = 0;
+        uint32_t level     = 0;
+        uint64_t lastUsed  = 0;
+    };
+
+    std::vector<Idle>        _idle;
+    std::vector<Framebuffer> _fbos;
+    uint64_t                 _frame = 0;
+    Stats                    _stats;
+    TexturePool *            _nextPool = nullptr; // next pool of the same thread.
+
+    friend class StateCache;
+
+    void evict(size_t index);
+    void deleteFramebuffer(size_t index);
+};
+
+// -----------------------------------------------------------------------------
+// Read only memory mapped file.
+class MappedFile {
+public:
+    LGI_NO_COPY(MappedFile);
+    LGI_NO_MOVE(MappedFile);
+
+    MappedFile() = default;
+
+    ~MappedFile() { close(); }
+
+    bool open(const std::string & path);
+
+    void close();
+
+    const uint8_t * data() const { return _data; }
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return !_data; }
+
+private:
+    const uint8_t * _data = nullptr;
+    size_t          _size = 0;
+#ifdef _WIN32
+    void * _file    = nullptr;
+    void * _mapping = nullptr;
+#endif
+};
+
+// -----------------------------------------------------------------------------
+/// Create texture from a KTX2 or DDS file, detected by file signature. The file is memory mapped, and each
+/// level/layer/face is uploaded straight from the mapped pages. Supports 2D, 2D array and cube textures of
+/// uncompressed and block compressed formats. Supercompressed KTX2 files are not supported. Returns false on failure.
+bool loadTexture(const std::string & path, TextureObject & texture);
+
+/// Same as loadTexture(), for file content already in memory.
+bool loadTextureFromMemory(const void * data, size_t size, TextureObject & texture);
+
+// -----------------------------------------------------------------------------
+// Texture atlas on top of a 2D array texture. Images are packed with MaxRects (best short side fit) and can be
+// inserted and removed at any time. Each image is surrounded by padding filled with its replicated edge pixels, and
+// padded rects are aligned to 2^(mips-1) so mip levels never mix neighbors. When all layers are full, the array grows
+// (up to maxLayers) and existing content is copied over on the GPU.
+class TextureAtlas {
+public:
+    struct Region {
+        uint32_t id    = 0; ///< 0 means invalid region.
+        uint32_t layer = 0;
+        uint32_t x = 0, y = 0, w = 0, h = 0; ///< content rect in pixels, excluding padding.
+        float    u0 = 0, v0 = 0, u1 = 0, v1 = 0; ///< content rect in texture coordinates. v0 is the first row of the image.
+
+        explicit operator bool() const { return 0 != id; }
+
+        /// UV rect in the (left, right, top, bottom) layout of ScreenQuad::update(), for images stored bottom-up.
+        glm::vec4 uv() const { return glm::vec4(u0, u1, v1, v0); }
+    };
+
+    LGI_NO_COPY(TextureAtlas);
+    LGI_NO_MOVE(TextureAtlas);
+
+    TextureAtlas() = default;
+
+    ~TextureAtlas() { cleanup(); }
+
+    /// @param size      width and height of each layer.
+    /// @param layers    initial number of layers.
+    /// @param maxLayers upper limit of layers when growing.
+    /// @param padding   pixels of replicated edge around each image.
+    /// @param mips      mip levels of the atlas. Mips of inserted images are generated with MipmapGenerator, which
+    ///                  requires 4 channel 8-bit, half or float pixels.
+    void allocate(GLenum internalFormat, uint32_t size, uint32_t layers = 1, uint32_t maxLayers = 16, uint32_t padding = 2, uint32_t mips = 1);
+
+    void cleanup();
+
+    /// Pack and upload a w x h image of tightly packed pixels. Returns an invalid region if it doesn't fit.
+    Region insert(uint32_t w, uint32_t h, const void * pixels, GLenum format, GLenum type);
+
+    /// Release the space of a region. Its pixels are left in the texture until overwritten.
+    void remove(uint32_t id);
+
+    /// Returns nullptr if the id is unknown.
+    const Region * find(uint32_t id) const;
+
+    const TextureObject & texture() const { return _texture; }
+
+    size_t regionCount() const { return _regions.size(); }
+
+private:
+    struct Rect {
+        uint32_t x = 0, y = 0, w = 0, h = 0;
+    };
+
+    struct Layer {
+        std::vector<Rect> free;
+        uint32_t          used = 0; // number of regions in the layer.
+    };
+
+    struct Entry {
+        Region region;
+        Rect   padded;
+    };
+
+    TextureObject                       _texture;
+    GLenum                              _internalFormat = GL_NONE;
+    uint32_t                            _size = 0, _maxLayers = 0, _padding = 0, _mips = 1;
+    std::vector<Layer>                  _layers;
+    std::unordered_map<uint32_t, Entry> _regions;
+    uint32_t                            _lastId = 0;
+
+    bool place(uint32_t w, uint32_t h, uint32_t & layer, Rect & rect);
+    void split(Layer &, const Rect & used);
+    void prune(Layer &);
+    void grow();
+};
+
+// -----------------------------------------------------------------------------
+// Asynchronous texture readback. read() packs one level and layer of a texture, or a rect of a frame buffer
+// attachment, into a pixel pack buffer and inserts a fence, without waiting for anything. Texture reads keep the
+// native pixel format of the texture. Same as BufferReadback, the result can be polled, waited on, or delivered to a
+// callback by update() a frame or more later, and pack buffers are pooled across requests.
+class TextureReadback {
+public:
+    struct Handle {
+        uint32_t index      = ~0u;
+        uint32_t generation = 0;
+
+        explicit operator bool() const { return ~0u != index; }
+    };
+
+    /// Pixels of a finished request. Rows are tightly packed, bottom row first.
+    struct Image {
+        const void * data   = nullptr;
+        size_t       size   = 0;
+        uint32_t     width  = 0;
+        uint32_t     height = 0;
+        GLenum       format = GL_NONE;
+        GLenum       type   = GL_NONE;
+    };
+
+    /// Called by update() when the pixels are ready. The data pointer is only valid during the call. Don't issue new
+    /// requests from within the callback.
+    using Callback = std::function<void(const Image &)>;
+
+    LGI_NO_COPY(TextureReadback);
+    LGI_NO_MOVE(TextureReadback);
+
+    TextureReadback() = default;
+
+    ~TextureReadback() { cleanup(); }
+
+    void cleanup();
+
+    /// Schedule a readback of one mip level. layer is the array layer, the face of a cube texture, or layer * 6 + face
+    /// of a cube array texture. Compressed textures are not supported.
+    Handle read(const TextureObject &, uint32_t level = 0, uint32_t layer = 0, Callback callback = {});
+
+    /// Schedule a readback of a rect of a frame buffer attachment: GL_COLOR_ATTACHMENTi, GL_DEPTH_ATTACHMENT,
+    /// GL_DEPTH_STENCIL_ATTACHMENT, or GL_BACK/GL_FRONT of the default frame buffer (fbo 0). Note that this changes the
+    /// read buffer of the frame buffer.
+    Handle read(GLuint fbo, GLenum attachment, int32_t x, int32_t y, uint32_t w, uint32_t h, GLenum format, GLenum type, Callback callback = {});
+
+    /// Check if the readback is done, without blocking.
+    bool ready(Handle);
+
+    /// Block until the readback is done, or the timeout expires. Returns true if the pixels are ready.
+    bool wait(Handle, uint64_t timeoutNs = ~0ull);
+
+    /// Bytes of the request's pixels. 0 for invalid handles.
+    size_t size(Handle) const;
+
+    /// Copy the pixels to dst and release the request. Returns false, without blocking, if they are not ready yet.
+    bool get(Handle &, void * dst, size_t size);
+
+    /// Drop the request without reading the pixels.
+    void release(Handle &);
+
+    /// Invoke callbacks of finished requests. Call once per frame.
+    void update();
+
+    /// Number of requests that are not released yet.
+    size_t pending() const;
+
+private:
+    struct Staging {
+        GLuint   buffer     = 0;
+        size_t   capacity   = 0;
+        Image    image;
+        Fence    fence;
+        uint32_t generation = 0;
+        bool     busy       = false;
+        Callback callback;
+    };
+
+    std::vector<Staging> _pool;
+    GLuint               _fbo = 0; // for reading textures that are not attached to any frame buffer.
+
+    Handle          pack(int32_t x, int32_t y, uint32_t w, uint32_t h, GLenum format, GLenum type, Callback);
+    Staging *       find(Handle);
+    const Staging * find(Handle) const;
+    bool            poll(Staging &, uint64_t timeoutNs);
+    void            deliver(Staging &, void * dst, size_t size);
+    void            recycle(Staging &);
+};
+
 // SSBO for in-shader debug output. Check out ftl/main_ps.glsl for example
 // usage. It is currently working on Windows only. Running it on Android crashes
 // the driver.
@@ -988,7 +2464,7 @@ struct DebugSSBO {
 
     void bind(GLuint slot = 15) const {
 #if LITESPD_GL_ENABLE_DEBUG_BUILD
-        if (g) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, slot, g);
+        if (g) StateCache::current().bindBufferBase(GL_SHADER_STORAGE_BUFFER, slot, g);
 #else
         (void) slot;
 #endif
@@ -1054,7 +2530,7 @@ struct ScreenQuad {
 
     const ScreenQuad & draw() const {
         LGI_ASSERT(va);
-        LGI_DCHK(glBindVertexArray(va));
+        StateCache::current().bindVertexArray(va);
         LGI_DCHK(glDrawArrays(GL_TRIANGLES, 0, 6));
         return *this;
     }
@@ -1141,12 +2617,33 @@ struct SimpleMesh {
         }
     };
 
+    /// Describes one per-instance vertex attribute of an instance stream.
+    struct InstanceAttribute {
+        GLuint location;           ///< must not overlap with per-vertex attributes (0-5).
+        GLint  components;         ///< 1, 2, 3 or 4.
+        GLenum type    = GL_FLOAT; ///< component type.
+        size_t offset  = 0;        ///< offset in bytes from the beginning of the instance.
+        bool   integer = false;    ///< set to true for attributes that are read as int/uint in shader.
+    };
+
+    /// A vertex buffer with per-instance data (divisor 1).
+    struct InstanceStream {
+        BufferObject<GL_ARRAY_BUFFER>  vb;
+        GLsizei                        stride   = 0; ///< size of one instance in bytes.
+        size_t                         capacity = 0; ///< max number of instances the buffer can hold.
+        std::vector<InstanceAttribute> attributes;
+    };
+
+    static constexpr size_t MAX_INSTANCE_STREAMS = 4;
+
     // vertex array
     GLuint                                va = 0;
     BufferObject<GL_ARRAY_BUFFER>         vb;
     BufferObject<GL_ELEMENT_ARRAY_BUFFER> ib;
     GLuint                                indexSize;
     GLenum                                indexType;
+    InstanceStream                        instances[MAX_INSTANCE_STREAMS];
+    size_t                                instanceStreamCount = 0;
 
     SimpleMesh() {}
 
@@ -1185,19 +2682,102 @@ struct SimpleMesh {
 
     SimpleMesh & cleanup();
 
-    const SimpleMesh & draw() const {
+    /// Attach a per-instance vertex stream to the mesh and return its index. Must be called after allocate(). A 4x4
+    /// matrix takes 4 attributes at consecutive locations, one for each column.
+    /// \param capacity Initial number of instances the stream can hold. The stream grows on demand in updateInstances().
+    /// \param data     Optional initial instance data. If not null, must contain capacity instances.
+    size_t addInstanceStream(GLsizei stride, const InstanceAttribute * attributes, size_t attributeCount, size_t capacity, const void * data = nullptr);
+
+    /// Upload per-instance data of a stream. The buffer is orphaned before upload, so that updating instance data every
+    /// frame doesn't wait for draws of previous frames that are still reading the old data.
+    void updateInstances(size_t stream, const void * data, size_t count);
+
+    const SimpleMesh & draw(GLsizei instanceCount = 1) const {
         LGI_ASSERT(va);
-        LGI_DCHK(glBindVertexArray(va));
+        StateCache::current().bindVertexArray(va);
         if (ib) {
-            LGI_DCHK(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ib));
-            LGI_DCHK(glDrawElements(GL_TRIANGLES, (GLsizei) (ib.length / indexSize), indexType, 0));
+            // The index buffer is part of the vertex array state, and the state cache never changes it behind our
+            // back. No need to bind it again.
+            auto count = (GLsizei) (ib.length / indexSize);
+            if (1 == instanceCount) {
+                LGI_DCHK(glDrawElements(GL_TRIANGLES, count, indexType, 0));
+            } else {
+                LGI_DCHK(glDrawElementsInstanced(GL_TRIANGLES, count, indexType, 0, instanceCount));
+            }
         } else {
-            LGI_DCHK(glDrawArrays(GL_TRIANGLES, 0, (GLsizei) (vb.length / sizeof(Vertex))));
+            auto count = (GLsizei) (vb.length / sizeof(Vertex));
+            if (1 == instanceCount) {
+                LGI_DCHK(glDrawArrays(GL_TRIANGLES, 0, count));
+            } else {
+                LGI_DCHK(glDrawArraysInstanced(GL_TRIANGLES, 0, count, instanceCount));
+            }
         }
         return *this;
     }
 };
 
+// -----------------------------------------------------------------------------
+// Layout of the draw command consumed by glDrawElementsIndirect and glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint  baseVertex;
+    GLuint baseInstance;
+};
+
+// -----------------------------------------------------------------------------
+// Pack many meshes of SimpleMesh::Vertex layout into shared vertex and index buffers, then draw all of them with one
+// glMultiDrawElementsIndirect call.
+//
+// Draw i is issued with baseInstance = i. Shaders can identify the draw either by gl_DrawID (GL 4.6 or
+// ARB_shader_draw_parameters), or by the per-instance attribute at DRAW_ID_LOCATION that holds the draw index, to
+// look up per-draw data stored in SSBO:
+//     layout(location = 6) in uint a_drawId;
+// OpenGL ES has neither multi-draw indirect nor non-zero base instance. On Android the batch falls back to one
+// glDrawElementsIndirect call per draw, and the draw ID attribute is always 0.
+class MeshBatch {
+public:
+    static constexpr GLuint DRAW_ID_LOCATION = 6;
+
+    /// Indirect draw commands, one for each added mesh. To update them (for example set instanceCount to 0 to cull a
+    /// mesh), modify them through commands.modify() then call syncCommands().
+    TypedBufferObject<DrawElementsIndirectCommand, GL_DRAW_INDIRECT_BUFFER> commands;
+
+    MeshBatch() = default;
+
+    ~MeshBatch() { cleanup(); }
+
+    LGI_NO_COPY_NO_MOVE(MeshBatch);
+
+    /// Append a mesh to the batch and return its draw index. Non-indexed mesh gets a trivial index list. The mesh is
+    /// not visible to GPU until next allocate(). Mesh data is copied, so the parameters can be released right away.
+    size_t add(const SimpleMesh::AllocateParameters &);
+
+    /// Upload all meshes added so far to GPU.
+    MeshBatch & allocate();
+
+    /// Release both GPU and CPU data.
+    MeshBatch & cleanup();
+
+    void syncCommands() { commands.syncGpuBuffer(); }
+
+    size_t size() const { return commands.c.size(); }
+
+    void draw() const { draw(0, size()); }
+
+    /// Draw meshes in range [first, first + count).
+    void draw(size_t first, size_t count) const;
+
+private:
+    std::vector<SimpleMesh::Vertex>       _vertices;
+    std::vector<uint32_t>                 _indices;
+    GLuint                                _va = 0;
+    BufferObject<GL_ARRAY_BUFFER>         _vb;
+    BufferObject<GL_ARRAY_BUFFER>         _drawIds;
+    BufferObject<GL_ELEMENT_ARRAY_BUFFER> _ib;
+};
+
 class SimpleGlslProgram {
     GLuint _program = 0;
 
@@ -1263,11 +2843,15 @@ public:
     //     gl::UpdateUniformValue(_uniforms[index].location, value);
     // }
 
-    void use() const { LGI_DCHK(glUseProgram(_program)); }
+    void use() const { StateCache::current().useProgram(_program); }
 
     void cleanup() {
         //_uniforms.clear();
-        if (_program) glDeleteProgram(_program), _program = 0;
+        if (_program) {
+            glDeleteProgram(_program);
+            StateCache::current().onProgramDeleted(_program);
+            _program = 0;
+        }
     }
 
     GLint getUniformLocation(const char * name_) const { return glGetUniformLocation(_program, name_); }
@@ -1397,6 +2981,651 @@ public:
     }
 };
 
+// -----------------------------------------------------------------------------
+// Spread buffer and texture uploads over multiple frames. Data is copied into a staging RingBuffer, then copied to
+// the destination on the GPU with glCopyBufferSubData or glTexSubImage* from the pixel unpack buffer. update() issues
+// pending uploads in priority order (FIFO within the same priority) until the per-frame byte or time budget runs
+// out. Large uploads are split into chunks. Completion callbacks fire once the GPU has finished copying the data.
+class UploadScheduler {
+public:
+    enum class Priority {
+        HIGH,
+        NORMAL,
+        LOW,
+        COUNT,
+    };
+
+    using Callback = std::function<void()>;
+
+    struct Budget {
+        size_t   bytesPerFrame = 4 * 1024 * 1024;
+        uint64_t nsPerFrame    = 2000000; ///< CPU time spent in update(), not counting completion callbacks.
+    };
+
+    struct Stats {
+        size_t   pendingJobs      = 0;
+        size_t   pendingBytes     = 0;
+        size_t   bytesLastFrame   = 0;
+        uint64_t nsLastFrame      = 0;
+        uint64_t totalBytes       = 0;
+        uint64_t completedJobs    = 0;
+        uint64_t overBudgetFrames = 0; ///< frames that left pending jobs because the budget ran out.
+    };
+
+    LGI_NO_COPY(UploadScheduler);
+    LGI_NO_MOVE(UploadScheduler);
+
+    UploadScheduler() = default;
+
+    ~UploadScheduler() { cleanup(); }
+
+    /// @param stagingSize Size of the staging ring buffer. Should hold a few frames worth of budget.
+    void init(size_t stagingSize = 16 * 1024 * 1024, uint32_t framesInFlight = 3);
+
+    void cleanup();
+
+    Budget budget;
+
+    /// Schedule a copy of data to [offset, offset + size) of the destination buffer. The data is copied right away,
+    /// so the caller doesn't need to keep it alive.
+    void uploadBuffer(GLuint buffer, size_t offset, const void * data, size_t size, Priority priority = Priority::NORMAL, Callback done = {});
+
+    /// Schedule upload of tightly packed pixels to a 2D region of the texture. Layer is ignored for 2D textures.
+    void uploadTexture(const TextureObject & texture, size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels,
+                       size_t sizeInBytes, GLenum format, GLenum type, Priority priority = Priority::NORMAL, Callback done = {});
+
+    /// Issue pending uploads within budget, and fire callbacks of finished ones. Call once per frame.
+    void update();
+
+    /// Issue all pending uploads regardless of budget, and wait for them to finish.
+    void finish();
+
+    const Stats & stats() const { return _stats; }
+
+private:
+    struct Job {
+        GLuint               buffer  = 0; // destination buffer, or 0 for texture jobs.
+        size_t               offset  = 0; // offset into destination buffer.
+        GLenum               target  = 0; // destination texture target.
+        GLuint               texture = 0;
+        size_t               layer = 0, level = 0, x = 0, y = 0, w = 0, h = 0;
+        GLenum               format = 0, type = 0;
+        std::vector<uint8_t> data;
+        size_t               progress = 0; // bytes uploaded so far.
+        Callback             done;
+    };
+
+    struct Batch {
+        Fence                 fence;
+        size_t                jobs = 0; // number of jobs finished by this batch.
+        std::vector<Callback> callbacks;
+    };
+
+    RingBuffer         _staging;
+    std::vector<Job>   _queues[(size_t) Priority::COUNT];
+    size_t             _heads[(size_t) Priority::COUNT] = {}; // first unfinished job of each queue.
+    std::vector<Batch> _inFlight;                             // uploads issued but not finished yet. oldest first.
+    Stats              _stats;
+
+    void   enqueue(Priority, Job &&);
+    size_t issue(size_t budgetBytes, uint64_t budgetNs);
+    size_t uploadChunk(Job &, size_t maxBytes);
+    void   complete(bool wait);
+};
+
+// -----------------------------------------------------------------------------
+// Streams texture content in the background. Worker threads decode mip levels straight into mapped pixel unpack
+// buffers, then update() on the GL thread copies them into the texture. Levels are loaded coarsest first and become
+// visible progressively by lowering GL_TEXTURE_BASE_LEVEL as each level lands.
+class TextureStreamer {
+public:
+    using Handle = uint64_t; ///< 0 is never a valid handle.
+
+    enum class Status {
+        UNKNOWN,   ///< Invalid handle, or the stream is forgotten.
+        LOADING,   ///< Some levels are still being decoded or uploaded.
+        LOADED,    ///< All levels are uploaded and visible.
+        FAILED,    ///< The decoder returned false or threw.
+        CANCELLED, ///< cancel() was called before the stream finished.
+    };
+
+    /// Called on a worker thread to produce tightly packed pixels of one layer of one mip level. Must write exactly
+    /// 'size' bytes to dst. Return false (or throw) to abort the whole stream.
+    using Decoder = std::function<bool(uint32_t layer, uint32_t level, void * dst, size_t size)>;
+
+    LGI_NO_COPY(TextureStreamer);
+    LGI_NO_MOVE(TextureStreamer);
+
+    TextureStreamer() = default;
+
+    ~TextureStreamer() { cleanup(); }
+
+    /// @param workers Number of decode threads.
+    /// @param slots   Number of pixel unpack buffers, i.e. maximum number of levels being decoded or uploaded at once.
+    void init(uint32_t workers = 2, uint32_t slots = 8);
+
+    void cleanup();
+
+    /// Start streaming all mip levels of the texture. The texture must stay alive until the stream is finished or
+    /// cancelled. Nothing is visible until the coarsest level is uploaded.
+    Handle load(const TextureObject & texture, GLenum format, GLenum type, size_t bytesPerPixel, Decoder decoder);
+
+    /// Stop streaming. The texture's original base and max levels are restored right away, so levels that were not
+    /// streamed yet keep whatever content they had before.
+    void cancel(Handle);
+
+    /// Upload decoded levels, update visible mip range and feed more work to decoders. Call once per frame.
+    void update();
+
+    /// Status of finished streams is kept until forget() or cleanup().
+    Status status(Handle) const;
+
+    bool loaded(Handle h) const { return Status::LOADED == status(h); }
+
+    /// Returns the finest level that was streamed and made visible, or number of mips if none was. Returns 0 for
+    /// loaded streams and for unknown handles.
+    uint32_t visibleLevel(Handle) const;
+
+    /// Drop the status of a finished stream. Does nothing to streams still loading.
+    void forget(Handle);
+
+    /// Number of streams still loading.
+    size_t pending() const;
+
+private:
+    class Impl;
+    Impl * _impl = nullptr;
+};
+
+// -----------------------------------------------------------------------------
+// Software virtual texture. Only tiles that are actually visible are kept in video memory:
+//  - a physical tile cache (GL_TEXTURE_2D_ARRAY) holds resident tiles;
+//  - a page table texture (one mip per virtual mip level) maps each virtual page to its cache slot, or to the slot of
+//    its closest resident ancestor;
+//  - a low resolution feedback pass, rendered with vtFeedback() from VirtualTexture::GLSL, tells which pages are needed.
+//    It is read back asynchronously, then update() streams missing tiles in and evicts least recently used ones.
+class VirtualTexture {
+public:
+    /// Fill one tile, including its border, with tileSize x tileSize tightly packed pixels. Called on the GL thread
+    /// from update(). Return false if the data is not available yet; the page will be requested again.
+    using TileLoader = std::function<bool(uint32_t pageX, uint32_t pageY, uint32_t level, void * pixels)>;
+
+    struct CreateParams {
+        uint32_t   width              = 0;                ///< virtual size in pixels.
+        uint32_t   height             = 0;                ///< virtual size in pixels.
+        uint32_t   tileSize           = 128;              ///< size of a cache tile in pixels, including borders.
+        uint32_t   border             = 4;                ///< pixels on each side of a tile duplicating its neighbors, for filtering.
+        uint32_t   cacheSize          = 2048;             ///< size of each layer of the tile cache in pixels.
+        uint32_t   cacheLayers        = 2;                ///< number of layers of the tile cache.
+        GLenum     internalFormat     = GL_RGBA8;         ///< format of the tile cache.
+        GLenum     format             = GL_RGBA;          ///< pixel format of tile data.
+        GLenum     type               = GL_UNSIGNED_BYTE; ///< pixel type of tile data.
+        size_t     pixelSize          = 4;                ///< bytes per pixel of tile data.
+        uint32_t   maxUploadsPerFrame = 16;
+        TileLoader loader;
+    };
+
+    struct Stats {
+        size_t   residentTiles     = 0;
+        size_t   capacity          = 0;
+        size_t   pendingTiles      = 0; ///< requested tiles not resident yet.
+        size_t   uploadsLastFrame  = 0;
+        uint64_t evictions         = 0;
+        size_t   requestsLastFrame = 0; ///< distinct pages seen in the last feedback.
+    };
+
+    /// GLSL (3.0 es / 3.3 core compatible) helpers. Paste into shaders after the #version line:
+    ///  - vec4 vtFeedback(vec2 uv, vec4 params, vec2 cacheInfo): output of the feedback pass.
+    ///  - vec4 vtSample(sampler2D pageTable, sampler2DArray cache, vec4 params, vec2 cacheInfo, vec2 uv)
+    /// params and cacheInfo come from shaderParams() and shaderCacheInfo().
+    static const char * const GLSL;
+
+    LGI_NO_COPY(VirtualTexture);
+    LGI_NO_MOVE(VirtualTexture);
+
+    VirtualTexture() = default;
+
+    ~VirtualTexture() { cleanup(); }
+
+    void init(const CreateParams &);
+
+    void cleanup();
+
+    /// Bind the feedback frame buffer, (re)allocated to the given size. Typically 1/8 to 1/16 of the screen.
+    void beginFeedback(uint32_t width, uint32_t height);
+
+    /// Schedule asynchronous read back of the feedback buffer. Skipped if the previous one is still in flight.
+    void endFeedback();
+
+    /// Process feedback, stream in missing tiles and update the page table. Call once per frame.
+    void update();
+
+    void bind(uint32_t pageTableStage, uint32_t cacheStage) const {
+        _pageTable.bind(pageTableStage);
+        _cache.bind(cacheStage);
+    }
+
+    const TextureObject & pageTable() const { return _pageTable; }
+
+    const TextureObject & cache() const { return _cache; }
+
+    /// (pages in x, pages in y, tile size, border) for the GLSL helpers.
+    std::array<float, 4> shaderParams() const {
+        return {(float) _pagesX, (float) _pagesY, (float) _cp.tileSize, (float) _cp.border};
+    }
+
+    /// (cache layer size, coarsest mip level of the page table) for the GLSL helpers.
+    std::array<float, 2> shaderCacheInfo() const { return {(float) _cp.cacheSize, (float) (_levels - 1)}; }
+
+    const Stats & stats() const { return _stats; }
+
+private:
+    struct Slot {
+        uint32_t page     = ~0u; // flat page index, or ~0 if free.
+        uint64_t lastUsed = 0;
+    };
+
+    struct PageRect {
+        uint32_t level, x0, y0, x1, y1; // pages [x0, x1) x [y0, y1) of one level.
+    };
+
+    CreateParams           _cp;
+    uint32_t               _pagesX = 0, _pagesY = 0, _levels = 0, _tilesPerRow = 0;
+    std::vector<uint32_t>  _levelOffsets; // flat index of the first page of each level.
+    std::vector<uint32_t>  _pageSlots;    // cache slot of each page, or ~0.
+    std::vector<uint8_t>   _queued;       // 1 if the page is in _missing.
+    std::vector<Slot>      _slots;
+    std::vector<uint32_t>  _freeSlots;
+    std::vector<uint32_t>  _missing;   // pages to load.
+    std::vector<uint32_t>  _requested; // pages from the last feedback.
+    std::vector<uint8_t>   _tile;      // staging for TileLoader.
+    std::vector<uint32_t>  _tableData;  // CPU copy of the page table, all levels.
+    std::vector<uint32_t>  _dirtyPages; // pages loaded or evicted since the last page table update.
+    std::vector<PageRect>  _dirtyRects; // page table regions rewritten by updatePageTable().
+    TextureObject          _cache;
+    TextureObject          _pageTable;
+    SimpleFBO              _feedback;
+    GLuint                 _feedbackPbo  = 0;
+    size_t                 _feedbackSize = 0;
+    BufferReadback         _readback;
+    BufferReadback::Handle _inFlight;
+    uint64_t               _frame = 0;
+    Stats                  _stats;
+
+    uint32_t pageIndex(uint32_t x, uint32_t y, uint32_t level) const { return _levelOffsets[level] + y * levelPagesX(level) + x; }
+    uint32_t levelPagesX(uint32_t level) const { return std::max(1u, _pagesX >> level); }
+    uint32_t levelPagesY(uint32_t level) const { return std::max(1u, _pagesY >> level); }
+    void     pageCoords(uint32_t page, uint32_t & x, uint32_t & y, uint32_t & level) const;
+    void     onFeedback(const uint8_t * pixels, size_t count);
+    uint32_t allocateSlot();
+    void     updatePageTable();
+};
+
+// -----------------------------------------------------------------------------
+// CPU side command buffer. Recording never touches GL, so worker threads can each record into their own command
+// buffer, while the thread that owns the GL context replays them in order with execute(). Command payloads (including
+// uniform values and buffer/texture data) are copied into a linear arena that is kept across reset(), so recording
+// doesn't allocate in steady state.
+//
+// Objects referenced by recorded commands must stay alive until the command buffer is executed.
+class CommandBuffer {
+public:
+    CommandBuffer() = default;
+
+    LGI_NO_COPY(CommandBuffer);
+    LGI_DEFAULT_MOVE(CommandBuffer);
+
+    /// Discard all recorded commands. The arena memory is kept for reuse.
+    void reset() {
+        _arena.clear();
+        _count = 0;
+    }
+
+    bool empty() const { return 0 == _count; }
+
+    /// Number of recorded commands.
+    size_t count() const { return _count; }
+
+    /// Size of the recorded commands in bytes.
+    size_t bytes() const { return _arena.size(); }
+
+    /// Replay all recorded commands. Must be called on the thread that owns the GL context.
+    void execute() const;
+
+    void useProgram(GLuint program) { push(Op::USE_PROGRAM, program); }
+
+    void bindVertexArray(GLuint va) { push(Op::BIND_VERTEX_ARRAY, va); }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint id) { push(Op::BIND_TEXTURE, BindTexture {unit, target, id}); }
+
+    void bindTexture(GLuint unit, const TextureObject & t) { bindTexture(unit, t.target(), t.id()); }
+
+    void bindSampler(GLuint unit, GLuint sampler) { push(Op::BIND_SAMPLER, BindTexture {unit, GL_NONE, sampler}); }
+
+    void bindBuffer(GLenum target, GLuint bo) { push(Op::BIND_BUFFER, BindBuffer {target, 0, bo, 0, 0}); }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint bo) { push(Op::BIND_BUFFER_RANGE, BindBuffer {target, index, bo, 0, 0}); }
+
+    void bindBufferRange(GLenum target, GLuint index, GLuint bo, GLintptr offset, GLsizeiptr size) {
+        push(Op::BIND_BUFFER_RANGE, BindBuffer {target, index, bo, offset, size});
+    }
+
+    void bindFramebuffer(GLuint fbo) { push(Op::BIND_FRAMEBUFFER, fbo); }
+
+    void viewport(GLint x, GLint y, GLsizei w, GLsizei h) { push(Op::VIEWPORT, Viewport {x, y, w, h}); }
+
+    /// Record uniform update. Supports the same value types as SimpleUniform.
+    template<typename T>
+    void uniform(GLint location, const T & value) {
+        if (location < 0) return;
+        if constexpr (std::is_same_v<std::vector<float>, T>) {
+            pushUniform(location, UniformType::FLOAT, (GLsizei) value.size(), value.data(), value.size() * sizeof(float));
+        } else {
+            pushUniform(location, uniformType<T>(), 1, &value, sizeof(T));
+        }
+    }
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instances = 1) { push(Op::DRAW_ARRAYS, DrawArrays {mode, first, count, instances}); }
+
+    /// \param offset Offset of the first index in the index buffer, in bytes.
+    void drawElements(GLenum mode, GLsizei count, GLenum type, size_t offset = 0, GLsizei instances = 1) {
+        push(Op::DRAW_ELEMENTS, DrawElements {mode, count, type, instances, offset});
+    }
+
+    void draw(const SimpleMesh & mesh, GLsizei instances = 1) {
+        bindVertexArray(mesh.va);
+        if (mesh.ib) {
+            drawElements(GL_TRIANGLES, (GLsizei) (mesh.ib.length / mesh.indexSize), mesh.indexType, 0, instances);
+        } else {
+            drawArrays(GL_TRIANGLES, 0, (GLsizei) (mesh.vb.length / sizeof(SimpleMesh::Vertex)), instances);
+        }
+    }
+
+    void draw(const ScreenQuad & quad) {
+        bindVertexArray(quad.va);
+        drawArrays(GL_TRIANGLES, 0, 6);
+    }
+
+    void dispatch(GLuint x, GLuint y = 1, GLuint z = 1) { push(Op::DISPATCH, Dispatch {x, y, z}); }
+
+    void memoryBarrier(GLbitfield barriers) { push(Op::MEMORY_BARRIER, barriers); }
+
+    /// Record buffer update. The data is copied into the command buffer.
+    void updateBuffer(GLenum target, GLuint bo, size_t offset, size_t size, const void * data) {
+        push(Op::UPDATE_BUFFER, UpdateBuffer {target, bo, offset, size}, data, size);
+    }
+
+    template<typename T, GLenum TARGET, size_t N>
+    void updateBuffer(const BufferObject<TARGET, N> & bo, const T * ptr, size_t offset = 0, size_t count = 1) {
+        updateBuffer(TARGET, bo, offset * sizeof(T), count * sizeof(T), ptr);
+    }
+
+    /// Record update to one layer of a texture. The pixels must be tightly packed and are copied into the command buffer.
+    /// For 2D texture, layer must be 0.
+    void setPixels(const TextureObject & t, size_t layer, size_t level, size_t x, size_t y, size_t w, size_t h, const void * pixels, size_t sizeInBytes,
+                   GLenum format, GLenum type) {
+        SetPixels p = {t.target(), t.id(), (GLint) level, (GLint) x, (GLint) y, (GLint) layer, (GLsizei) w, (GLsizei) h, format, type};
+        push(Op::SET_PIXELS, p, pixels, sizeInBytes);
+    }
+
+private:
+    enum class Op : uint32_t {
+        USE_PROGRAM,
+        BIND_VERTEX_ARRAY,
+        BIND_TEXTURE,
+        BIND_SAMPLER,
+        BIND_BUFFER,
+        BIND_BUFFER_RANGE,
+        BIND_FRAMEBUFFER,
+        VIEWPORT,
+        UNIFORM,
+        DRAW_ARRAYS,
+        DRAW_ELEMENTS,
+        DISPATCH,
+        MEMORY_BARRIER,
+        UPDATE_BUFFER,
+        SET_PIXELS,
+    };
+
+    enum class UniformType : uint32_t {
+        INT,
+        UINT,
+        FLOAT,
+        VEC2,
+        VEC3,
+        VEC4,
+        IVEC2,
+        IVEC3,
+        IVEC4,
+        UVEC2,
+        UVEC3,
+        UVEC4,
+        MAT3,
+        MAT4,
+    };
+
+    // Every command starts with a header, followed by fixed sized payload and then optional variable sized data.
+    // Commands are 8-byte aligned in the arena.
+    struct Header {
+        Op       op;
+        uint32_t size; // size of the whole command in bytes, including header and padding.
+    };
+
+    struct BindTexture {
+        GLuint unit;
+        GLenum target;
+        GLuint id;
+    };
+
+    struct BindBuffer {
+        GLenum     target;
+        GLuint     index;
+        GLuint     bo;
+        GLintptr   offset;
+        GLsizeiptr size; // 0 means the whole buffer.
+    };
+
+    struct Viewport {
+        GLint   x, y;
+        GLsizei w, h;
+    };
+
+    struct Uniform {
+        GLint       location;
+        UniformType type;
+        GLsizei     count;
+    };
+
+    struct DrawArrays {
+        GLenum  mode;
+        GLint   first;
+        GLsizei count;
+        GLsizei instances;
+    };
+
+    struct DrawElements {
+        GLenum  mode;
+        GLsizei count;
+        GLenum  type;
+        GLsizei instances;
+        size_t  offset;
+    };
+
+    struct Dispatch {
+        GLuint x, y, z;
+    };
+
+    struct UpdateBuffer {
+        GLenum target;
+        GLuint bo;
+        size_t offset;
+        size_t size;
+    };
+
+    struct SetPixels {
+        GLenum  target;
+        GLuint  id;
+        GLint   level, x, y, z;
+        GLsizei w, h;
+        GLenum  format, type;
+    };
+
+    std::vector<uint8_t> _arena;
+    size_t               _count = 0;
+
+    template<typename T>
+    void push(Op op, const T & payload, const void * data = nullptr, size_t dataSize = 0) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        size_t size = (sizeof(Header) + sizeof(T) + dataSize + 7) & ~size_t(7);
+        LGI_REQUIRE(size <= UINT32_MAX, "command is too large");
+        size_t offset = _arena.size();
+        _arena.resize(offset + size);
+        Header h = {op, (uint32_t) size};
+        std::memcpy(&_arena[offset], &h, sizeof(h));
+        std::memcpy(&_arena[offset + sizeof(h)], &payload, sizeof(T));
+        if (dataSize) std::memcpy(&_arena[offset + sizeof(h) + sizeof(T)], data, dataSize);
+        ++_count;
+    }
+
+    void pushUniform(GLint location, UniformType type, GLsizei count, const void * data, size_t dataSize) {
+        push(Op::UNIFORM, Uniform {location, type, count}, data, dataSize);
+    }
+
+    template<typename T>
+    static constexpr UniformType uniformType() {
+        if constexpr (std::is_same_v<T, int>)
+            return UniformType::INT;
+        else if constexpr (std::is_same_v<T, unsigned int>)
+            return UniformType::UINT;
+        else if constexpr (std::is_same_v<T, float>)
+            return UniformType::FLOAT;
+        else if constexpr (std::is_same_v<T, glm::vec2>)
+            return UniformType::VEC2;
+        else if constexpr (std::is_same_v<T, glm::vec3>)
+            return UniformType::VEC3;
+        else if constexpr (std::is_same_v<T, glm::vec4>)
+            return UniformType::VEC4;
+        else if constexpr (std::is_same_v<T, glm::ivec2>)
+            return UniformType::IVEC2;
+        else if constexpr (std::is_same_v<T, glm::ivec3>)
+            return UniformType::IVEC3;
+        else if constexpr (std::is_same_v<T, glm::ivec4>)
+            return UniformType::IVEC4;
+        else if constexpr (std::is_same_v<T, glm::uvec2>)
+            return UniformType::UVEC2;
+        else if constexpr (std::is_same_v<T, glm::uvec3>)
+            return UniformType::UVEC3;
+        else if constexpr (std::is_same_v<T, glm::uvec4>)
+            return UniformType::UVEC4;
+        else if constexpr (std::is_same_v<T, glm::mat3>)
+            return UniformType::MAT3;
+        else if constexpr (std::is_same_v<T, glm::mat4>)
+            return UniformType::MAT4;
+        else {
+            struct DependentFalse : public std::false_type {};
+            static_assert(DependentFalse::value, "unsupported uniform type");
+        }
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Collect draw packets of a frame, sort them by 64-bit sort key to minimize state changes, then submit them in one go.
+// The default sort key draws opaque packets first, grouped by program, textures and vertex array, then front-to-back
+// within each group; transparent packets are drawn after that, back-to-front.
+class DrawQueue {
+public:
+    /// Max number of textures per packet. Texture i is bound to texture unit i.
+    static constexpr size_t MAX_TEXTURES = 4;
+
+    struct Packet {
+        GLuint                program   = 0;
+        GLuint                va        = 0;
+        GLenum                mode      = GL_TRIANGLES;
+        GLsizei               count     = 0;       ///< number of vertices or indices to draw.
+        GLenum                indexType = GL_NONE; ///< GL_NONE for non-indexed draw.
+        GLsizei               instances = 1;
+        GLuint                textures[MAX_TEXTURES]       = {};
+        GLenum                textureTargets[MAX_TEXTURES] = {};
+        const SimpleUniform * uniforms     = nullptr; ///< optional uniforms to apply after the program is in use.
+        size_t                uniformCount = 0;
+        float                 depth        = 0.f; ///< view space distance to camera. Used by the default sort key.
+        bool                  transparent  = false;
+
+        Packet & setProgram(const SimpleGlslProgram & p) {
+            program = p;
+            return *this;
+        }
+
+        Packet & setMesh(const SimpleMesh & m) {
+            va = m.va;
+            if (m.ib) {
+                count     = (GLsizei) (m.ib.length / m.indexSize);
+                indexType = m.indexType;
+            } else {
+                count     = (GLsizei) (m.vb.length / sizeof(SimpleMesh::Vertex));
+                indexType = GL_NONE;
+            }
+            return *this;
+        }
+
+        Packet & setTexture(size_t unit, GLenum target, GLuint id) {
+            LGI_ASSERT(unit < MAX_TEXTURES);
+            textures[unit]       = id;
+            textureTargets[unit] = target;
+            return *this;
+        }
+
+        Packet & setTexture(size_t unit, const TextureObject & t) { return setTexture(unit, t.target(), t.id()); }
+
+        Packet & setUniforms(const SimpleUniform * u, size_t n) {
+            uniforms     = u;
+            uniformCount = n;
+            return *this;
+        }
+    };
+
+    struct Stats {
+        size_t packets       = 0; ///< number of packets submitted in last flush.
+        size_t stateChanges  = 0; ///< number of program, texture and vertex array changes after sorting.
+        size_t unsortedState = 0; ///< number of state changes if packets were drawn in submission order.
+
+        size_t saved() const { return unsortedState > stateChanges ? unsortedState - stateChanges : 0; }
+    };
+
+    /// Build the default sort key of a packet.
+    static uint64_t makeKey(const Packet &);
+
+    /// Add a packet to the queue using the default sort key.
+    void submit(const Packet & p) { submit(p, makeKey(p)); }
+
+    /// Add a packet to the queue with custom sort key. Packets are drawn in ascending order of the key.
+    void submit(const Packet & p, uint64_t key) {
+        _packets.push_back(p);
+        _keys.push_back(key);
+    }
+
+    /// Sort and draw all queued packets, then clear the queue.
+    void flush();
+
+    /// Discard all queued packets.
+    void clear() {
+        _packets.clear();
+        _keys.clear();
+    }
+
+    size_t size() const { return _packets.size(); }
+
+    const Stats & stats() const { return _stats; }
+
+private:
+    std::vector<Packet>   _packets;
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _order, _temp; // scratch buffers of the radix sort, kept across frames.
+    Stats                 _stats;
+
+    void sort();
+};
+
 // -----------------------------------------------------------------------------
 // For asynchronous timer (not time stamp) queries
 struct GpuTimeElapsedQuery {
@@ -1489,6 +3718,61 @@ private:
     bool               _started = false;
 };
 
+// -----------------------------------------------------------------------------
+// Track frames in flight with one fence per frame. beginFrame() blocks when the CPU gets more than
+// maxFramesInFlight() frames ahead of the GPU. Subsystems can defer recycling of per-frame resources until the GPU is
+// done with the frame that used them, or keep maxFramesInFlight() copies of a resource indexed by frameSlot().
+class FrameManager {
+public:
+    LGI_NO_COPY(FrameManager);
+    LGI_NO_MOVE(FrameManager);
+
+    explicit FrameManager(uint32_t maxFramesInFlight = 2): _maxFramesInFlight(std::max(maxFramesInFlight, 1u)) {}
+
+    ~FrameManager() { cleanup(); }
+
+    /// Waits for the GPU to go idle first, so resources indexed by frameSlot() are safe to reuse.
+    void setMaxFramesInFlight(uint32_t n);
+
+    uint32_t maxFramesInFlight() const { return _maxFramesInFlight; }
+
+    /// Index of the frame being recorded.
+    uint64_t frameIndex() const { return _frameIndex; }
+
+    /// Index of the per-frame resource copy to use in current frame.
+    uint32_t frameSlot() const { return (uint32_t) (_frameIndex % _maxFramesInFlight); }
+
+    /// Frames with index below this value are finished by the GPU.
+    uint64_t completedFrames() const { return _completed; }
+
+    /// Run the callback once the GPU finishes the current frame.
+    void defer(std::function<void()> recycle) { _pending.push_back(std::move(recycle)); }
+
+    void beginFrame();
+
+    void endFrame();
+
+    /// Wait for all frames in flight, and run all deferred callbacks.
+    void waitIdle();
+
+    void cleanup();
+
+private:
+    struct Frame {
+        uint64_t                           index = 0;
+        Fence                              fence;
+        std::vector<std::function<void()>> recyclers;
+    };
+
+    std::vector<Frame>                 _inFlight; // oldest first.
+    std::vector<std::function<void()>> _pending;  // recyclers of current frame.
+    uint64_t                           _frameIndex = 0;
+    uint64_t                           _completed  = 0;
+    uint32_t                           _maxFramesInFlight;
+
+    bool retire(bool wait);
+};
+
 // -----------------------------------------------------------------------------
 // Manage an OpenGL context
 class RenderContext {
@@ -1499,11 +3783,16 @@ public:
     using WindowHandle = intptr_t;
 
     struct CreateParams {
-        uint32_t     width          = 1280;
-        uint32_t     height         = 720;
-        WindowHandle externalWindow = 0;
-        bool         shared         = false; ///< Set to true to create a shared OpenGL context of the current context.
-        bool         debug          = LITESPD_GL_ENABLE_DEBUG_BUILD;
+        uint32_t     width            = 1280;
+        uint32_t     height           = 720;
+        WindowHandle externalWindow   = 0;
+        bool         shared           = false; ///< Set to true to create a shared OpenGL context of the current context.
+        bool         debug            = LITESPD_GL_ENABLE_DEBUG_BUILD;
+        uint32_t     framesInFlight   = 2; ///< max number of frames the CPU can get ahead of the GPU.
+        /// Process GL debug messages synchronously on the thread that issues the GL call. Easier to set a break point
+        /// on, and GL errors are logged with a backtrace. When false, messages are queued and logged by a background
+        /// thread, with repeated messages rate-limited and no backtrace.
+        bool         debugSynchronous = false;
     };
 
     RenderContext(const CreateParams & params);
@@ -1520,6 +3809,9 @@ public:
     void endFrame();   ///< End current frame and present to screen. Must be called in paif with an successfull call to
                        ///< beginFrame.
 
+    /// Frames in flight of this context. Driven by beginFrame() and endFrame().
+    FrameManager & frames();
+
     // unbound render context from current thread.
     static void clearCurrent();
 };